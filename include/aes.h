@@ -29,6 +29,14 @@
   #define CTR 1
 #endif
 
+// AES_TTABLE selects the block cipher backend used by every mode above.
+// 1 = 32-bit T-table rounds (one 1KB table, SubBytes/ShiftRows/MixColumns done as word lookups)
+// 0 = original byte-wise tiny-AES rounds (smallest code, slowest)
+// Both produce identical output, decryption always uses the byte-wise path.
+#ifndef AES_TTABLE
+  #define AES_TTABLE 1
+#endif
+
 
 #define AES128 1
 //#define AES192 1
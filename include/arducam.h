@@ -1,5 +1,57 @@
-#include "hardware/spi.h"
-#include "pico/stdlib.h"
+#ifndef _ARDUCAM_H_
+#define _ARDUCAM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+
+// 1 = frames are read from the FIFO by DMA in CAMERA_DMA_CHUNK sized chunks
+// 0 = frames are read with a single spi_read_blocking call
+#ifndef CAMERA_DMA
+#define CAMERA_DMA 1
+#endif
+
+#ifndef CAMERA_DMA_CHUNK
+#define CAMERA_DMA_CHUNK 1400
+#endif
+
+// 1 = frames read from the camera are checked: core 1 drops those that don't start with the JPEG SOI
+//     marker and end with EOI and captures again, and the CRC-32 of the rest goes in the stream header
+//     for the receiver to check (see frame_check.h). With CAMERA_DMA the DMA sniffer works the CRC out
+//     while the frame is read, with no CPU time, otherwise core 1 does after the readout.
+#ifndef FRAME_CHECK
+#define FRAME_CHECK 1
+#endif
+
+// Frames failing their checks in a row before the camera is reset
+#ifndef FRAME_CHECK_RESETS
+#define FRAME_CHECK_RESETS 3
+#endif
+
+// 1 = the next capture is triggered as soon as the previous frame has been read from the FIFO,
+//     so the sensor works on frame N+1 while frame N is handed off and sent
+// 0 = a capture is only triggered when camera_take_picture() is called
+#ifndef CAMERA_PIPELINE
+#define CAMERA_PIPELINE 1
+#endif
+
+// With EVENT_WAITS, time between two reads of a status register while waiting for the camera
+#ifndef CAMERA_POLL_US
+#define CAMERA_POLL_US 200
+#endif
+
+// Capture resolution, register 0x21
+enum camera_resolution {
+    CAMERA_RES_QVGA = 1,
+    CAMERA_RES_VGA = 2
+};
+
+// JPEG quality, register 0x2A
+enum camera_quality {
+    CAMERA_QUALITY_HIGH = 0,
+    CAMERA_QUALITY_DEFAULT = 1,
+    CAMERA_QUALITY_LOW = 2
+};
 
 /**
  * Read register "reg" for arducam camera
@@ -12,8 +64,36 @@ uint8_t read_register(uint8_t reg);
  * @param buf Index 0 is for the register, index 1 is for the value to write
  */
 void write_register(uint8_t buf[2]);
+
+/**
+ * Waits for a picture and returns its length
+ * A capture is triggered first, unless CAMERA_PIPELINE already triggered one after the last readout
+ * @returns the byte size of the image
+ */
 uint32_t camera_take_picture();
 
+// Timing of the last frame through the camera
+struct camera_timing {
+    // Capture trigger until the capture done flag was seen
+    uint32_t capture_us;
+    // Reading the frame out of the FIFO
+    uint32_t readout_us;
+    // Rest of the frame period, the camera was neither capturing nor being read
+    uint32_t idle_us;
+    // End of the previous readout until the end of this one
+    uint32_t period_us;
+};
+
+/**
+ * @returns Timing of the last frame read from the camera
+ */
+const struct camera_timing *camera_last_timing();
+
+/**
+ * Prints the frame rate and average capture, readout and idle time since the last report
+ */
+void camera_timing_report();
+
 /**
  * Get the length of the picture taken by the arducam
  * @warning Must call camera_take_picture() first
@@ -34,7 +114,60 @@ void camera_wait();
  */
 void load_image(uint8_t *buf, uint32_t size);
 
+#if FRAME_CHECK
+/**
+ * @returns CRC-32 of the last frame read from the camera, see frame_crc32()
+ * @warning Only valid once the whole frame is in the buffer
+ */
+uint32_t load_image_crc();
+#endif
+
+#if CAMERA_DMA
+/**
+ * Claims the DMA channels used to read the camera FIFO
+ * @warning Must be called from the core that reads the camera, the DMA interrupt is enabled on that core
+ */
+void camera_dma_init();
+
+/**
+ * Starts reading the image frame into "buf" in CAMERA_DMA_CHUNK sized chunks and returns straight away
+ * @warning Must call load_image_finish() before talking to the camera again
+ */
+void load_image_start(uint8_t *buf, uint32_t size);
+
+/**
+ * @returns Amount of bytes of the current frame that are already in the buffer
+ */
+uint32_t load_image_progress();
+
+/**
+ * @returns Amount of chunks of the current frame that are already in the buffer
+ */
+uint32_t load_image_chunks();
+
+/**
+ * Waits until the whole frame is in the buffer and ends the burst read
+ */
+void load_image_finish();
+#endif
+
 /**
  * Resets and configures camera to video mode
+ * The mode is VGA at default quality, with no limit on the frame rate.
  */
-void camera_start();
\ No newline at end of file
+void camera_start();
+
+/**
+ * Changes resolution and JPEG quality from the next capture on
+ * A capture already started in the old mode is waited for and thrown away.
+ */
+void camera_set_mode(enum camera_resolution resolution, enum camera_quality quality);
+
+/**
+ * Paces captures at most one per "interval_us", 0 = as fast as the camera goes
+ * While paced the next capture is no longer started straight after a readout
+ * (CAMERA_PIPELINE) but when it is due.
+ */
+void camera_set_frame_interval(uint32_t interval_us);
+
+#endif // _ARDUCAM_H_
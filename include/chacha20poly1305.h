@@ -0,0 +1,73 @@
+#ifndef _CHACHA20POLY1305_H_
+#define _CHACHA20POLY1305_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * ChaCha20-Poly1305 authenticated encryption (RFC 8439).
+ * Picked over AES-GCM for the RP2040: ChaCha20 is only 32-bit adds, XORs and rotates, which
+ * the Cortex-M0+ does in a cycle each, with no tables and no key dependent memory accesses.
+ * GHASH needs a 64-bit carry-less multiply the M0+ doesn't have, or several KB of tables.
+ * Poly1305 keeps its state in five 26-bit limbs so every product is a 32x32->64 multiply.
+ *
+ * Every message needs its own nonce under a key, reusing one leaks the Poly1305 key.
+ */
+
+#define CHACHA20_KEYLEN 32
+#define CHACHA20_NONCELEN 12
+#define POLY1305_TAGLEN 16
+
+struct poly1305_ctx {
+    uint32_t r[5];
+    uint32_t h[5];
+    uint32_t pad[4];
+    // Partial block waiting for more input
+    uint8_t buf[16];
+    uint32_t buf_len;
+};
+
+/**
+ * XORs "len" bytes of "buf" with the ChaCha20 keystream starting at block "counter"
+ */
+void chacha20_xor(const uint8_t *key, const uint8_t *nonce, uint32_t counter, uint8_t *buf, size_t len);
+
+/**
+ * @param key 32 byte one-time key
+ */
+void poly1305_init(struct poly1305_ctx *ctx, const uint8_t *key);
+void poly1305_update(struct poly1305_ctx *ctx, const uint8_t *data, size_t len);
+/**
+ * Pads what was added so far with zeroes to a multiple of 16 bytes, as the AEAD construction does
+ */
+void poly1305_pad(struct poly1305_ctx *ctx);
+void poly1305_finish(struct poly1305_ctx *ctx, uint8_t *tag);
+
+/**
+ * Encrypts "buf" in place and computes the tag over "aad" and the ciphertext
+ * @param tag POLY1305_TAGLEN bytes out
+ */
+void chacha20poly1305_encrypt(const uint8_t *key, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+    uint8_t *buf, size_t len, uint8_t *tag);
+
+/**
+ * Computes the tag of a message that is already encrypted, without touching it
+ */
+void chacha20poly1305_tag(const uint8_t *key, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+    const uint8_t *ciphertext, size_t len, uint8_t *tag);
+
+/**
+ * Checks "tag" against the ciphertext in constant time
+ * @returns false if the message or the additional data was changed, or the key or nonce is wrong
+ */
+bool chacha20poly1305_verify(const uint8_t *key, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+    const uint8_t *ciphertext, size_t len, const uint8_t *tag);
+
+/**
+ * Checks the tag and decrypts "buf" in place, "buf" is left as it was if the tag is wrong
+ */
+bool chacha20poly1305_decrypt(const uint8_t *key, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+    uint8_t *buf, size_t len, const uint8_t *tag);
+
+#endif // _CHACHA20POLY1305_H_
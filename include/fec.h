@@ -0,0 +1,34 @@
+#ifndef _FEC_H_
+#define _FEC_H_
+
+#include <stdint.h>
+
+/**
+ * XOR parity forward error correction for the stream's fragments.
+ * The fragments of a frame are split into groups of "group" fragments (the last group may
+ * be shorter) and each group is followed by one parity fragment: the XOR of the group's
+ * fragments, shorter ones padded with zeroes. A receiver missing exactly one fragment of
+ * a group gets it back by XORing the parity with the fragments it has.
+ *
+ * The parity covers the fragments as the receiver keeps them before the final decryption:
+ * with CTR the plaintext, the parity itself is then CTR encrypted with fragment index
+ * FEC_PARITY_COUNTER | group, with CBC the ciphertext, sent as is. AEAD works like CTR,
+ * the parity gets its own nonce and tag (see stream_auth_nonce()).
+ */
+
+// Set in the fragment index part of the CTR counter for parity fragments
+#define FEC_PARITY_COUNTER 0x8000
+
+/**
+ * parity ^= data for "len" bytes
+ */
+void fec_xor(uint8_t *parity, const uint8_t *data, uint32_t len);
+
+/**
+ * @returns Number of parity groups for "count" fragments
+ */
+static inline uint32_t fec_groups(uint32_t count, uint32_t group) {
+    return (count + group - 1) / group;
+}
+
+#endif // _FEC_H_
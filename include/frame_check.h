@@ -0,0 +1,42 @@
+#ifndef _FRAME_CHECK_H_
+#define _FRAME_CHECK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Integrity checks of the frames read from the camera.
+ * A JPEG starts with the SOI marker (FF D8) and ends with EOI (FF D9). A frame cut short or
+ * shifted by a FIFO or SPI glitch is missing one of them. The CRC-32 of the frame as read is
+ * sent along in the stream header (STREAM_FLAG_CRC) so the receiver can tell whether the frame it
+ * put back together is the one that left the camera. On the Pico the DMA sniffer works it out
+ * while the frame is read, frame_crc32() is the same CRC in software for the simulator and
+ * the receivers.
+ */
+
+// Bytes after EOI still accepted, the FIFO length can be a little longer than the JPEG
+#ifndef FRAME_CHECK_TAIL
+#define FRAME_CHECK_TAIL 8
+#endif
+
+/**
+ * CRC-32 as in zlib's crc32() and Ethernet (reflected, polynomial 0x04C11DB7)
+ * @param crc 0 to start, or the CRC of the data before "data"
+ */
+uint32_t frame_crc32(uint32_t crc, const uint8_t *data, size_t len);
+
+/**
+ * @param len Bytes of the frame read so far
+ * @returns true if the frame starts with SOI
+ */
+static inline bool frame_check_start(const uint8_t *buf, uint32_t len) {
+    return len >= 2 && buf[0] == 0xFF && buf[1] == 0xD8;
+}
+
+/**
+ * @returns true if the frame ends with EOI, at most FRAME_CHECK_TAIL bytes before its end
+ */
+bool frame_check_end(const uint8_t *buf, uint32_t len);
+
+#endif // _FRAME_CHECK_H_
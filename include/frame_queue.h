@@ -0,0 +1,144 @@
+#ifndef _FRAME_QUEUE_H_
+#define _FRAME_QUEUE_H_
+
+#include <stdint.h>
+
+/**
+ * Ring of frame slots shared between the camera core (producer) and the UDP core (consumer).
+ * Single producer / single consumer: "head" is only written by the producer and "tail" only
+ * by the consumer. Publishing a slot is a release store of head, taking it an acquire load,
+ * so the frame data and length written by one core are visible to the other before the slot is.
+ * No read-modify-write atomics are used, the Cortex-M0+ has none.
+ * The consumer can keep slots it is done with (frame_queue_keep()), e.g. to resend parts
+ * of a frame. Kept slots are given back oldest first with frame_queue_release_kept(), "tail"
+ * never moves past a kept slot so the producer can't overwrite it.
+ */
+
+// Number of frame slots in the ring, each slot holds one whole frame
+#ifndef FRAME_QUEUE_SLOTS
+#define FRAME_QUEUE_SLOTS 3
+#endif
+
+// "ready" of a frame published with frame_queue_publish_partial() that turned out to be corrupt,
+// the consumer stops sending it
+#define FRAME_SLOT_CORRUPT UINT32_MAX
+
+enum frame_queue_policy {
+    // Every frame is sent in order, the camera waits while the ring is full
+    FRAME_QUEUE_BLOCK,
+    // Only the newest queued frame is sent, older queued frames are dropped
+    FRAME_QUEUE_DROP_OLDEST
+};
+
+struct frame_slot {
+    uint8_t *buf;
+    // Length of the whole frame
+    uint32_t len;
+    // Bytes of the frame already in buf, less than len while the frame is still being read
+    uint32_t ready;
+    // Capture time, set by the producer before the slot is published
+    uint32_t time_us;
+    // CRC-32 of the frame (FRAME_CHECK), set by the producer before "ready" reaches "len"
+    uint32_t crc;
+    // Consumer only: slot was kept after reading it, see frame_queue_keep()
+    uint8_t kept;
+};
+
+struct frame_queue {
+    struct frame_slot slots[FRAME_QUEUE_SLOTS];
+    uint32_t slot_size;
+    enum frame_queue_policy policy;
+    // Written by the producer only
+    uint32_t head;
+    uint8_t producer_waiting;
+    // Written by the consumer only
+    // Slots before "tail" are given back to the producer, slots from "tail" to "read" are
+    // read and kept or waiting behind a kept one
+    uint32_t tail;
+    uint32_t read;
+
+    // Drop counters, each one is only written by one core
+    // Producer: times the ring was full when a new frame could have been captured
+    uint32_t full;
+    // Producer: frame rejected before it was queued (bad length, camera error)
+    uint32_t dropped_capture;
+    // Producer: frame that failed its checks after it was read (FRAME_CHECK), either before
+    // it was queued or, published partially, before its last fragment
+    uint32_t dropped_corrupt;
+    // Consumer: queued frame skipped for a newer one (FRAME_QUEUE_DROP_OLDEST)
+    uint32_t dropped_stale;
+    // Consumer: frame that failed to send
+    uint32_t dropped_send;
+};
+
+/**
+ * Sets up the ring over "storage"
+ * @param storage FRAME_QUEUE_SLOTS * slot_size bytes
+ * @param slot_size Size in bytes of a single frame slot
+ */
+void frame_queue_init(struct frame_queue *q, uint8_t *storage, uint32_t slot_size, enum frame_queue_policy policy);
+
+/**
+ * Producer: slot that the next frame should be written to
+ * @returns NULL if the ring is full
+ */
+struct frame_slot *frame_queue_write_slot(struct frame_queue *q);
+
+/**
+ * Producer: hands the slot returned by frame_queue_write_slot() to the consumer
+ * @param len Amount of bytes written to the slot
+ */
+void frame_queue_publish(struct frame_queue *q, uint32_t len);
+
+/**
+ * Producer: hands the slot returned by frame_queue_write_slot() to the consumer before
+ * the frame data is in it. The consumer follows the data with frame_slot_ready().
+ * @param len Length of the whole frame
+ */
+void frame_queue_publish_partial(struct frame_queue *q, uint32_t len);
+
+/**
+ * Producer: updates how much of the last published frame is in its slot
+ * @param ready Amount of bytes from the start of the frame that are in the slot, or
+ *              FRAME_SLOT_CORRUPT to give up on the frame
+ */
+void frame_queue_set_ready(struct frame_queue *q, uint32_t ready);
+
+/**
+ * Consumer: oldest queued frame, or the newest one with FRAME_QUEUE_DROP_OLDEST
+ * @returns NULL if no frame is queued
+ */
+struct frame_slot *frame_queue_read_slot(struct frame_queue *q);
+
+/**
+ * Consumer: gives the slot returned by frame_queue_read_slot() back to the producer
+ * If older slots are still kept it only goes back once they have been given back.
+ */
+void frame_queue_release(struct frame_queue *q);
+
+/**
+ * Consumer: done with the slot returned by frame_queue_read_slot() but keeps it,
+ * the producer can't reuse it until frame_queue_release_kept() gives it back
+ */
+void frame_queue_keep(struct frame_queue *q);
+
+/**
+ * Consumer: gives the oldest kept slot back to the producer
+ */
+void frame_queue_release_kept(struct frame_queue *q);
+
+/**
+ * Consumer: amount of bytes from the start of the frame in "slot" that can be read
+ */
+static inline uint32_t frame_slot_ready(const struct frame_slot *slot) {
+    return __atomic_load_n(&slot->ready, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @returns Index of "slot" in the ring
+ */
+static inline uint32_t frame_queue_index(const struct frame_queue *q, const struct frame_slot *slot) {
+    return slot - q->slots;
+}
+
+#endif // _FRAME_QUEUE_H_
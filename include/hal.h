@@ -0,0 +1,273 @@
+#ifndef _HAL_H_
+#define _HAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Thin hardware abstraction layer used by the camera driver and the streaming pipeline.
+ * src/hal_pico.c implements it for the Pico W (SPI, GPIO, DMA, both cores, lwIP),
+ * sim/hal_sim.c for Linux with a simulated ArduCAM and a UDP socket, so the same
+ * pipeline code can be run and benchmarked off target.
+ */
+
+// 1 = the cores sleep while they wait for each other, the camera or the network and wake up
+// on a doorbell (hal_core_notify()), an interrupt or a timer. 0 = they spin.
+#ifndef EVENT_WAITS
+#define EVENT_WAITS 1
+#endif
+
+// How long hal_udp_unpin() waits for the network stack to let go of a frame buffer before it
+// stops feeding the watchdog and lets it reset the device
+#ifndef UNPIN_TIMEOUT_US
+#define UNPIN_TIMEOUT_US 1000000
+#endif
+
+/**
+ * Sets up SPI and the camera chip select pin
+ * @param spi_hz SPI clock in Hz
+ */
+void hal_init(uint32_t spi_hz);
+
+/**
+ * Drives the camera chip select pin
+ * @param level false selects the camera
+ */
+void hal_cs_put(bool level);
+
+/**
+ * Full duplex SPI transfer of "len" bytes
+ */
+void hal_spi_write_read(const uint8_t *tx, uint8_t *rx, size_t len);
+
+/**
+ * Reads "len" bytes while sending "repeated_tx"
+ */
+void hal_spi_read(uint8_t repeated_tx, uint8_t *dst, size_t len);
+
+// Called when a background read started with hal_spi_read_async() has finished,
+// runs in interrupt context on the Pico
+typedef void (*hal_read_done_fn)(void);
+
+/**
+ * Sets up background SPI reads and the callback that signals their completion
+ * @warning On the Pico this must be called from the core that reads the camera, the interrupt is enabled on that core
+ */
+void hal_spi_async_init(hal_read_done_fn done);
+
+/**
+ * Starts reading "len" bytes into "dst" in the background (DMA on the Pico) and returns straight away
+ */
+void hal_spi_read_async(uint8_t *dst, size_t len);
+
+/**
+ * Starts a CRC-32 over the bytes the next hal_spi_read_async() calls read, see frame_crc32()
+ * On the Pico the DMA sniffer works it out as the data goes by.
+ */
+void hal_spi_crc_start();
+
+/**
+ * @returns CRC-32 of the bytes read since hal_spi_crc_start(), once those reads have finished
+ */
+uint32_t hal_spi_crc();
+
+/**
+ * @returns Microseconds since boot
+ */
+uint64_t hal_time_us();
+
+void hal_sleep_us(uint64_t us);
+void hal_sleep_ms(uint32_t ms);
+
+/**
+ * Runs "entry" on the second core
+ */
+void hal_launch_core1(void (*entry)(void));
+
+/**
+ * Wakes the other core if it is sleeping in hal_core_wait(), or makes its next
+ * hal_core_wait() return straight away
+ */
+void hal_core_notify();
+
+/**
+ * Sleeps until the other core calls hal_core_notify(), an interrupt on this core or
+ * "until_us" (hal_time_us() clock). Can return early, callers check again what they wait for.
+ */
+void hal_core_wait(uint64_t until_us);
+
+/**
+ * @returns Time "core" spent sleeping in hal_core_wait() and hal_net_wait_until() since boot.
+ *          Read from the other core it can be torn, it is only meant for reports.
+ */
+uint64_t hal_core_idle_us(uint8_t core);
+
+/**
+ * @returns 0 or 1, the core the caller runs on
+ */
+uint8_t hal_core_num();
+
+/**
+ * Keeps the watchdog from resetting the device
+ */
+void hal_watchdog_update();
+
+/**
+ * @returns 32 random bits, different after every reset
+ */
+uint32_t hal_random32();
+
+/**
+ * Opens the UDP socket used for the video stream
+ * @returns false if it could not be opened
+ */
+bool hal_udp_connect(const char *ip, uint16_t port);
+
+// Tracks datagrams that still reference a frame buffer after hal_udp_send() returned
+struct hal_udp_pin {
+    // Only changed with the network stack locked, hal_udp_unpin() reads it without
+    uint32_t pending;
+};
+
+/**
+ * Sends one datagram made of "header" followed by "payload"
+ * The header is always copied.
+ * @param pin If not NULL the payload is referenced instead of copied and must not be
+ *            changed until hal_udp_unpin() returns. NULL copies the payload.
+ * @returns 0 on success, the network stack's error code otherwise
+ */
+int hal_udp_send(const uint8_t *header, uint16_t header_len, const uint8_t *payload, uint16_t len, struct hal_udp_pin *pin);
+
+/**
+ * @returns Total amount of bytes copied by hal_udp_send() into network buffers
+ */
+uint64_t hal_udp_bytes_copied();
+
+/**
+ * Waits until no datagram references the buffers tracked by "pin" anymore
+ * If that takes longer than UNPIN_TIMEOUT_US the watchdog is no longer fed and resets the device.
+ */
+void hal_udp_unpin(struct hal_udp_pin *pin);
+
+// Use of one of the fixed buffer pools hal_udp_send() takes network buffers from
+struct hal_pool_stats {
+    const char *name;
+    uint32_t block_size;
+    uint16_t count;
+    uint16_t in_use;
+    uint16_t peak;
+    // Sends that found the pool empty, they fail with an error instead of waiting
+    uint32_t failures;
+};
+
+/**
+ * @param stats Filled with up to "max" pools
+ * @returns Number of pools filled in
+ */
+uint32_t hal_pool_stats(struct hal_pool_stats *stats, uint32_t max);
+
+// RAM used by the whole program
+struct hal_mem_usage {
+    // RAM there is in total, 0 where it isn't fixed
+    uint32_t ram_bytes;
+    // Initialised and zeroed data, everything laid out at link time
+    uint32_t static_bytes;
+    // Most the heap has ever grown to, and what is allocated from it now
+    uint32_t heap_peak;
+    uint32_t heap_in_use;
+};
+
+void hal_mem_usage(struct hal_mem_usage *usage);
+
+// hal_cycles() wraps at this on every platform, the Pico's SysTick only has 24 bits
+#define HAL_CYCLES_MASK 0xFFFFFFu
+
+/**
+ * @returns CPU clock cycles on the calling core, (end - start) & HAL_CYCLES_MASK is only right
+ * for spans under 2^24 cycles (134 ms at 125 MHz)
+ */
+uint32_t hal_cycles();
+
+// Memories behind the bus fabric whose accesses can be counted
+enum hal_bus_region {
+    HAL_BUS_SRAM0,
+    HAL_BUS_SRAM1,
+    HAL_BUS_SRAM2,
+    HAL_BUS_SRAM3,
+    HAL_BUS_SRAM4,
+    HAL_BUS_SRAM5,
+    HAL_BUS_XIP,
+    HAL_BUS_REGIONS
+};
+
+// Accesses by any master (both cores, DMA), and those that stalled behind another master
+struct hal_bus_count {
+    uint64_t accesses;
+    uint64_t contested;
+};
+
+/**
+ * Picks the two regions hal_bus_count_add() counts, counting starts from zero
+ * Nothing is counted in the simulator.
+ */
+void hal_bus_count_select(uint8_t region_a, uint8_t region_b);
+
+/**
+ * Sets the counts back to zero, the XIP cache counts too
+ */
+void hal_bus_count_clear();
+
+/**
+ * Adds what was counted since the last clear to "counts[0]" (region_a) and "counts[1]" (region_b)
+ */
+void hal_bus_count_add(struct hal_bus_count *counts);
+
+// Lookups in the XIP cache flash is read through, by any master, and how many of them hit
+struct hal_cache_count {
+    uint64_t accesses;
+    uint64_t hits;
+};
+
+/**
+ * Adds the XIP cache lookups and hits since the last hal_bus_count_clear() to "count"
+ */
+void hal_cache_count_add(struct hal_cache_count *count);
+
+/**
+ * Empties the XIP cache so the next reads from flash miss, for measuring the cold case
+ */
+void hal_cache_flush();
+
+// Called with every datagram received on the stream socket, on core 0 from hal_net_poll()
+// or while sending. "data" is only valid during the call.
+typedef void (*hal_udp_recv_fn)(const uint8_t *data, uint16_t len);
+
+/**
+ * Sets the function datagrams sent back to the stream socket by the server go to
+ */
+void hal_udp_set_recv(hal_udp_recv_fn recv);
+
+/**
+ * Opens the side channel trace batches are sent over
+ * @returns false if it could not be opened
+ */
+bool hal_trace_connect(const char *ip, uint16_t port);
+
+/**
+ * Sends one trace batch as a datagram, copied
+ */
+void hal_trace_send(const uint8_t *data, uint16_t len);
+
+/**
+ * Gives the network stack time to do its work
+ */
+void hal_net_poll();
+
+/**
+ * Serves the network stack until "time_us" (hal_time_us() clock), sleeping while there is
+ * nothing to do instead of spinning
+ */
+void hal_net_wait_until(uint64_t time_us);
+
+#endif // _HAL_H_
@@ -0,0 +1,88 @@
+#ifndef _KEYSTREAM_H_
+#define _KEYSTREAM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "aes.h"
+
+/**
+ * Ring of precomputed AES-CTR keystream, one fragment per entry, so a fragment can be encrypted
+ * with a plain XOR. The camera core fills it while it would otherwise wait, the UDP core uses it.
+ * Single producer / single consumer like frame_queue.h: "head" is only written by the producer,
+ * "tail" only by the consumer, with release stores and acquire loads between them.
+ *
+ * Frame ids are known in advance, core 0 numbers frames in order, but their length isn't.
+ * Entries are generated in (frame id, fragment) order up to the fragment count of the last frame
+ * plus a margin, then the producer moves on to the next frame. The consumer skips entries of
+ * fragments a frame didn't have, and encrypts any fragment that wasn't generated in time itself.
+ */
+
+// Entries in the ring, each one is a whole fragment of keystream
+#ifndef KEYSTREAM_FRAGMENTS
+#define KEYSTREAM_FRAGMENTS 8
+#endif
+
+// Fragments generated past the fragment count of the last frame, frame sizes vary a little
+#ifndef KEYSTREAM_MARGIN
+#define KEYSTREAM_MARGIN 2
+#endif
+
+struct keystream_tag {
+    uint32_t frame_id;
+    uint16_t fragment;
+};
+
+struct keystream_ring {
+    uint8_t *storage;
+    uint32_t entry_size;
+    struct keystream_tag tags[KEYSTREAM_FRAGMENTS];
+    // Written by the producer only
+    uint32_t head;
+    // Producer's own context, the counter block changes for every entry
+    struct AES_ctx ctx;
+    uint8_t iv[AES_BLOCKLEN];
+    uint32_t next_id;
+    uint16_t next_fragment;
+    // Written by the consumer only
+    uint32_t tail;
+    // Oldest frame still to be sent, the producer skips ahead to it if it fell behind
+    uint32_t first_id;
+    // Fragments of the last frame sent, until then a whole ring's worth
+    uint16_t fragments_hint;
+    // Consumer: fragments XORed with a ready entry, fragments encrypted on the consumer's
+    // core, entries generated for fragments a frame didn't have
+    uint32_t used;
+    uint32_t missed;
+    uint32_t skipped;
+};
+
+/**
+ * Sets up the ring over "storage", the first frame is "first_id"
+ * @param storage KEYSTREAM_FRAGMENTS * entry_size bytes, entry_size is the longest fragment
+ */
+void keystream_init(struct keystream_ring *k, uint8_t *storage, uint32_t entry_size, const uint8_t *key,
+    const uint8_t *iv, uint32_t first_id);
+
+/**
+ * Producer: generates the next entry
+ * @returns false if the ring is full and there was nothing to do
+ */
+bool keystream_fill(struct keystream_ring *k);
+
+/**
+ * Consumer: keystream for a fragment, drops entries of earlier fragments on the way
+ * @returns entry_size bytes, valid until keystream_release(), or NULL if it isn't ready
+ */
+const uint8_t *keystream_take(struct keystream_ring *k, uint32_t frame_id, uint16_t fragment);
+
+/**
+ * Consumer: gives back the entry returned by keystream_take()
+ */
+void keystream_release(struct keystream_ring *k);
+
+/**
+ * Consumer: a frame was sent with "fragments" fragments, the producer moves on to the next one
+ */
+void keystream_frame_done(struct keystream_ring *k, uint32_t frame_id, uint16_t fragments);
+
+#endif // _KEYSTREAM_H_
@@ -0,0 +1,38 @@
+#ifndef _LATENCY_HIST_H_
+#define _LATENCY_HIST_H_
+
+#include <stdint.h>
+
+/**
+ * Fixed size latency histogram in microseconds
+ * Values below 64 us get their own bucket, above that every power of two is split
+ * into 16 buckets (about 6% resolution) up to 16 s. Recording is a few shifts and an
+ * increment, so it can be used inside the pipeline loops. Each histogram must only be
+ * written by one core.
+ */
+
+#define LATENCY_LINEAR 64
+#define LATENCY_SUB_BUCKETS 16
+#define LATENCY_MAX_BIT 24
+#define LATENCY_BUCKETS (LATENCY_LINEAR + (LATENCY_MAX_BIT - 6) * LATENCY_SUB_BUCKETS)
+
+struct latency_hist {
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t buckets[LATENCY_BUCKETS];
+};
+
+/**
+ * Adds one sample
+ * @param us Latency in microseconds
+ */
+void latency_record(struct latency_hist *h, uint32_t us);
+
+/**
+ * @param pct Percentile between 0 and 100
+ * @returns Latency in microseconds that "pct" percent of the samples are at or below, 0 if there are none
+ */
+uint32_t latency_percentile(const struct latency_hist *h, uint32_t pct);
+
+#endif // _LATENCY_HIST_H_
@@ -0,0 +1,62 @@
+#ifndef _MEM_POOL_H_
+#define _MEM_POOL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Fixed number of equally sized blocks handed out from a static array
+ * Allocating and freeing take a block off and put it back on a free list in constant time,
+ * nothing is ever taken from the heap, so a device running for weeks can't fragment it.
+ * Running out is counted instead of being an error the caller has to recover from.
+ * Not thread safe, every call for one pool has to be made under the same lock.
+ */
+
+struct mem_pool {
+    const char *name;
+    uint8_t *blocks;
+    uint32_t block_size;
+    uint16_t count;
+    // Index of the first free block, count when none is left
+    uint16_t free_head;
+    uint16_t in_use;
+    // Most blocks in use at the same time since mem_pool_init()
+    uint16_t peak;
+    uint32_t allocs;
+    // Allocations that found no free block
+    uint32_t failures;
+};
+
+/**
+ * Declares the static storage for a pool of "count" blocks of at least "size" bytes
+ * Blocks are rounded up to 4 bytes and aligned to 4.
+ */
+#define MEM_POOL_STORAGE(name, size, count) \
+    static uint8_t name[(count) * MEM_POOL_BLOCK_SIZE(size)] __attribute__((aligned(4)))
+
+#define MEM_POOL_BLOCK_SIZE(size) (((size) + 3u) & ~3u)
+
+/**
+ * @param blocks Storage from MEM_POOL_STORAGE with the same size and count
+ * @param name Shown in reports
+ */
+void mem_pool_init(struct mem_pool *pool, const char *name, void *blocks, uint32_t size, uint16_t count);
+
+/**
+ * @returns A free block, or NULL if all of them are in use
+ */
+void *mem_pool_alloc(struct mem_pool *pool);
+
+/**
+ * Gives back a block from mem_pool_alloc()
+ */
+void mem_pool_free(struct mem_pool *pool, void *block);
+
+/**
+ * @returns Bytes of storage the pool takes
+ */
+static inline uint32_t mem_pool_bytes(const struct mem_pool *pool) {
+    return pool->block_size * pool->count;
+}
+
+#endif // _MEM_POOL_H_
@@ -0,0 +1,47 @@
+#ifndef _PACER_H_
+#define _PACER_H_
+
+#include <stdint.h>
+
+/**
+ * Token bucket that spaces out datagrams
+ * Tokens are bytes, they come in at "rate" bytes per second and at most "burst" of them are
+ * saved up, so up to "burst" bytes can go out back to back and after that datagrams are
+ * spaced by their length over the rate. The caller asks how long to wait before a datagram,
+ * waits however it likes and then takes the tokens. A datagram longer than the burst waits
+ * for a full bucket and leaves it in debt.
+ */
+
+struct pacer {
+    // Bytes per second, 0 = unpaced
+    uint32_t rate;
+    uint32_t burst;
+    // Tokens at "updated_us", negative after a datagram longer than what was in the bucket
+    int64_t tokens;
+    uint64_t updated_us;
+};
+
+/**
+ * Starts with a full bucket
+ * @param rate Bytes per second, 0 = every datagram goes straight away
+ * @param burst Bytes that may go out back to back
+ */
+void pacer_init(struct pacer *p, uint32_t rate, uint32_t burst, uint64_t now_us);
+
+/**
+ * Changes rate and burst, keeping the tokens already in the bucket
+ */
+void pacer_set_rate(struct pacer *p, uint32_t rate, uint32_t burst, uint64_t now_us);
+
+/**
+ * @returns Time, on the same clock as now_us, at which "len" bytes may be sent. now_us or
+ *          earlier if they may go straight away.
+ */
+uint64_t pacer_next_us(struct pacer *p, uint32_t len, uint64_t now_us);
+
+/**
+ * Takes the tokens for a datagram of "len" bytes that is being sent now
+ */
+void pacer_take(struct pacer *p, uint32_t len, uint64_t now_us);
+
+#endif // _PACER_H_
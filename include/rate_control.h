@@ -0,0 +1,89 @@
+#ifndef _RATE_CONTROL_H_
+#define _RATE_CONTROL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "arducam.h"
+
+/**
+ * Closed loop controller that trades picture size for a steady frame rate.
+ * Every RATE_INTERVAL_US the UDP core tells it what happened since the last update: frames
+ * sent, frames the link couldn't keep up with (backlog), send errors and the loss the
+ * receiver reported. On congestion it steps down one camera mode (rate_modes, from the
+ * biggest frames to the smallest), and once on the smallest it paces the captures.
+ * After a run of clean intervals it undoes one step, pacing first. A step up that is
+ * followed by congestion straight away doubles the wait before the next one, so a link
+ * that is just too slow for a mode isn't probed over and over.
+ */
+
+// Time between updates
+#ifndef RATE_INTERVAL_US
+#define RATE_INTERVAL_US 500000
+#endif
+
+// Receiver reported fragment loss, per mille, that counts as congestion
+#ifndef RATE_LOSS_HIGH
+#define RATE_LOSS_HIGH 30
+#endif
+
+// Longest frame interval pacing goes to, and the shortest it is kept at before it is turned off
+#define RATE_MAX_INTERVAL_US 500000
+#define RATE_MIN_INTERVAL_US 33000
+
+// Updates after a change before congestion is blamed on it
+#define RATE_SETTLE 2
+// Clean updates needed before stepping up, doubled after a failed step up, up to RATE_PROBE_MAX
+#define RATE_PROBE_MIN 4
+#define RATE_PROBE_MAX 32
+
+// loss_permille when no report came in since the last update
+#define RATE_NO_REPORT 0xFFFF
+
+struct camera_mode {
+    enum camera_resolution resolution;
+    enum camera_quality quality;
+};
+
+#define RATE_MODES 5
+// Biggest frames first, RATE_START_MODE is what camera_start() sets
+extern const struct camera_mode rate_modes[RATE_MODES];
+#define RATE_START_MODE 1
+
+// What happened during one update interval
+struct rate_signals {
+    uint32_t interval_us;
+    uint32_t frames_sent;
+    // Frames dropped as stale plus times the camera found the ring full
+    uint32_t backlog;
+    uint32_t send_errors;
+    // Fragment loss seen by the receiver, RATE_NO_REPORT if unknown
+    uint16_t loss_permille;
+};
+
+struct rate_control {
+    // Index into rate_modes, never below best_mode
+    uint8_t mode;
+    uint8_t best_mode;
+    // Capture pacing, 0 = as fast as the camera goes
+    uint32_t frame_interval_us;
+    // Updates since the last change and clean updates in a row
+    uint16_t since_change;
+    uint16_t clean;
+    uint16_t probe_after;
+    // Last change was a step up that hasn't proven itself yet
+    bool probing;
+};
+
+/**
+ * @param best_mode Biggest mode the controller may step up to
+ * @param start_mode Mode the camera is in now
+ */
+void rate_control_init(struct rate_control *rc, uint8_t best_mode, uint8_t start_mode);
+
+/**
+ * Feeds one update interval
+ * @returns true if the mode or the frame interval changed
+ */
+bool rate_control_update(struct rate_control *rc, const struct rate_signals *s);
+
+#endif // _RATE_CONTROL_H_
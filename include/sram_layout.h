@@ -0,0 +1,120 @@
+#ifndef _SRAM_LAYOUT_H_
+#define _SRAM_LAYOUT_H_
+
+/**
+ * Where the buffers and tables that both cores and the DMA hit go in the RP2040's SRAM.
+ *
+ * SRAM0-3 (64KB each) are normally word-striped, consecutive words are in consecutive banks,
+ * so every large buffer is spread over all four and any two masters hitting SRAM at the same
+ * time collide on a bank a quarter of the time. SRAM4 and SRAM5 (4KB each) hold core 1's and
+ * core 0's stack. A bank serves one master per cycle, the other one stalls.
+ *
+ * With the banked linker script (cmake -DARDUCAM_SRAM_BANKED=ON) SRAM0-3 are used through their
+ * non-striped alias: .data, .bss and the heap are in SRAM0-1, SRAM2-3 are left for SRAM_BANKED.
+ * tools/sram_layout.py shows where everything ended up in a built image.
+ */
+
+// Constant tables stay in flash and are read through the XIP cache, variables go in main RAM
+#define SRAM_FLASH 0
+// Main RAM, striped over SRAM0-3
+#define SRAM_STRIPED 1
+// SRAM2-3 through the non-striped alias, nothing else is there. Needs the banked linker script
+// and is never initialised, only for buffers
+#define SRAM_BANKED 2
+// Room in SRAM2-3, the frame ring (FRAME_QUEUE_SLOTS * BUFFER_SIZE) has to fit: at most four
+// 30000 byte slots, so configurations with a retransmission window stay striped
+#define SRAM_BANKED_SIZE (128 * 1024)
+// SRAM4, shared with core 1's stack
+#define SRAM_SCRATCH_X 3
+// SRAM5, shared with core 0's stack
+#define SRAM_SCRATCH_Y 4
+
+// Frame ring written by the camera DMA and encrypted in place by core 0
+#ifndef FRAME_SRAM
+#define FRAME_SRAM SRAM_STRIPED
+#endif
+
+// AES S-box and T-table (1.3KB) and the AES_ctx round keys core 0 looks up on every block.
+// SRAM_SCRATCH_Y keeps them next to core 0's stack, away from the DMA's writes.
+#ifndef AES_SRAM
+#define AES_SRAM SRAM_FLASH
+#endif
+
+// Core 1's stack, PICO_CORE1_STACK_SIZE bytes. SRAM_SCRATCH_X is the SDK's default.
+// Core 0's stack is always at the top of SRAM5, the linker script puts it there.
+#ifndef CORE1_STACK_SRAM
+#define CORE1_STACK_SRAM SRAM_SCRATCH_X
+#endif
+
+// Code of the encryption kernels, run for every byte of every frame: AES Cipher() with the CBC and
+// CTR loops, and ChaCha20-Poly1305. From flash every XIP cache miss stalls core 0 mid frame,
+// SRAM_STRIPED copies them into RAM at boot, tools/sram_layout.py shows how much that takes.
+#ifndef CIPHER_CODE_SRAM
+#define CIPHER_CODE_SRAM SRAM_FLASH
+#endif
+
+// Code run once per fragment on core 0: send_frame(), the parity XOR, the pbuf pools and
+// hal_udp_send(). lwIP and the CYW43 driver they call stay in flash.
+#ifndef SEND_CODE_SRAM
+#define SEND_CODE_SRAM SRAM_FLASH
+#endif
+
+// Set by the firmware build, the placement attributes do nothing in the simulator
+#ifndef SRAM_SECTIONS
+#define SRAM_SECTIONS 0
+#endif
+// Set by the firmware build when it links with the banked linker script
+#ifndef SRAM_BANKED_LAYOUT
+#define SRAM_BANKED_LAYOUT 0
+#endif
+
+#if SRAM_SECTIONS && !SRAM_BANKED_LAYOUT && \
+    (FRAME_SRAM == SRAM_BANKED || AES_SRAM == SRAM_BANKED || CORE1_STACK_SRAM == SRAM_BANKED)
+#error "SRAM_BANKED needs the banked linker script, configure with -DARDUCAM_SRAM_BANKED=ON"
+#endif
+#if AES_SRAM == SRAM_BANKED || CIPHER_CODE_SRAM == SRAM_BANKED || SEND_CODE_SRAM == SRAM_BANKED
+#error "Tables and code have to be copied in at boot, SRAM_BANKED is never initialised"
+#endif
+
+/**
+ * Places a variable, "name" tells it apart in the map file
+ * static uint8_t buf[...] SRAM_DATA(FRAME_SRAM, "frames");
+ */
+#define SRAM_DATA(where, name) SRAM_DATA_(where, name)
+/**
+ * Places a constant table, SRAM_FLASH leaves it in flash, the others copy it in at boot
+ */
+#define SRAM_TABLE(where, name) SRAM_TABLE_(where, name)
+
+/**
+ * Places a function, used like the SDK's __not_in_flash_func()
+ * void SRAM_FUNC(CIPHER_CODE_SRAM, Cipher)(state_t *state, ...)
+ */
+#define SRAM_FUNC(where, func) SRAM_FUNC_(where, func)
+
+#if SRAM_SECTIONS
+// Two steps so "where" is expanded to its number before it is pasted
+#define SRAM_DATA_(where, name) SRAM_DATA_##where(name)
+#define SRAM_TABLE_(where, name) SRAM_TABLE_##where(name)
+#define SRAM_DATA_0(name)
+#define SRAM_DATA_1(name)
+#define SRAM_DATA_2(name) __attribute__((section(".sram_banked." name)))
+#define SRAM_DATA_3(name) __attribute__((section(".scratch_x." name)))
+#define SRAM_DATA_4(name) __attribute__((section(".scratch_y." name)))
+#define SRAM_TABLE_0(name)
+// .time_critical is copied into .data by crt0, like the SDK's __not_in_flash()
+#define SRAM_TABLE_1(name) __attribute__((section(".time_critical." name)))
+#define SRAM_TABLE_3(name) __attribute__((section(".scratch_x." name)))
+#define SRAM_TABLE_4(name) __attribute__((section(".scratch_y." name)))
+#define SRAM_FUNC_(where, func) SRAM_FUNC_##where(func)
+#define SRAM_FUNC_0(func) func
+#define SRAM_FUNC_1(func) __attribute__((section(".time_critical." #func))) func
+#define SRAM_FUNC_3(func) __attribute__((section(".scratch_x." #func))) func
+#define SRAM_FUNC_4(func) __attribute__((section(".scratch_y." #func))) func
+#else
+#define SRAM_DATA_(where, name)
+#define SRAM_TABLE_(where, name)
+#define SRAM_FUNC_(where, func) func
+#endif
+
+#endif // _SRAM_LAYOUT_H_
@@ -0,0 +1,286 @@
+#ifndef _STREAM_HEADER_H_
+#define _STREAM_HEADER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Header at the start of every UDP datagram of the video stream, followed by the
+ * fragment's (encrypted) payload. All fields are big endian.
+ *
+ *  0  version          uint8   STREAM_HEADER_VERSION
+ *  1  flags            uint8   STREAM_FLAG_*
+ *  2  fragment index   uint16  position of this fragment in the frame
+ *  4  frame id         uint32  increases by one per frame sent, part of the CTR counter
+ *  8  frame length     uint32  bytes of the whole frame as sent (padded length for CBC)
+ * 12  fragment count   uint16
+ * 14  fragment size    uint16  payload bytes of every fragment but the last one,
+ *                              the payload of fragment i starts at i * fragment size
+ * 16  timestamp        uint32  capture time in microseconds, low 32 bits of the device clock
+ * 20  stream id        uint16  tells apart several streams coming from the same address
+ * 22  FEC group        uint16  data fragments per parity fragment, 0 without FEC (see fec.h)
+ * 24  frame CRC        uint32  CRC-32 of the frame as read from the camera, before encryption
+ *                              and padding (see frame_check.h), only with STREAM_FLAG_CRC
+ *
+ * Fragments sent again because the receiver asked for them (see stream_nack below) are
+ * the same as the first time plus STREAM_FLAG_RETRANSMIT.
+ * Parity fragments have STREAM_FLAG_PARITY set and carry the group number in the fragment
+ * index field, all the other fields are the same as for the frame's data fragments.
+ * With the frame length and fragment size in every datagram a receiver can allocate the
+ * frame from whichever fragment arrives first, put each one in place directly and tell
+ * exactly which fragments are missing.
+ * The CRC is only known once the whole frame has been read: with cut-through sending only
+ * the fragments sent after that carry it, always at least the last one and the parity after it.
+ * A resent fragment carries it only if it did the first time, so it stays the same message.
+ * A receiver checks the frame it put back together against the CRC of any of its fragments.
+ *
+ * With STREAM_FLAG_AEAD the header is followed by an auth block before the payload:
+ * 28  session          uint32  random per boot, keeps nonces unique across restarts
+ * 32  tag              16 bytes Poly1305 tag over the header and the encrypted payload
+ * Each fragment is ChaCha20-Poly1305 encrypted on its own, see stream_auth_nonce(). The
+ * header is the additional data, without STREAM_FLAG_RETRANSMIT so a resent fragment is
+ * the exact same message as the first time.
+ */
+
+#define STREAM_HEADER_VERSION 4
+#define STREAM_HEADER_SIZE 28
+
+// Last fragment of the frame
+#define STREAM_FLAG_LAST 0x01
+// Frame is CBC encrypted as a whole (PKCS#7 padded), otherwise each fragment is CTR encrypted
+#define STREAM_FLAG_CBC 0x02
+// XOR parity of a group of fragments instead of frame data
+#define STREAM_FLAG_PARITY 0x04
+// Fragment sent again after a NACK
+#define STREAM_FLAG_RETRANSMIT 0x08
+// Payload is not encrypted (ENCRYPT_NONE)
+#define STREAM_FLAG_PLAIN 0x10
+// Payload is ChaCha20-Poly1305 encrypted and follows an auth block (ENCRYPT_AEAD)
+#define STREAM_FLAG_AEAD 0x20
+// Frame CRC field is set
+#define STREAM_FLAG_CRC 0x40
+
+#define STREAM_AUTH_SIZE 20
+// Shared key bytes, the AES modes use the first AES_KEYLEN of them
+#define STREAM_KEY_LEN 32
+
+struct stream_header {
+    uint8_t flags;
+    uint16_t fragment;
+    uint32_t frame_id;
+    uint32_t frame_len;
+    uint16_t fragment_count;
+    uint16_t fragment_size;
+    uint32_t timestamp_us;
+    uint16_t stream_id;
+    uint16_t fec_group;
+    uint32_t frame_crc;
+};
+
+static inline void stream_put16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void stream_put32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/**
+ * Writes "h" into "out" in wire format
+ * @param out STREAM_HEADER_SIZE bytes
+ */
+static inline void stream_header_write(uint8_t *out, const struct stream_header *h) {
+    out[0] = STREAM_HEADER_VERSION;
+    out[1] = h->flags;
+    stream_put16(&out[2], h->fragment);
+    stream_put32(&out[4], h->frame_id);
+    stream_put32(&out[8], h->frame_len);
+    stream_put16(&out[12], h->fragment_count);
+    stream_put16(&out[14], h->fragment_size);
+    stream_put32(&out[16], h->timestamp_us);
+    stream_put16(&out[20], h->stream_id);
+    stream_put16(&out[22], h->fec_group);
+    stream_put32(&out[24], h->frame_crc);
+}
+
+static inline uint16_t stream_get16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t stream_get32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/**
+ * Reads the header at the start of a datagram
+ * @param len Length of the whole datagram
+ * @returns false if the datagram is too short or has another version
+ */
+static inline bool stream_header_read(const uint8_t *in, size_t len, struct stream_header *h) {
+    if(len < STREAM_HEADER_SIZE || in[0] != STREAM_HEADER_VERSION) {
+        return false;
+    }
+    h->flags = in[1];
+    h->fragment = stream_get16(&in[2]);
+    h->frame_id = stream_get32(&in[4]);
+    h->frame_len = stream_get32(&in[8]);
+    h->fragment_count = stream_get16(&in[12]);
+    h->fragment_size = stream_get16(&in[14]);
+    h->timestamp_us = stream_get32(&in[16]);
+    h->stream_id = stream_get16(&in[20]);
+    h->fec_group = stream_get16(&in[22]);
+    h->frame_crc = stream_get32(&in[24]);
+    return true;
+}
+
+/**
+ * Builds the 16 byte AES-CTR counter block a fragment starts at:
+ * IV[0..7] | frame id (32 bit BE) | fragment (16 bit BE) | block counter (16 bit BE, 0)
+ * Parity fragments use FEC_PARITY_COUNTER | group as their fragment.
+ */
+static inline void stream_ctr_counter(uint8_t *counter, const uint8_t *iv, uint32_t frame_id, uint16_t fragment) {
+    for(int i = 0; i < 8; i++) {
+        counter[i] = iv[i];
+    }
+    stream_put32(&counter[8], frame_id);
+    stream_put16(&counter[12], fragment);
+    counter[14] = 0;
+    counter[15] = 0;
+}
+
+/**
+ * Builds the 12 byte nonce of a fragment: session | frame id | fragment | stream id
+ * Parity fragments have the top bit of the fragment index set like their CTR counter.
+ */
+static inline void stream_auth_nonce(uint8_t *nonce, uint32_t session, const struct stream_header *h) {
+    stream_put32(&nonce[0], session);
+    stream_put32(&nonce[4], h->frame_id);
+    stream_put16(&nonce[8], h->fragment | ((h->flags & STREAM_FLAG_PARITY) ? 0x8000 : 0));
+    stream_put16(&nonce[10], h->stream_id);
+}
+
+/**
+ * Copies a written header into the additional data the tag covers
+ * @param aad STREAM_HEADER_SIZE bytes
+ */
+static inline void stream_auth_aad(uint8_t *aad, const uint8_t *header) {
+    for(int i = 0; i < STREAM_HEADER_SIZE; i++) {
+        aad[i] = header[i];
+    }
+    aad[1] &= ~STREAM_FLAG_RETRANSMIT;
+}
+
+/**
+ * NACK sent by the receiver back to the device's stream port, asks for the fragments
+ * of one frame that are set in the bitmap. Big endian like the stream header.
+ *
+ *  0  type             uint8   STREAM_NACK_TYPE
+ *  1  bitmap length    uint8   bytes, at most STREAM_NACK_BITMAP
+ *  2  stream id        uint16
+ *  4  frame id         uint32
+ *  8  first fragment   uint16  fragment index of bit 0
+ * 10  bitmap                   bit i (LSB first in each byte) asks for fragment first + i
+ */
+
+#define STREAM_NACK_TYPE 'N'
+#define STREAM_NACK_HEADER_SIZE 10
+#define STREAM_NACK_BITMAP 32
+
+struct stream_nack {
+    uint16_t stream_id;
+    uint32_t frame_id;
+    uint16_t first;
+    uint8_t bitmap_len;
+    uint8_t bitmap[STREAM_NACK_BITMAP];
+};
+
+/**
+ * Writes "n" into "out" in wire format
+ * @param out STREAM_NACK_HEADER_SIZE + STREAM_NACK_BITMAP bytes
+ * @returns Length of the datagram
+ */
+static inline size_t stream_nack_write(uint8_t *out, const struct stream_nack *n) {
+    out[0] = STREAM_NACK_TYPE;
+    out[1] = n->bitmap_len;
+    stream_put16(&out[2], n->stream_id);
+    stream_put32(&out[4], n->frame_id);
+    stream_put16(&out[8], n->first);
+    for(uint8_t i = 0; i < n->bitmap_len; i++) {
+        out[STREAM_NACK_HEADER_SIZE + i] = n->bitmap[i];
+    }
+    return STREAM_NACK_HEADER_SIZE + n->bitmap_len;
+}
+
+/**
+ * Reads a NACK datagram
+ * @returns false if it isn't a well formed NACK
+ */
+static inline bool stream_nack_read(const uint8_t *in, size_t len, struct stream_nack *n) {
+    if(len < STREAM_NACK_HEADER_SIZE || in[0] != STREAM_NACK_TYPE || in[1] > STREAM_NACK_BITMAP ||
+        len < (size_t)STREAM_NACK_HEADER_SIZE + in[1]) {
+        return false;
+    }
+    n->bitmap_len = in[1];
+    n->stream_id = stream_get16(&in[2]);
+    n->frame_id = stream_get32(&in[4]);
+    n->first = stream_get16(&in[8]);
+    for(uint8_t i = 0; i < n->bitmap_len; i++) {
+        n->bitmap[i] = in[STREAM_NACK_HEADER_SIZE + i];
+    }
+    return true;
+}
+
+/**
+ * Loss report the receiver sends back to the device's stream port about once a second,
+ * feeds the rate controller (rate_control.h). Big endian.
+ *
+ *  0  type             uint8   STREAM_REPORT_TYPE
+ *  1  reserved         uint8
+ *  2  stream id        uint16
+ *  4  loss             uint16  fragments lost per mille of those sent, over the interval
+ *  6  frames           uint16  frames delivered over the interval
+ *  8  interval         uint16  milliseconds covered by the report
+ */
+
+#define STREAM_REPORT_TYPE 'R'
+#define STREAM_REPORT_SIZE 10
+
+struct stream_report {
+    uint16_t stream_id;
+    uint16_t loss_permille;
+    uint16_t frames;
+    uint16_t interval_ms;
+};
+
+/**
+ * @param out STREAM_REPORT_SIZE bytes
+ */
+static inline void stream_report_write(uint8_t *out, const struct stream_report *r) {
+    out[0] = STREAM_REPORT_TYPE;
+    out[1] = 0;
+    stream_put16(&out[2], r->stream_id);
+    stream_put16(&out[4], r->loss_permille);
+    stream_put16(&out[6], r->frames);
+    stream_put16(&out[8], r->interval_ms);
+}
+
+/**
+ * @returns false if it isn't a loss report
+ */
+static inline bool stream_report_read(const uint8_t *in, size_t len, struct stream_report *r) {
+    if(len < STREAM_REPORT_SIZE || in[0] != STREAM_REPORT_TYPE) {
+        return false;
+    }
+    r->stream_id = stream_get16(&in[2]);
+    r->loss_permille = stream_get16(&in[4]);
+    r->frames = stream_get16(&in[6]);
+    r->interval_ms = stream_get16(&in[8]);
+    return true;
+}
+
+#endif // _STREAM_HEADER_H_
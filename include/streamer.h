@@ -0,0 +1,218 @@
+#ifndef _STREAMER_H_
+#define _STREAMER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "frame_queue.h"
+
+/**
+ * Camera to UDP pipeline shared by the Pico W firmware and the host simulator.
+ * Core 1 runs camera_poll() and fills the frame ring, core 0 runs streamer_send_loop()
+ * which encrypts, fragments and sends the frames.
+ */
+
+// Used for handling the buffer
+#define BUFFER_SIZE 30000
+// Payload bytes per datagram, with the stream header and UDP/IP headers it stays under a 1500 byte MTU
+#define FRAME_SIZE 1400
+#define AES_BLOCK  16
+
+// How each frame is encrypted
+// CBC: the whole frame is padded and encrypted before the first fragment is sent,
+//      the receiver needs every fragment of a frame to decrypt it.
+// CTR: each fragment is encrypted right before it is sent with a counter built from
+//      (frame id, fragment index), so fragments can be decrypted on their own.
+// NONE: plain MJPEG, flagged with STREAM_FLAG_PLAIN, no AES code or state is built in.
+// AEAD: each fragment is ChaCha20-Poly1305 encrypted on its own with a nonce built from
+//       (session, frame id, fragment index) and carries a tag, so the receiver can also
+//       tell when a fragment was forged or changed. Uses all STREAM_KEY_LEN bytes of the key.
+#define ENCRYPT_CBC 0
+#define ENCRYPT_CTR 1
+#define ENCRYPT_NONE 2
+#define ENCRYPT_AEAD 3
+#ifndef ENCRYPT_MODE
+#define ENCRYPT_MODE ENCRYPT_CTR
+#endif
+
+// 1 = with CTR core 1 works out the keystream of the next fragments while it waits for a free
+// frame slot or for the camera DMA, see keystream.h, and core 0 only XORs it into the frame.
+// Fragments core 1 didn't get to in time are encrypted on core 0 as before.
+#ifndef CTR_KEYSTREAM
+#define CTR_KEYSTREAM 0
+#endif
+
+// Sent in every stream header, lets a receiver tell apart cameras behind the same address
+#ifndef STREAM_ID
+#define STREAM_ID 0
+#endif
+
+// 1 = the XOR parity stage is built in, its group size is FEC_GROUP. 0 = no parity code or buffer.
+#ifndef STREAM_FEC
+#define STREAM_FEC 1
+#endif
+
+// Data fragments per XOR parity fragment, 0 = no forward error correction
+// The receiver can rebuild one lost fragment per group without asking for it again,
+// at the cost of 1/FEC_GROUP more bandwidth. See fec.h, can be changed at run time
+// with streamer_set_fec_group().
+#ifndef FEC_GROUP
+#define FEC_GROUP 0
+#endif
+
+// Sent frames kept so the receiver can ask for lost fragments again, 0 = no retransmission
+// The receiver sends a NACK (see stream_header.h) and core 0 resends the fragments between
+// new frames. A kept frame holds on to its frame slot: FRAME_QUEUE_SLOTS needs room for
+// these plus one frame being sent and one being captured. The window can be made smaller
+// at run time with streamer_set_retransmit().
+#ifndef RETRANSMIT_FRAMES
+#define RETRANSMIT_FRAMES 0
+#endif
+
+// How long after it was sent a frame can still be asked for
+#ifndef RETRANSMIT_DEADLINE_US
+#define RETRANSMIT_DEADLINE_US 150000
+#endif
+
+// 1 = adapts camera mode (resolution, JPEG quality) and capture pacing to what the link
+// manages, see rate_control.h. Can be turned off at run time with streamer_set_rate_control().
+#ifndef RATE_CONTROL
+#define RATE_CONTROL 1
+#endif
+
+// 1 = datagrams go through a token bucket (see pacer.h) instead of back to back, so a frame
+// is spread over the time until the next one rather than reaching the radio as one burst.
+// Can be changed at run time with streamer_set_pacing().
+#ifndef SEND_PACING
+#define SEND_PACING 1
+#endif
+
+// Paced rate in bytes per second, 0 = the frame's datagrams over 4/5 of the time between frames
+#ifndef SEND_PACING_RATE
+#define SEND_PACING_RATE 0
+#endif
+
+// Bytes that may go out back to back, four full datagrams
+#ifndef SEND_PACING_BURST
+#define SEND_PACING_BURST 5696
+#endif
+
+// With EVENT_WAITS, longest a core sleeps before it checks again what it waits for, in case a
+// doorbell was missed or a deadline (NACKs, rate control) comes up
+#ifndef CORE_WAIT_US
+#define CORE_WAIT_US 1000
+#endif
+
+// 1 = each fragment is sent as soon as it has been read from the camera (cut-through)
+// 0 = a frame is only sent once it has been completely read (store-and-forward)
+#ifndef CUT_THROUGH
+#define CUT_THROUGH 1
+#endif
+
+// 1 = fragments reference the frame buffer directly (PBUF_REF), only the stream header is copied
+// 0 = every fragment is copied into its own PBUF_RAM pbuf
+#ifndef ZERO_COPY
+#define ZERO_COPY 1
+#endif
+
+// What happens when the camera gets ahead of the UDP core, see frame_queue.h
+// The number of frame slots is set with FRAME_QUEUE_SLOTS
+#ifndef FRAME_POLICY
+#define FRAME_POLICY FRAME_QUEUE_DROP_OLDEST
+#endif
+
+// Frames between printing the copy and drop statistics
+#ifndef STATS_INTERVAL
+#define STATS_INTERVAL 100
+#endif
+
+// 1 = records per stage latency histograms, see streamer_profile_report()
+// Adds a few timer reads per fragment, the host benchmark turns it on
+#ifndef PIPELINE_PROFILE
+#define PIPELINE_PROFILE 0
+#endif
+
+// 1 = counts the cycles core 0 spends encrypting, per byte and per frame, the bus accesses to the
+// frame ring's and the AES tables' memory that stall behind the DMA or core 1 meanwhile, and XIP
+// cache hits (see sram_layout.h). Every STATS_INTERVAL frames the XIP cache is emptied before a
+// frame to time it with every flash read missing. Printed with the statistics and by
+// streamer_profile_report().
+#ifndef BUS_PROFILE
+#define BUS_PROFILE 0
+#endif
+
+// Pipeline stages timed when PIPELINE_PROFILE is on, all per frame
+enum pipeline_stage {
+    // Capture trigger until the camera reported the frame done (core 1)
+    STAGE_CAPTURE,
+    // Reading the frame out of the camera FIFO (core 1)
+    STAGE_READOUT,
+    // PKCS#7 padding, CBC only (core 0)
+    STAGE_PADDING,
+    // AES over the whole frame (core 0)
+    STAGE_ENCRYPT,
+    // Splitting into fragments and building the headers (core 0)
+    STAGE_FRAGMENT,
+    // Handing all fragments to the network stack (core 0)
+    STAGE_SEND,
+    STAGE_COUNT
+};
+
+// Frames handed from core 1 (camera) to core 0 (UDP)
+extern struct frame_queue frames;
+
+/**
+ * Sets up the frame ring and the encryption state
+ * @param key STREAM_KEY_LEN bytes, the AES modes only use the first AES_KEYLEN
+ * @param iv AES_BLOCKLEN bytes, not used by ENCRYPT_AEAD
+ */
+void streamer_init(const uint8_t *key, const uint8_t *iv);
+
+/**
+ * Sets how many data fragments share a parity fragment from the next frame on, 0 turns FEC off
+ */
+void streamer_set_fec_group(uint16_t group);
+
+/**
+ * Sets how many sent frames are kept for retransmission and for how long, from the next frame on
+ * @param window At most RETRANSMIT_FRAMES, 0 turns retransmission off
+ */
+void streamer_set_retransmit(uint8_t window, uint32_t deadline_us);
+
+/**
+ * Turns the rate controller on or off, off puts the camera back to camera_start()'s mode
+ * Only does something when built with RATE_CONTROL
+ */
+void streamer_set_rate_control(bool enabled);
+
+/**
+ * Changes send pacing, only does something when built with SEND_PACING
+ * @param enabled false sends every datagram straight away
+ * @param rate Bytes per second, 0 = follows the frame size and the time between frames
+ * @param burst Bytes that may go out back to back
+ */
+void streamer_set_pacing(bool enabled, uint32_t rate, uint32_t burst);
+
+/**
+ * Camera mode (index into rate_modes) and capture pacing the rate controller asked for
+ */
+void streamer_rate_state(uint8_t *mode, uint32_t *frame_interval_us);
+
+/**
+ * Core 1: captures frames and hands them to core 0, never returns
+ */
+void camera_poll();
+
+/**
+ * Core 0: encrypts and sends the frames captured by camera_poll(), never returns
+ */
+void streamer_send_loop();
+
+/**
+ * Prints p50/p99/max latency of every pipeline stage plus frames and bytes per second,
+ * and with BUS_PROFILE the encryption cycles per byte and bus contention
+ * Only does something when built with PIPELINE_PROFILE or BUS_PROFILE
+ * @param elapsed_us Time since the pipeline was started
+ */
+void streamer_profile_report(uint64_t elapsed_us);
+
+#endif // _STREAMER_H_
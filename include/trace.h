@@ -0,0 +1,125 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+/**
+ * Binary event trace for the pipeline loops, replaces printing from them.
+ * Each core has its own ring of timestamped events that only that core writes to, a
+ * record is a few stores and a release store of the ring's head, no locks and no
+ * read-modify-write atomics. trace_poll() on core 0 drains both rings in batches to
+ * USB stdio or to a UDP port, tools/trace_decode.py turns them into Chrome trace JSON
+ * (chrome://tracing or https://ui.perfetto.dev).
+ * When the rings are not drained fast enough the oldest events are overwritten and
+ * counted as lost.
+ * @warning Don't record from interrupt handlers, an interrupt would race the core's own writes
+ */
+
+// 1 = record events, 0 = trace_record() compiles to nothing
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+// Where trace_poll() sends the batches
+// USB: one "T:<hex>" line per batch on stdio, can be mixed with other output
+// UDP: one datagram per batch to TRACE_PORT on the stream's server
+#define TRACE_SINK_USB 0
+#define TRACE_SINK_UDP 1
+#ifndef TRACE_SINK
+#define TRACE_SINK TRACE_SINK_USB
+#endif
+
+#ifndef TRACE_PORT
+#define TRACE_PORT 20002
+#endif
+
+// Events per core, must be a power of two
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 512
+#endif
+
+// Most events in one batch, a batch has to fit in a single datagram
+#define TRACE_BATCH 128
+
+// How often trace_poll() drains the rings unless they are filling up
+#ifndef TRACE_FLUSH_US
+#define TRACE_FLUSH_US 100000
+#endif
+
+/**
+ * Event ids, tools/trace_decode.py has the same table
+ * _BEGIN/_END pairs become spans in the timeline, everything else an instant event.
+ */
+enum trace_id {
+    // Core 1: trigger until the camera has the frame, arg = frame length
+    TRACE_CAPTURE_BEGIN = 1,
+    TRACE_CAPTURE_END = 2,
+    // Core 1: reading the FIFO, arg = frame length
+    TRACE_READOUT_BEGIN = 3,
+    TRACE_READOUT_END = 4,
+    // Core 1: ring full, waiting for core 0 to free a slot
+    TRACE_SLOT_WAIT_BEGIN = 5,
+    TRACE_SLOT_WAIT_END = 6,
+    // Core 0: ring empty, waiting for the camera
+    TRACE_FRAME_WAIT_BEGIN = 7,
+    TRACE_FRAME_WAIT_END = 8,
+    // Core 0: encrypting and sending a frame, arg = frame id
+    TRACE_SEND_BEGIN = 9,
+    TRACE_SEND_END = 10,
+    // Core 0: a fragment could not be sent, arg = error code
+    TRACE_SEND_ERROR = 11,
+    // Core 1: bad frame length, the camera is reset, arg = frame length
+    TRACE_CAMERA_RESET = 12,
+    // Core 0: fragments sent again after a NACK, arg = number of fragments
+    TRACE_RETRANSMIT = 13,
+    // Core 0: rate controller changed the camera, arg = mode << 12 | frame interval in ms
+    TRACE_RATE_CHANGE = 14,
+    // Core 1: frame failed its JPEG marker checks and was dropped, arg = frame length
+    TRACE_FRAME_CORRUPT = 15,
+};
+
+// One event as stored in the rings and sent in batches (little endian)
+struct trace_event {
+    // Low 32 bits of hal_time_us()
+    uint32_t time_us;
+    uint16_t id;
+    uint16_t arg;
+};
+
+// Batch header followed by "count" events
+struct trace_batch_header {
+    // 'T', 'R'
+    uint8_t magic[2];
+    uint8_t version;
+    uint8_t core;
+    // Events overwritten before they could be drained since the last batch
+    uint16_t lost;
+    uint16_t count;
+};
+
+#define TRACE_VERSION 1
+
+#if TRACE_ENABLED
+/**
+ * Sets up the rings and the sink
+ * @param ip Address the UDP sink sends to, unused for the USB sink
+ */
+void trace_init(const char *ip);
+
+/**
+ * Records an event on the calling core's ring
+ */
+void trace_record(uint16_t id, uint16_t arg);
+
+/**
+ * Drains both rings if TRACE_FLUSH_US has passed or one of them is half full
+ * @warning Only call it from core 0
+ */
+void trace_poll();
+#else
+#define trace_init(ip) ((void)(ip))
+#define trace_record(id, arg) ((void)0)
+#define trace_poll() ((void)0)
+#endif
+
+#endif // _TRACE_H_
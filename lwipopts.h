@@ -19,7 +19,8 @@
 #define MEM_LIBC_MALLOC             0
 #endif
 #define MEM_ALIGNMENT               4
-#define MEM_SIZE                    30000 // modified
+// Stream datagrams come from the fixed pools in src/hal_pico.c, the lwIP heap is only left for DHCP, ARP and ICMP
+#define MEM_SIZE                    8000 // modified
 #define MEMP_NUM_TCP_SEG            32
 #define MEMP_NUM_ARP_QUEUE          10
 #define PBUF_POOL_SIZE              24
@@ -52,6 +53,8 @@
 #define LWIP_DHCP_DOES_ACD_CHECK    0
 // Camera special config
 #define IP_FRAG                     1
+// Needed for the zero copy PBUF_REF fragments that point into the frame buffers
+#define LWIP_SUPPORT_CUSTOM_PBUF    1
 
 #ifndef NDEBUG
 #define LWIP_DEBUG                  0
@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+
+#include "frame_assembler.h"
+#include "frame_sink.h"
+
+/**
+ * Loss injection harness for the FEC parity fragments
+ * Encrypts and fragments frames the way the firmware does (CTR, one XOR parity fragment
+ * per group), drops datagrams with a loss model and feeds the rest straight into the
+ * frame assembler, no sockets involved. For every FEC group size and loss rate it prints
+ * the bandwidth overhead and the share of frames that came out complete and correct.
+ *
+ * Usage: fec_harness [-n frames] [-s frame_bytes] [-b mean_burst]
+ *   -b B  losses come in bursts of B datagrams on average (Gilbert-Elliott), default 1 = independent
+ */
+
+static const uint16_t FRAGMENT_SIZE = 1400;
+
+// Two state loss model, the bad state loses every datagram and lasts "burst" datagrams on average
+class loss_model {
+public:
+    loss_model(double rate, double burst, uint32_t seed) : state_(seed ? seed : 1) {
+        // Chance to leave the bad state, and to enter it so the average loss is "rate"
+        exit_ = 1.0 / burst;
+        enter_ = rate >= 1 ? 1 : rate * exit_ / (1 - rate);
+    }
+
+    bool drop() {
+        bad_ = bad_ ? random() >= exit_ : random() < enter_;
+        return bad_;
+    }
+
+private:
+    double random() {
+        state_ ^= state_ << 13;
+        state_ ^= state_ >> 17;
+        state_ ^= state_ << 5;
+        return state_ / 4294967296.0;
+    }
+
+    uint32_t state_;
+    double enter_;
+    double exit_;
+    bool bad_ = false;
+};
+
+// Checks every delivered frame against what was sent
+class check_sink : public frame_sink {
+public:
+    explicit check_sink(const std::vector<uint8_t> &expected) : expected_(expected) {}
+    void frame(const assembled_frame &f) override {
+        if(f.len == expected_.size() && memcmp(f.data, expected_.data(), f.len) == 0) {
+            good++;
+        } else {
+            bad++;
+        }
+    }
+    uint64_t good = 0;
+    uint64_t bad = 0;
+
+private:
+    const std::vector<uint8_t> &expected_;
+};
+
+static void set_counter(AES_ctx *ctx, const uint8_t *iv, uint32_t id, uint16_t fragment) {
+    uint8_t counter[AES_BLOCKLEN];
+    memcpy(counter, iv, 8);
+    stream_put32(&counter[8], id);
+    stream_put16(&counter[12], fragment);
+    counter[14] = 0;
+    counter[15] = 0;
+    AES_ctx_set_iv(ctx, counter);
+}
+
+struct run_result {
+    uint64_t datagrams = 0;
+    uint64_t payload_bytes = 0;
+    uint64_t parity_bytes = 0;
+    uint64_t good = 0;
+    uint64_t bad = 0;
+    uint64_t recovered = 0;
+};
+
+static run_result run(uint32_t frames, const std::vector<uint8_t> &plain, uint16_t group, double rate, double burst) {
+    uint8_t key[STREAM_KEY_LEN] = "YOUR_KEY";
+    uint8_t iv[AES_BLOCKLEN] = "YOUR_IV";
+    AES_ctx ctx;
+    AES_init_ctx(&ctx, key);
+    check_sink sink(plain);
+    frame_assembler assembler(key, iv, sink);
+    loss_model loss(rate, burst, 12345);
+    run_result r;
+
+    uint32_t len = plain.size();
+    uint16_t count = (len + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE;
+    std::vector<uint8_t> frame(len);
+    std::vector<uint8_t> datagram(STREAM_HEADER_SIZE + FRAGMENT_SIZE);
+    std::vector<uint8_t> parity(FRAGMENT_SIZE);
+
+    auto send = [&](const stream_header &h, const uint8_t *payload, uint16_t payload_len) {
+        r.datagrams++;
+        if(loss.drop()) {
+            return;
+        }
+        stream_header_write(datagram.data(), &h);
+        memcpy(&datagram[STREAM_HEADER_SIZE], payload, payload_len);
+        assembler.datagram(datagram.data(), STREAM_HEADER_SIZE + payload_len);
+    };
+
+    for(uint32_t id = 1; id <= frames; id++) {
+        memcpy(frame.data(), plain.data(), len);
+        stream_header h = {};
+        h.frame_id = id;
+        h.frame_len = len;
+        h.fragment_count = count;
+        h.fragment_size = FRAGMENT_SIZE;
+        h.timestamp_us = id;
+        h.fec_group = group;
+        for(uint16_t i = 0; i < count; i++) {
+            uint32_t offset = i * FRAGMENT_SIZE;
+            uint16_t frag_len = std::min<uint32_t>(FRAGMENT_SIZE, len - offset);
+            if(group) {
+                if(i % group == 0) {
+                    memset(parity.data(), 0, FRAGMENT_SIZE);
+                }
+                fec_xor(parity.data(), &frame[offset], frag_len);
+            }
+            set_counter(&ctx, iv, id, i);
+            AES_CTR_xcrypt_buffer(&ctx, &frame[offset], frag_len);
+            h.fragment = i;
+            h.flags = i == count - 1 ? STREAM_FLAG_LAST : 0;
+            send(h, &frame[offset], frag_len);
+            r.payload_bytes += frag_len;
+
+            if(group && (i % group == group - 1 || i == count - 1)) {
+                uint32_t first = i - i % group;
+                uint16_t parity_len = std::min<uint32_t>(FRAGMENT_SIZE, len - first * FRAGMENT_SIZE);
+                set_counter(&ctx, iv, id, FEC_PARITY_COUNTER | (i / group));
+                AES_CTR_xcrypt_buffer(&ctx, parity.data(), parity_len);
+                stream_header p = h;
+                p.flags = STREAM_FLAG_PARITY;
+                p.fragment = i / group;
+                send(p, parity.data(), parity_len);
+                r.parity_bytes += parity_len;
+            }
+        }
+    }
+    r.good = sink.good;
+    r.bad = sink.bad;
+    r.recovered = assembler.stats().recovered;
+    return r;
+}
+
+int main(int argc, char **argv) {
+    uint32_t frames = 2000;
+    uint32_t frame_len = 22000;
+    double burst = 1;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:s:b:")) != -1) {
+        switch(opt) {
+            case 'n': frames = strtoul(optarg, nullptr, 0); break;
+            case 's': frame_len = strtoul(optarg, nullptr, 0); break;
+            case 'b': burst = strtod(optarg, nullptr); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n frames] [-s frame_bytes] [-b mean_burst]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(burst < 1) {
+        burst = 1;
+    }
+
+    std::vector<uint8_t> plain(frame_len);
+    for(uint32_t i = 0; i < frame_len; i++) {
+        plain[i] = i * 131 + (i >> 8);
+    }
+
+    static const uint16_t groups[] = { 0, 16, 8, 4, 2 };
+    static const double rates[] = { 0.005, 0.01, 0.02, 0.05, 0.10 };
+    printf("%u frames of %u bytes (%u fragments), mean burst %.1f\n", frames, frame_len,
+        (frame_len + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE, burst);
+    printf("%-8s %9s", "group", "overhead");
+    for(double rate : rates) {
+        printf("  %5.1f%% loss", rate * 100);
+    }
+    printf("\n");
+
+    bool all_correct = true;
+    for(uint16_t group : groups) {
+        std::vector<run_result> results;
+        for(double rate : rates) {
+            results.push_back(run(frames, plain, group, rate, burst));
+        }
+        if(group) {
+            printf("%-8u %8.1f%%", group, 100.0 * results[0].parity_bytes / results[0].payload_bytes);
+        } else {
+            printf("%-8s %8.1f%%", "off", 0.0);
+        }
+        for(const run_result &r : results) {
+            printf("  %10.1f%%", 100.0 * r.good / frames);
+            all_correct &= r.bad == 0;
+        }
+        printf("\n");
+    }
+    printf("Columns are the share of frames that arrived complete and correct\n");
+    if(!all_correct) {
+        printf("ERROR: some rebuilt frames didn't match what was sent\n");
+        return 1;
+    }
+    return 0;
+}
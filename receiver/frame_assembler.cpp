@@ -0,0 +1,377 @@
+#include "frame_assembler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// A frame id this far behind the newest one means the device restarted its count
+static const uint32_t RESTART_GAP = 1000;
+
+frame_assembler::frame_assembler(const uint8_t *key, const uint8_t *iv, frame_sink &sink,
+    size_t max_frame, unsigned slabs) : sink_(sink), max_frame_(max_frame), slabs_(slabs) {
+    AES_init_ctx(&ctx_, key);
+    AES_init_ctx_iv(&cbc_ctx_, key, iv);
+    memcpy(iv_, iv, AES_BLOCKLEN);
+    memcpy(aead_key_, key, CHACHA20_KEYLEN);
+}
+
+static uint64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void frame_assembler::start(slab &s, const stream_header &h) {
+    s.in_use = true;
+    s.frame_id = h.frame_id;
+    s.len = h.frame_len;
+    s.timestamp_us = h.timestamp_us;
+    s.started_us = now_us();
+    s.last_fragment_us = s.started_us;
+    s.complete = false;
+    s.last_nack_us = 0;
+    s.stream_id = h.stream_id;
+    if(s.data.size() < h.frame_len) {
+        s.data.resize(h.frame_len);
+    }
+    s.count = h.fragment_count;
+    s.remaining = h.fragment_count;
+    s.fragment_size = h.fragment_size;
+    s.flags = h.flags & (STREAM_FLAG_CBC | STREAM_FLAG_PLAIN);
+    s.has_crc = false;
+    s.received.assign((h.fragment_count + 63) / 64, 0);
+    s.fec_group = h.fec_group;
+    if(h.fec_group) {
+        uint32_t groups = fec_groups(h.fragment_count, h.fec_group);
+        s.group_received.assign(groups, 0);
+        s.parity_received.assign(groups, 0);
+        if(s.parity.size() < (size_t)groups * h.fragment_size) {
+            s.parity.resize((size_t)groups * h.fragment_size);
+        }
+    }
+}
+
+void frame_assembler::drop(slab &s) {
+    stats_.incomplete++;
+    stats_.missing_fragments += s.remaining;
+    s.in_use = false;
+}
+
+void frame_assembler::deliver(slab &s) {
+    s.in_use = false;
+    s.complete = false;
+    uint32_t len = s.len;
+    if(s.flags & STREAM_FLAG_CBC) {
+        if(len == 0 || len % AES_BLOCKLEN) {
+            stats_.malformed++;
+            return;
+        }
+        AES_CBC_decrypt_buffer(&cbc_ctx_, s.data.data(), len);
+        // PKCS#7
+        uint8_t pad = s.data[len - 1];
+        if(pad == 0 || pad > AES_BLOCKLEN || pad > len) {
+            stats_.malformed++;
+            return;
+        }
+        len -= pad;
+    }
+    if(s.has_crc && frame_crc32(0, s.data.data(), len) != s.crc) {
+        stats_.corrupt++;
+        return;
+    }
+    last_delivered_ = s.frame_id;
+    delivered_any_ = true;
+    stats_.frames++;
+    stats_.bytes += len;
+    uint32_t assembly_us = now_us() - s.started_us;
+    sink_.frame(assembled_frame{s.frame_id, s.stream_id, s.timestamp_us, assembly_us, s.data.data(), len});
+}
+
+void frame_assembler::evict(slab &s) {
+    if(s.complete) {
+        // Older frames are given up on so the complete one can go out in order
+        for(slab &other : slabs_) {
+            if(other.in_use && !other.complete && (int32_t)(other.frame_id - s.frame_id) < 0) {
+                drop(other);
+            }
+        }
+    } else {
+        drop(s);
+    }
+    flush();
+}
+
+void frame_assembler::flush() {
+    while(true) {
+        slab *oldest = nullptr;
+        for(slab &s : slabs_) {
+            if(s.in_use && (!oldest || (int32_t)(s.frame_id - oldest->frame_id) < 0)) {
+                oldest = &s;
+            }
+        }
+        if(!oldest || !oldest->complete) {
+            return;
+        }
+        deliver(*oldest);
+    }
+}
+
+void frame_assembler::enable_retransmit(nack_sink &nacks, uint32_t wait_us, uint32_t interval_us) {
+    nacks_ = &nacks;
+    wait_us_ = wait_us;
+    interval_us_ = interval_us;
+}
+
+void frame_assembler::send_nack(const slab &s) {
+    // One NACK per STREAM_NACK_BITMAP * 8 fragments that has any missing
+    const uint32_t span = STREAM_NACK_BITMAP * 8;
+    for(uint32_t first = 0; first < s.count; first += span) {
+        stream_nack n;
+        n.stream_id = s.stream_id;
+        n.frame_id = s.frame_id;
+        n.first = first;
+        uint32_t end = std::min<uint32_t>(first + span, s.count);
+        n.bitmap_len = (end - first + 7) / 8;
+        memset(n.bitmap, 0, sizeof(n.bitmap));
+        bool any = false;
+        for(uint32_t i = first; i < end; i++) {
+            if(!(s.received[i / 64] & (1ull << (i % 64)))) {
+                n.bitmap[(i - first) / 8] |= 1 << ((i - first) % 8);
+                any = true;
+            }
+        }
+        if(any) {
+            uint8_t out[STREAM_NACK_HEADER_SIZE + STREAM_NACK_BITMAP];
+            nacks_->nack(out, stream_nack_write(out, &n));
+            stats_.nacks++;
+        }
+    }
+}
+
+void frame_assembler::poll() {
+    if(!nacks_) {
+        return;
+    }
+    uint64_t now = now_us();
+    for(slab &s : slabs_) {
+        if(!s.in_use || s.complete) {
+            continue;
+        }
+        if(now - s.started_us >= wait_us_) {
+            drop(s);
+            continue;
+        }
+        // All of it should be here once a newer frame has started or nothing came for a while
+        bool sent = (int32_t)(newest_ - s.frame_id) > 0 || now - s.last_fragment_us >= interval_us_;
+        if(sent && now - s.last_nack_us >= interval_us_) {
+            send_nack(s);
+            s.last_nack_us = now;
+        }
+    }
+    flush();
+}
+
+// Bytes of fragment "i" of a frame of "len" bytes
+static uint32_t fragment_length(uint32_t len, uint32_t fragment_size, uint32_t i) {
+    uint32_t offset = i * fragment_size;
+    return len - offset < fragment_size ? len - offset : fragment_size;
+}
+
+void frame_assembler::decrypt(uint8_t *buf, size_t len, uint32_t frame_id, uint16_t counter_fragment) {
+    // Counter block: IV[0..7] | frame id | fragment index | block counter, see set_fragment_counter()
+    uint8_t counter[AES_BLOCKLEN];
+    memcpy(counter, iv_, 8);
+    stream_put32(&counter[8], frame_id);
+    stream_put16(&counter[12], counter_fragment);
+    counter[14] = 0;
+    counter[15] = 0;
+    AES_ctx_set_iv(&ctx_, counter);
+    AES_CTR_xcrypt_buffer(&ctx_, buf, len);
+}
+
+void frame_assembler::recover(slab &s, uint32_t group) {
+    uint32_t first = group * s.fec_group;
+    uint32_t end = std::min<uint32_t>(first + s.fec_group, s.count);
+    if(!s.parity_received[group] || s.group_received[group] != end - first - 1) {
+        return;
+    }
+    uint32_t missing = first;
+    while(s.received[missing / 64] & (1ull << (missing % 64))) {
+        missing++;
+    }
+    // Missing = parity ^ every other fragment of the group, only its own length matters
+    uint32_t missing_len = fragment_length(s.len, s.fragment_size, missing);
+    uint8_t *dst = s.data.data() + (size_t)missing * s.fragment_size;
+    memcpy(dst, &s.parity[(size_t)group * s.fragment_size], missing_len);
+    for(uint32_t i = first; i < end; i++) {
+        if(i != missing) {
+            fec_xor(dst, s.data.data() + (size_t)i * s.fragment_size,
+                std::min(missing_len, fragment_length(s.len, s.fragment_size, i)));
+        }
+    }
+    s.received[missing / 64] |= 1ull << (missing % 64);
+    s.group_received[group]++;
+    s.remaining--;
+    stats_.recovered++;
+}
+
+void frame_assembler::datagram(const uint8_t *data, size_t len) {
+    stats_.datagrams++;
+    stream_header h;
+    if(!stream_header_read(data, len, &h)) {
+        stats_.malformed++;
+        return;
+    }
+    bool parity = h.flags & STREAM_FLAG_PARITY;
+    const uint8_t *payload = data + STREAM_HEADER_SIZE;
+    size_t payload_len = len - STREAM_HEADER_SIZE;
+    const uint8_t *auth = nullptr;
+    if(h.flags & STREAM_FLAG_AEAD) {
+        if(payload_len < STREAM_AUTH_SIZE) {
+            stats_.malformed++;
+            return;
+        }
+        auth = payload;
+        payload += STREAM_AUTH_SIZE;
+        payload_len -= STREAM_AUTH_SIZE;
+    } else if(require_auth_) {
+        stats_.unauthenticated++;
+        return;
+    }
+    // The device splits every frame into exactly this many fragments, fragment_length() relies on it
+    if(h.frame_len == 0 || h.frame_len > max_frame_ || h.fragment_size == 0 ||
+        h.fragment_count != ((uint64_t)h.frame_len + h.fragment_size - 1) / h.fragment_size ||
+        payload_len > h.fragment_size) {
+        stats_.malformed++;
+        return;
+    }
+    if(parity) {
+        stats_.parity++;
+        if(h.fec_group == 0 || h.fragment >= fec_groups(h.fragment_count, h.fec_group)) {
+            stats_.malformed++;
+            return;
+        }
+    } else if(h.fragment >= h.fragment_count || (uint64_t)h.fragment * h.fragment_size + payload_len > h.frame_len ||
+        payload_len != fragment_length(h.frame_len, h.fragment_size, h.fragment)) {
+        stats_.malformed++;
+        return;
+    }
+
+    // Checked before anything else looks at the header, a forged one could reset the stream
+    uint8_t nonce[CHACHA20_NONCELEN];
+    if(auth) {
+        uint8_t aad[STREAM_HEADER_SIZE];
+        stream_auth_aad(aad, data);
+        stream_auth_nonce(nonce, stream_get32(auth), &h);
+        if(!chacha20poly1305_verify(aead_key_, nonce, aad, sizeof(aad), payload, payload_len, auth + 4)) {
+            stats_.unauthenticated++;
+            return;
+        }
+    }
+
+    if(delivered_any_ && (int32_t)(h.frame_id - last_delivered_) <= 0) {
+        if(last_delivered_ - h.frame_id < RESTART_GAP) {
+            // Parity of a frame that arrived whole is expected, it isn't counted as late
+            if(!parity) {
+                stats_.late++;
+            }
+            return;
+        }
+        // Device started counting from the beginning again
+        for(slab &s : slabs_) {
+            s.in_use = false;
+            s.complete = false;
+        }
+        delivered_any_ = false;
+        newest_ = h.frame_id;
+        AES_ctx_set_iv(&cbc_ctx_, iv_);
+    }
+
+    slab &s = slabs_[h.frame_id % slabs_.size()];
+    if(!s.in_use || s.frame_id != h.frame_id) {
+        if(s.in_use) {
+            if((int32_t)(h.frame_id - s.frame_id) < 0) {
+                // Slab already belongs to a newer frame
+                stats_.late++;
+                return;
+            }
+            evict(s);
+        }
+        start(s, h);
+        if((int32_t)(h.frame_id - newest_) > 0) {
+            newest_ = h.frame_id;
+        }
+    } else if(h.frame_len != s.len || h.fragment_count != s.count || h.fragment_size != s.fragment_size ||
+        h.fec_group != s.fec_group) {
+        stats_.malformed++;
+        return;
+    }
+    // With cut-through only the fragments sent after the camera readout carry it
+    if(h.flags & STREAM_FLAG_CRC) {
+        s.crc = h.frame_crc;
+        s.has_crc = true;
+    }
+
+    uint32_t group;
+    if(parity) {
+        group = h.fragment;
+        if(s.parity_received[group]) {
+            stats_.duplicate++;
+            return;
+        }
+        s.parity_received[group] = 1;
+        uint8_t *dst = &s.parity[(size_t)group * s.fragment_size];
+        memcpy(dst, payload, payload_len);
+        if(auth) {
+            chacha20_xor(aead_key_, nonce, 1, dst, payload_len);
+        } else if(!(s.flags & (STREAM_FLAG_CBC | STREAM_FLAG_PLAIN))) {
+            decrypt(dst, payload_len, h.frame_id, FEC_PARITY_COUNTER | group);
+        }
+    } else {
+        uint64_t bit = 1ull << (h.fragment % 64);
+        uint64_t &word = s.received[h.fragment / 64];
+        if(word & bit) {
+            stats_.duplicate++;
+            return;
+        }
+        word |= bit;
+        if(h.flags & STREAM_FLAG_RETRANSMIT) {
+            stats_.retransmitted++;
+        }
+
+        uint8_t *dst = s.data.data() + (size_t)h.fragment * h.fragment_size;
+        memcpy(dst, payload, payload_len);
+        if(auth) {
+            chacha20_xor(aead_key_, nonce, 1, dst, payload_len);
+        } else if(!(s.flags & (STREAM_FLAG_CBC | STREAM_FLAG_PLAIN))) {
+            decrypt(dst, payload_len, h.frame_id, h.fragment);
+        }
+        s.remaining--;
+        if(!s.fec_group) {
+            group = 0;
+        } else {
+            group = h.fragment / s.fec_group;
+            s.group_received[group]++;
+        }
+    }
+    if(s.fec_group) {
+        recover(s, group);
+    }
+    if(nacks_) {
+        s.last_fragment_us = now_us();
+    }
+
+    if(s.remaining == 0 && nacks_) {
+        if(!s.complete) {
+            s.complete = true;
+            flush();
+        }
+    } else if(s.remaining == 0) {
+        // Frames older than this one can't be shown anymore
+        for(slab &other : slabs_) {
+            if(&other != &s && other.in_use && (int32_t)(other.frame_id - s.frame_id) < 0) {
+                drop(other);
+            }
+        }
+        deliver(s);
+    }
+}
@@ -0,0 +1,156 @@
+#ifndef _FRAME_ASSEMBLER_H_
+#define _FRAME_ASSEMBLER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+#include "aes.h"
+#include "chacha20poly1305.h"
+#include "stream_header.h"
+#include "fec.h"
+#include "frame_check.h"
+}
+#include "frame_sink.h"
+
+/**
+ * Puts the fragments of one stream back together into frames
+ * Frames are assembled in a fixed set of slabs, frame id modulo the number of slabs picks
+ * the slab, so placing a fragment is O(1). A slab only grows when a frame is bigger than
+ * any before it, nothing is allocated per packet.
+ * Each fragment is copied to its place in the slab and decrypted there, ChaCha20-Poly1305
+ * fragments only once their tag checks out so a forged one never touches a slab. A complete frame
+ * goes to the sink, unless the device sent the frame's CRC and it doesn't match. With FEC a group missing a single fragment gets it rebuilt from the
+ * group's parity fragment as soon as the last other one is in. A frame still missing fragments when a newer frame needs its slab, or
+ * once a newer frame has been delivered, is dropped.
+ * With retransmission enabled missing fragments are NACKed instead, and a frame that completes
+ * while an older one is still waiting for its fragments is held back so frames still reach the
+ * sink in order. poll() sends the NACKs and gives up on frames that waited too long.
+ */
+class frame_assembler {
+public:
+    struct counters {
+        uint64_t datagrams = 0;
+        // Wrong version, too short or inconsistent with the rest of the frame
+        uint64_t malformed = 0;
+        // Tag didn't match, or not authenticated while require_auth() is on
+        uint64_t unauthenticated = 0;
+        // Fragment seen before
+        uint64_t duplicate = 0;
+        // Fragment of a frame that was already delivered or dropped
+        uint64_t late = 0;
+        uint64_t frames = 0;
+        uint64_t bytes = 0;
+        // Frames put back together that don't match the CRC the device read from the camera
+        uint64_t corrupt = 0;
+        // Frames given up on with fragments missing, and how many were missing
+        uint64_t incomplete = 0;
+        uint64_t missing_fragments = 0;
+        // FEC parity fragments received, and data fragments rebuilt from them
+        uint64_t parity = 0;
+        uint64_t recovered = 0;
+        // NACKs sent, and missing fragments that arrived resent
+        uint64_t nacks = 0;
+        uint64_t retransmitted = 0;
+    };
+
+    /**
+     * @param key STREAM_KEY_LEN bytes, the AES modes use the first AES_KEYLEN
+     * @param iv AES_BLOCKLEN bytes, the same as the device's
+     * @param max_frame Largest frame accepted
+     * @param slabs Frames that can be assembled at the same time
+     */
+    frame_assembler(const uint8_t *key, const uint8_t *iv, frame_sink &sink,
+        size_t max_frame = 256 * 1024, unsigned slabs = 4);
+
+    /**
+     * Handles one datagram, calls the sink when it completes a frame
+     */
+    void datagram(const uint8_t *data, size_t len);
+
+    /**
+     * Asks the device for missing fragments from now on
+     * @param wait_us How long after its first fragment a frame is waited for
+     * @param interval_us Quiet time before a frame is NACKed, and between NACKs for the same frame
+     */
+    void enable_retransmit(nack_sink &nacks, uint32_t wait_us = 150000, uint32_t interval_us = 20000);
+
+    /**
+     * Drops every datagram that isn't ChaCha20-Poly1305 authenticated (firmware built with ENCRYPT_AEAD)
+     * Without it plain, CTR and CBC fragments are still accepted, and those can be forged.
+     */
+    void require_auth(bool on) { require_auth_ = on; }
+
+    /**
+     * Sends NACKs that are due and gives up on frames past their wait, call every few milliseconds
+     */
+    void poll();
+
+    const counters &stats() const { return stats_; }
+
+private:
+    struct slab {
+        std::vector<uint8_t> data;
+        // Bit per fragment that has arrived
+        std::vector<uint64_t> received;
+        bool in_use = false;
+        uint32_t frame_id = 0;
+        uint32_t len = 0;
+        uint32_t timestamp_us = 0;
+        // Arrival of the first and the latest fragment, steady clock
+        uint64_t started_us = 0;
+        uint64_t last_fragment_us = 0;
+        // Retransmission: every fragment is in, held until the older frames are done
+        bool complete = false;
+        uint64_t last_nack_us = 0;
+        uint16_t stream_id = 0;
+        uint16_t count = 0;
+        uint16_t remaining = 0;
+        uint16_t fragment_size = 0;
+        uint8_t flags = 0;
+        // CRC-32 of the frame, once a fragment carrying it has arrived
+        bool has_crc = false;
+        uint32_t crc = 0;
+        // FEC: data fragments per parity fragment, 0 without
+        uint16_t fec_group = 0;
+        // Per group: parity, data fragments received, parity received
+        std::vector<uint8_t> parity;
+        std::vector<uint16_t> group_received;
+        std::vector<uint8_t> parity_received;
+    };
+
+    void start(slab &s, const stream_header &h);
+    void drop(slab &s);
+    void deliver(slab &s);
+    // Makes room in "s" for a newer frame
+    void evict(slab &s);
+    // Delivers held frames for as long as the oldest frame in progress is complete
+    void flush();
+    void send_nack(const slab &s);
+    void decrypt(uint8_t *buf, size_t len, uint32_t frame_id, uint16_t counter_fragment);
+    // Rebuilds the missing fragment of "group" if it is the only one missing and the parity is in
+    void recover(slab &s, uint32_t group);
+
+    frame_sink &sink_;
+    AES_ctx ctx_;
+    // CBC chains from frame to frame like the device's context does
+    AES_ctx cbc_ctx_;
+    uint8_t iv_[AES_BLOCKLEN];
+    uint8_t aead_key_[CHACHA20_KEYLEN];
+    bool require_auth_ = false;
+    size_t max_frame_;
+    std::vector<slab> slabs_;
+    // Newest frame handed to the sink
+    uint32_t last_delivered_ = 0;
+    bool delivered_any_ = false;
+    // Retransmission, off while nacks_ is null
+    nack_sink *nacks_ = nullptr;
+    uint32_t wait_us_ = 0;
+    uint32_t interval_us_ = 0;
+    // Newest frame any fragment was seen of
+    uint32_t newest_ = 0;
+    counters stats_;
+};
+
+#endif // _FRAME_ASSEMBLER_H_
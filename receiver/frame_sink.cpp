@@ -0,0 +1,119 @@
+#include "frame_sink.h"
+
+#include <cstdio>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+void file_sink::frame(const assembled_frame &f) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/frame_%08u.jpg", dir_.c_str(), f.frame_id);
+    FILE *out = fopen(path, "wb");
+    if(!out) {
+        perror(path);
+        return;
+    }
+    fwrite(f.data, 1, f.len, out);
+    fclose(out);
+}
+
+void pipe_sink::frame(const assembled_frame &f) {
+    size_t done = 0;
+    while(done < f.len) {
+        ssize_t n = write(fd_, f.data + done, f.len - done);
+        if(n <= 0) {
+            return;
+        }
+        done += n;
+    }
+}
+
+http_mjpeg_sink::http_mjpeg_sink(uint16_t port) {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) || listen(listen_fd_, 8)) {
+        perror("http sink");
+        close(listen_fd_);
+        listen_fd_ = -1;
+        return;
+    }
+    printf("MJPEG stream on http://0.0.0.0:%u/\n", port);
+    accept_thread_ = std::thread(&http_mjpeg_sink::accept_loop, this);
+}
+
+http_mjpeg_sink::~http_mjpeg_sink() {
+    if(listen_fd_ >= 0) {
+        shutdown(listen_fd_, SHUT_RDWR);
+        close(listen_fd_);
+    }
+    if(accept_thread_.joinable()) {
+        accept_thread_.join();
+    }
+    for(int fd : clients_) {
+        close(fd);
+    }
+}
+
+void http_mjpeg_sink::accept_loop() {
+    static const char response[] =
+        "HTTP/1.0 200 OK\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n\r\n";
+    while(true) {
+        int fd = accept(listen_fd_, nullptr, nullptr);
+        if(fd < 0) {
+            return;
+        }
+        // The request itself doesn't matter, every path gets the stream
+        if(send(fd, response, sizeof(response) - 1, MSG_NOSIGNAL) < 0) {
+            close(fd);
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(clients_lock_);
+        clients_.push_back(fd);
+    }
+}
+
+void http_mjpeg_sink::frame(const assembled_frame &f) {
+    char part[128];
+    int part_len = snprintf(part, sizeof(part),
+        "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: %zu\r\n\r\n", f.len);
+    std::lock_guard<std::mutex> lock(clients_lock_);
+    for(size_t i = 0; i < clients_.size();) {
+        int fd = clients_[i];
+        // Non blocking, a client whose socket buffer is full is dropped
+        bool ok = send(fd, part, part_len, MSG_NOSIGNAL | MSG_DONTWAIT) == part_len &&
+            send(fd, f.data, f.len, MSG_NOSIGNAL | MSG_DONTWAIT) == (ssize_t)f.len &&
+            send(fd, "\r\n", 2, MSG_NOSIGNAL | MSG_DONTWAIT) == 2;
+        if(ok) {
+            i++;
+        } else {
+            close(fd);
+            clients_.erase(clients_.begin() + i);
+        }
+    }
+}
+
+std::unique_ptr<frame_sink> make_sink(const std::string &spec) {
+    if(spec == "null") {
+        return std::make_unique<null_sink>();
+    }
+    if(spec == "pipe") {
+        return std::make_unique<pipe_sink>(STDOUT_FILENO);
+    }
+    if(spec.rfind("file:", 0) == 0) {
+        return std::make_unique<file_sink>(spec.substr(5));
+    }
+    if(spec.rfind("http:", 0) == 0) {
+        return std::make_unique<http_mjpeg_sink>(strtoul(spec.c_str() + 5, nullptr, 0));
+    }
+    return nullptr;
+}
@@ -0,0 +1,97 @@
+#ifndef _FRAME_SINK_H_
+#define _FRAME_SINK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * A complete, decrypted JPEG handed out by the frame assembler
+ * "data" is only valid during the frame_sink::frame() call.
+ */
+struct assembled_frame {
+    uint32_t frame_id;
+    uint16_t stream_id;
+    // Capture time on the device, low 32 bits of its microsecond clock
+    uint32_t timestamp_us;
+    // First fragment received until the frame was complete
+    uint32_t assembly_us;
+    const uint8_t *data;
+    size_t len;
+};
+
+/**
+ * Where complete frames go
+ */
+class frame_sink {
+public:
+    virtual ~frame_sink() = default;
+    virtual void frame(const assembled_frame &f) = 0;
+};
+
+/**
+ * Where the frame assembler's NACKs go, back to the device the stream came from
+ * "data" is a NACK datagram in wire format (see stream_header.h).
+ */
+class nack_sink {
+public:
+    virtual ~nack_sink() = default;
+    virtual void nack(const uint8_t *data, size_t len) = 0;
+};
+
+// Throws frames away, for benchmarks
+class null_sink : public frame_sink {
+public:
+    void frame(const assembled_frame &) override {}
+};
+
+// Writes every frame to DIR/frame_<id>.jpg
+class file_sink : public frame_sink {
+public:
+    explicit file_sink(std::string dir) : dir_(std::move(dir)) {}
+    void frame(const assembled_frame &f) override;
+
+private:
+    std::string dir_;
+};
+
+// Writes the JPEGs back to back to a file descriptor, e.g. stdout into "ffplay -f mjpeg -"
+class pipe_sink : public frame_sink {
+public:
+    explicit pipe_sink(int fd) : fd_(fd) {}
+    void frame(const assembled_frame &f) override;
+
+private:
+    int fd_;
+};
+
+/**
+ * Serves the stream as multipart/x-mixed-replace MJPEG over HTTP, viewable in a browser
+ * Clients that can't keep up are dropped instead of slowing the receiver down.
+ */
+class http_mjpeg_sink : public frame_sink {
+public:
+    explicit http_mjpeg_sink(uint16_t port);
+    ~http_mjpeg_sink() override;
+    void frame(const assembled_frame &f) override;
+
+private:
+    void accept_loop();
+
+    int listen_fd_ = -1;
+    std::thread accept_thread_;
+    std::mutex clients_lock_;
+    std::vector<int> clients_;
+};
+
+/**
+ * Makes a sink from a command line spec: "null", "pipe", "file:DIR" or "http:PORT"
+ * @returns nullptr for an unknown spec
+ */
+std::unique_ptr<frame_sink> make_sink(const std::string &spec);
+
+#endif // _FRAME_SINK_H_
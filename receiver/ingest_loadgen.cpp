@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+extern "C" {
+#include "stream_header.h"
+}
+
+/**
+ * Load generator for arducam_ingest: simulates many cameras over loopback
+ * Every camera has its own socket, and so its own source port, and sends frames in the
+ * firmware's wire format at a fixed frame rate. The cameras' frames are spread evenly
+ * over the frame period. Payloads are not real ciphertext, the ingest server does the
+ * same work on them either way.
+ *
+ * Usage: ingest_loadgen [options]
+ *   -c N     cameras (default 100)
+ *   -f FPS   frames per second per camera (default 30)
+ *   -n B     frame size in bytes (default 8000)
+ *   -t S     seconds to run for (default 10)
+ *   -g N     sender threads (default 1)
+ *   -a IP    ingest server address (default 127.0.0.1)
+ *   -p PORT  ingest server port (default 20001)
+ */
+
+static const uint16_t FRAGMENT_SIZE = 1400;
+
+struct sim_camera {
+    int fd;
+    uint16_t stream_id;
+    uint32_t frame_id;
+};
+
+struct sender_totals {
+    uint64_t frames = 0;
+    uint64_t datagrams = 0;
+    // Frame sends that started after the next one was already due
+    uint64_t late = 0;
+};
+
+static void send_frame(sim_camera &cam, const std::vector<uint8_t> &payload, sender_totals &totals) {
+    uint32_t frame_len = payload.size();
+    uint16_t count = (frame_len + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE;
+    uint8_t headers[64][STREAM_HEADER_SIZE];
+    iovec iov[64][2];
+    mmsghdr msgs[64];
+    cam.frame_id++;
+    uint32_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    for(uint16_t first = 0; first < count; first += 64) {
+        unsigned batch = std::min<unsigned>(64, count - first);
+        for(unsigned j = 0; j < batch; j++) {
+            uint16_t i = first + j;
+            uint32_t offset = i * FRAGMENT_SIZE;
+            stream_header h = {};
+            h.flags = i == count - 1 ? STREAM_FLAG_LAST : 0;
+            h.fragment = i;
+            h.frame_id = cam.frame_id;
+            h.frame_len = frame_len;
+            h.fragment_count = count;
+            h.fragment_size = FRAGMENT_SIZE;
+            h.timestamp_us = now;
+            h.stream_id = cam.stream_id;
+            stream_header_write(headers[j], &h);
+            iov[j][0] = { headers[j], STREAM_HEADER_SIZE };
+            iov[j][1] = { (void*)&payload[offset], std::min<size_t>(FRAGMENT_SIZE, frame_len - offset) };
+            memset(&msgs[j], 0, sizeof(mmsghdr));
+            msgs[j].msg_hdr.msg_iov = iov[j];
+            msgs[j].msg_hdr.msg_iovlen = 2;
+        }
+        int n = sendmmsg(cam.fd, msgs, batch, 0);
+        if(n > 0) {
+            totals.datagrams += n;
+        }
+    }
+    totals.frames++;
+}
+
+static void sender(std::vector<sim_camera> cams, unsigned fps, uint32_t frame_len,
+    std::chrono::steady_clock::time_point end, sender_totals *totals) {
+    std::vector<uint8_t> payload(frame_len);
+    for(uint32_t i = 0; i < frame_len; i++) {
+        payload[i] = i * 31 + 7;
+    }
+    // Camera i of this thread sends at start + i * (period / cameras) + k * period
+    auto period = std::chrono::nanoseconds(1000000000ull / fps);
+    auto slot = period / cams.size();
+    auto next = std::chrono::steady_clock::now();
+    size_t i = 0;
+    while(next < end) {
+        auto now = std::chrono::steady_clock::now();
+        if(now < next) {
+            std::this_thread::sleep_until(next);
+        } else if(now - next > slot) {
+            totals->late++;
+        }
+        send_frame(cams[i], payload, *totals);
+        i = (i + 1) % cams.size();
+        next += slot;
+    }
+}
+
+int main(int argc, char **argv) {
+    unsigned cameras = 100;
+    unsigned fps = 30;
+    uint32_t frame_len = 8000;
+    unsigned seconds = 10;
+    unsigned threads = 1;
+    const char *ip = "127.0.0.1";
+    uint16_t port = 20001;
+
+    int opt;
+    while((opt = getopt(argc, argv, "c:f:n:t:g:a:p:")) != -1) {
+        switch(opt) {
+            case 'c': cameras = strtoul(optarg, nullptr, 0); break;
+            case 'f': fps = strtoul(optarg, nullptr, 0); break;
+            case 'n': frame_len = strtoul(optarg, nullptr, 0); break;
+            case 't': seconds = strtoul(optarg, nullptr, 0); break;
+            case 'g': threads = strtoul(optarg, nullptr, 0); break;
+            case 'a': ip = optarg; break;
+            case 'p': port = strtoul(optarg, nullptr, 0); break;
+            default:
+                fprintf(stderr, "Usage: %s [-c cameras] [-f fps] [-n frame_bytes] [-t seconds] [-g threads] [-a ip] [-p port]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(cameras == 0 || fps == 0 || frame_len == 0 || threads == 0) {
+        fprintf(stderr, "Cameras, fps, frame size and threads must not be 0\n");
+        return 1;
+    }
+    threads = std::min(threads, cameras);
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if(inet_pton(AF_INET, ip, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Bad address %s\n", ip);
+        return 1;
+    }
+
+    std::vector<std::vector<sim_camera>> groups(threads);
+    for(unsigned c = 0; c < cameras; c++) {
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if(fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr))) {
+            perror("camera socket");
+            return 1;
+        }
+        groups[c % threads].push_back(sim_camera{ fd, (uint16_t)c, 0 });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::seconds(seconds);
+    std::vector<sender_totals> totals(threads);
+    std::vector<std::thread> senders;
+    for(unsigned t = 0; t < threads; t++) {
+        senders.emplace_back(sender, groups[t], fps, frame_len, end, &totals[t]);
+    }
+    for(std::thread &t : senders) {
+        t.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    sender_totals sum;
+    for(const sender_totals &t : totals) {
+        sum.frames += t.frames;
+        sum.datagrams += t.datagrams;
+        sum.late += t.late;
+    }
+    printf("%u cameras at %u fps, %u byte frames, %.1f s\n", cameras, fps, frame_len, elapsed);
+    printf("Sent %llu frames (%.1f fps, target %u), %.0f datagrams/s, %.1f MB/s, %llu late\n",
+        (unsigned long long)sum.frames, sum.frames / elapsed, cameras * fps, sum.datagrams / elapsed,
+        sum.frames * (double)frame_len / elapsed / 1e6, (unsigned long long)sum.late);
+    return 0;
+}
@@ -0,0 +1,340 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" {
+#include "latency_hist.h"
+}
+#include "frame_assembler.h"
+#include "frame_sink.h"
+#include "udp_batch.h"
+
+/**
+ * Ingest server for a fleet of cameras
+ * Every worker thread has its own socket on the same port (SO_REUSEPORT), the kernel hashes
+ * each source address onto one of them, so a camera always lands on the same worker and
+ * workers share no state. Each worker keeps one frame assembler per (source address,
+ * stream id) and per camera counters.
+ *
+ * Usage: arducam_ingest [options]
+ *   -p PORT  UDP port (default 20001)
+ *   -w N     worker threads (default 1)
+ *   -o SINK  null (default) or file:DIR, frames go to DIR/<address>_<port>_<stream>/
+ *   -k KEY   key (default YOUR_KEY)
+ *   -i IV    AES IV (default YOUR_IV)
+ *   -t S     stop after S seconds and print every camera (default 0, run forever)
+ *   -v       also print every camera each second, averaged since the start
+ *   -r MS    NACK missing fragments and wait up to MS milliseconds for them (default 0, off)
+ *   -a       only accept authenticated fragments, the cameras need ENCRYPT_AEAD
+ */
+
+struct source_key {
+    uint32_t addr;
+    uint16_t port;
+    uint16_t stream_id;
+    bool operator==(const source_key &o) const {
+        return addr == o.addr && port == o.port && stream_id == o.stream_id;
+    }
+};
+
+struct source_key_hash {
+    size_t operator()(const source_key &k) const {
+        uint64_t v = (uint64_t)k.addr << 32 | (uint32_t)k.port << 16 | k.stream_id;
+        return (v * 0x9E3779B97F4A7C15ull) >> 32;
+    }
+};
+
+static std::string source_name(const source_key &k) {
+    char addr[INET_ADDRSTRLEN];
+    in_addr a = { htonl(k.addr) };
+    inet_ntop(AF_INET, &a, addr, sizeof(addr));
+    return std::string(addr) + ":" + std::to_string(k.port) + "/" + std::to_string(k.stream_id);
+}
+
+// Numbers for one camera as last published by its worker
+struct camera_snapshot {
+    source_key key;
+    frame_assembler::counters counters;
+    uint32_t assembly_p50;
+    uint32_t assembly_p99;
+    uint32_t delay_p50;
+    uint32_t delay_p99;
+};
+
+/**
+ * One camera: its assembler plus the sink the frames go on to
+ * Sits between the assembler and the real sink to time every frame.
+ */
+class camera : public frame_sink {
+public:
+    camera(const source_key &key, const uint8_t *aes_key, const uint8_t *iv, std::unique_ptr<frame_sink> sink,
+        int fd, unsigned retransmit_ms, bool require_auth)
+        : key_(key), sink_(std::move(sink)), nacks_(fd),
+          assembler_(aes_key, iv, *this, 1024 * 1024, retransmit_ms ? 3 + retransmit_ms * 30 / 1000 : 3) {
+        assembler_.require_auth(require_auth);
+        memset(&assembly_, 0, sizeof(assembly_));
+        memset(&delay_, 0, sizeof(delay_));
+        if(retransmit_ms) {
+            // NACKs go back to the camera's own address and port
+            sockaddr_in to;
+            memset(&to, 0, sizeof(to));
+            to.sin_family = AF_INET;
+            to.sin_addr.s_addr = htonl(key.addr);
+            to.sin_port = htons(key.port);
+            nacks_.set_destination(to);
+            assembler_.enable_retransmit(nacks_, retransmit_ms * 1000);
+        }
+    }
+
+    void datagram(const uint8_t *data, size_t len) { assembler_.datagram(data, len); }
+    void poll() { assembler_.poll(); }
+
+    void frame(const assembled_frame &f) override {
+        latency_record(&assembly_, f.assembly_us);
+        // Device and host clocks aren't synchronised, the delay is measured above the
+        // smallest capture to arrival offset seen so far, i.e. queueing and jitter
+        uint32_t offset = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count() - f.timestamp_us;
+        if(!have_offset_ || (int32_t)(offset - min_offset_) < 0) {
+            min_offset_ = offset;
+            have_offset_ = true;
+        }
+        latency_record(&delay_, offset - min_offset_);
+        sink_->frame(f);
+    }
+
+    camera_snapshot snapshot() const {
+        return camera_snapshot{ key_, assembler_.stats(),
+            latency_percentile(&assembly_, 50), latency_percentile(&assembly_, 99),
+            latency_percentile(&delay_, 50), latency_percentile(&delay_, 99) };
+    }
+
+private:
+    source_key key_;
+    std::unique_ptr<frame_sink> sink_;
+    udp_nack_sink nacks_;
+    frame_assembler assembler_;
+    latency_hist assembly_;
+    latency_hist delay_;
+    uint32_t min_offset_ = 0;
+    bool have_offset_ = false;
+};
+
+struct options {
+    uint16_t port = 20001;
+    unsigned workers = 1;
+    std::string sink = "null";
+    uint8_t key[STREAM_KEY_LEN] = "YOUR_KEY";
+    uint8_t iv[AES_BLOCKLEN] = "YOUR_IV";
+    unsigned seconds = 0;
+    bool verbose = false;
+    unsigned retransmit_ms = 0;
+    bool require_auth = false;
+};
+
+static std::atomic<bool> running(true);
+
+class worker {
+public:
+    explicit worker(const options &opt) : opt_(opt) {}
+
+    bool start() {
+        fd_ = udp_listen(opt_.port, true);
+        if(fd_ < 0) {
+            return false;
+        }
+        thread_ = std::thread(&worker::run, this);
+        return true;
+    }
+
+    void join() {
+        thread_.join();
+        close(fd_);
+    }
+
+    // Copy of every camera's numbers, at most one publish interval old
+    std::vector<camera_snapshot> snapshots() {
+        std::lock_guard<std::mutex> lock(lock_);
+        return published_;
+    }
+
+private:
+    std::unique_ptr<frame_sink> make_camera_sink(const source_key &key) {
+        if(opt_.sink.rfind("file:", 0) == 0) {
+            std::string name = source_name(key);
+            std::replace(name.begin(), name.end(), ':', '_');
+            std::replace(name.begin(), name.end(), '/', '_');
+            std::string base = opt_.sink.substr(5);
+            mkdir(base.c_str(), 0755);
+            mkdir((base + "/" + name).c_str(), 0755);
+            return std::make_unique<file_sink>(base + "/" + name);
+        }
+        return std::make_unique<null_sink>();
+    }
+
+    void run() {
+        udp_batch batch;
+        auto last_publish = std::chrono::steady_clock::now();
+        auto last_poll = last_publish;
+        while(running.load(std::memory_order_relaxed)) {
+            int n = batch.receive(fd_, opt_.retransmit_ms ? 5 : 100);
+            for(int i = 0; i < n; i++) {
+                const uint8_t *data = batch.data(i);
+                size_t len = batch.length(i);
+                const sockaddr_in &from = batch.source(i);
+                source_key key = { ntohl(from.sin_addr.s_addr), ntohs(from.sin_port),
+                    len >= STREAM_HEADER_SIZE ? stream_get16(&data[20]) : (uint16_t)0 };
+                auto it = cameras_.find(key);
+                if(it == cameras_.end()) {
+                    it = cameras_.emplace(key, std::make_unique<camera>(key, opt_.key, opt_.iv,
+                        make_camera_sink(key), fd_, opt_.retransmit_ms, opt_.require_auth)).first;
+                }
+                it->second->datagram(data, len);
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if(opt_.retransmit_ms && now - last_poll >= std::chrono::milliseconds(5)) {
+                for(auto &c : cameras_) {
+                    c.second->poll();
+                }
+                last_poll = now;
+            }
+            if(now - last_publish >= std::chrono::milliseconds(500)) {
+                publish();
+                last_publish = now;
+            }
+        }
+        publish();
+    }
+
+    void publish() {
+        std::vector<camera_snapshot> snaps;
+        snaps.reserve(cameras_.size());
+        for(auto &c : cameras_) {
+            snaps.push_back(c.second->snapshot());
+        }
+        std::lock_guard<std::mutex> lock(lock_);
+        published_.swap(snaps);
+    }
+
+    const options &opt_;
+    int fd_ = -1;
+    std::thread thread_;
+    // Only touched by the worker thread
+    std::unordered_map<source_key, std::unique_ptr<camera>, source_key_hash> cameras_;
+    std::mutex lock_;
+    std::vector<camera_snapshot> published_;
+};
+
+// Rates are averaged over "dt" seconds
+static void print_camera(const camera_snapshot &s, double dt) {
+    const frame_assembler::counters &c = s.counters;
+    uint64_t expected = c.datagrams + c.missing_fragments;
+    printf("  %-24s %7.1f fps %8.1f KB/s  loss %5.2f%%  incomplete %6llu  assembly p50/p99 %6u/%6u us  delay p50/p99 %6u/%6u us\n",
+        source_name(s.key).c_str(), c.frames / dt, c.bytes / dt / 1000,
+        expected ? 100.0 * c.missing_fragments / expected : 0.0, (unsigned long long)c.incomplete,
+        s.assembly_p50, s.assembly_p99, s.delay_p50, s.delay_p99);
+}
+
+int main(int argc, char **argv) {
+    options opt;
+    int o;
+    while((o = getopt(argc, argv, "p:w:o:k:i:t:vr:a")) != -1) {
+        switch(o) {
+            case 'p': opt.port = strtoul(optarg, nullptr, 0); break;
+            case 'w': opt.workers = std::max(1ul, strtoul(optarg, nullptr, 0)); break;
+            case 'o': opt.sink = optarg; break;
+            case 'k': memset(opt.key, 0, sizeof(opt.key)); memcpy(opt.key, optarg, strnlen(optarg, sizeof(opt.key))); break;
+            case 'i': memset(opt.iv, 0, sizeof(opt.iv)); memcpy(opt.iv, optarg, strnlen(optarg, sizeof(opt.iv))); break;
+            case 't': opt.seconds = strtoul(optarg, nullptr, 0); break;
+            case 'v': opt.verbose = true; break;
+            case 'r': opt.retransmit_ms = strtoul(optarg, nullptr, 0); break;
+            case 'a': opt.require_auth = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-p port] [-w workers] [-o null|file:DIR] [-k key] [-i iv] [-t seconds] [-v] [-r wait_ms] [-a]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(opt.sink != "null" && opt.sink.rfind("file:", 0) != 0) {
+        fprintf(stderr, "Unknown sink %s\n", opt.sink.c_str());
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<worker>> workers;
+    for(unsigned i = 0; i < opt.workers; i++) {
+        workers.push_back(std::make_unique<worker>(opt));
+        if(!workers.back()->start()) {
+            return 1;
+        }
+    }
+    printf("Listening on port %u with %u workers\n", opt.port, opt.workers);
+
+    auto start = std::chrono::steady_clock::now();
+    auto last = start;
+    frame_assembler::counters last_total;
+    while(!opt.seconds || std::chrono::steady_clock::now() - start < std::chrono::seconds(opt.seconds)) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        auto now = std::chrono::steady_clock::now();
+        double dt = std::chrono::duration<double>(now - last).count();
+        last = now;
+
+        frame_assembler::counters total;
+        unsigned cameras = 0;
+        for(unsigned w = 0; w < workers.size(); w++) {
+            std::vector<camera_snapshot> snaps = workers[w]->snapshots();
+            cameras += snaps.size();
+            for(const camera_snapshot &s : snaps) {
+                total.datagrams += s.counters.datagrams;
+                total.frames += s.counters.frames;
+                total.bytes += s.counters.bytes;
+                total.incomplete += s.counters.incomplete;
+                total.missing_fragments += s.counters.missing_fragments;
+                total.malformed += s.counters.malformed;
+                total.unauthenticated += s.counters.unauthenticated;
+                total.corrupt += s.counters.corrupt;
+                if(opt.verbose) {
+                    print_camera(s, std::chrono::duration<double>(now - start).count());
+                }
+            }
+        }
+        uint64_t expected = total.datagrams + total.missing_fragments;
+        printf("%u cameras: %.1f fps, %.1f MB/s, %.0f datagrams/s, loss %.2f%%, incomplete %llu, malformed %llu, unauthenticated %llu, corrupt %llu\n",
+            cameras, (total.frames - last_total.frames) / dt, (total.bytes - last_total.bytes) / dt / 1e6,
+            (total.datagrams - last_total.datagrams) / dt,
+            expected ? 100.0 * total.missing_fragments / expected : 0.0,
+            (unsigned long long)total.incomplete, (unsigned long long)total.malformed,
+            (unsigned long long)total.unauthenticated, (unsigned long long)total.corrupt);
+        fflush(stdout);
+        last_total = total;
+    }
+
+    running = false;
+    for(auto &w : workers) {
+        w->join();
+    }
+    // Final per camera numbers, averaged over the whole run
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for(unsigned w = 0; w < workers.size(); w++) {
+        std::vector<camera_snapshot> snaps = workers[w]->snapshots();
+        printf("Worker %u: %zu cameras\n", w, snaps.size());
+        std::sort(snaps.begin(), snaps.end(), [](const camera_snapshot &a, const camera_snapshot &b) {
+            return source_name(a.key) < source_name(b.key);
+        });
+        for(const camera_snapshot &s : snaps) {
+            print_camera(s, elapsed);
+        }
+    }
+    return 0;
+}
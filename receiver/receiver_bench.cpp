@@ -0,0 +1,136 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "frame_assembler.h"
+#include "frame_sink.h"
+#include "udp_batch.h"
+
+/**
+ * Loopback throughput of the receiver
+ * A sender thread blasts frames in the firmware's wire format at the receiver as fast as
+ * the kernel takes them, the receiver assembles and decrypts them into a null sink.
+ * The payload is not real ciphertext, only the work done on it matters.
+ *
+ * Usage: receiver_bench [-n frame_bytes] [-t seconds] [-p port] [-b batch]
+ */
+
+static const uint16_t FRAGMENT_SIZE = 1400;
+
+static std::atomic<bool> running(true);
+
+// Sends frames with increasing ids, one sendmmsg() per frame
+static void sender(uint16_t port, uint32_t frame_len, uint64_t *frames_sent) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    connect(fd, (sockaddr*)&addr, sizeof(addr));
+
+    uint16_t count = (frame_len + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE;
+    std::vector<uint8_t> payload(frame_len);
+    for(uint32_t i = 0; i < frame_len; i++) {
+        payload[i] = i * 31 + 7;
+    }
+    std::vector<uint8_t> headers(count * STREAM_HEADER_SIZE);
+    std::vector<iovec> iov(count * 2);
+    std::vector<mmsghdr> msgs(count);
+    for(uint16_t i = 0; i < count; i++) {
+        uint32_t offset = i * FRAGMENT_SIZE;
+        iov[i * 2] = { &headers[i * STREAM_HEADER_SIZE], STREAM_HEADER_SIZE };
+        iov[i * 2 + 1] = { &payload[offset], std::min<size_t>(FRAGMENT_SIZE, frame_len - offset) };
+        memset(&msgs[i], 0, sizeof(mmsghdr));
+        msgs[i].msg_hdr.msg_iov = &iov[i * 2];
+        msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+
+    uint32_t id = 0;
+    while(running.load(std::memory_order_relaxed)) {
+        id++;
+        for(uint16_t i = 0; i < count; i++) {
+            stream_header h = {};
+            h.flags = i == count - 1 ? STREAM_FLAG_LAST : 0;
+            h.fragment = i;
+            h.frame_id = id;
+            h.frame_len = frame_len;
+            h.fragment_count = count;
+            h.fragment_size = FRAGMENT_SIZE;
+            h.timestamp_us = id;
+            stream_header_write(&headers[i * STREAM_HEADER_SIZE], &h);
+        }
+        unsigned sent = 0;
+        while(sent < count && running.load(std::memory_order_relaxed)) {
+            int n = sendmmsg(fd, &msgs[sent], count - sent, 0);
+            if(n > 0) {
+                sent += n;
+            }
+        }
+        (*frames_sent)++;
+    }
+    close(fd);
+}
+
+int main(int argc, char **argv) {
+    uint32_t frame_len = 22000;
+    unsigned seconds = 5;
+    uint16_t port = 20201;
+    unsigned batch_size = 64;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:t:p:b:")) != -1) {
+        switch(opt) {
+            case 'n': frame_len = strtoul(optarg, nullptr, 0); break;
+            case 't': seconds = strtoul(optarg, nullptr, 0); break;
+            case 'p': port = strtoul(optarg, nullptr, 0); break;
+            case 'b': batch_size = strtoul(optarg, nullptr, 0); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n frame_bytes] [-t seconds] [-p port] [-b batch]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    int fd = udp_listen(port);
+    if(fd < 0) {
+        return 1;
+    }
+    uint8_t key[STREAM_KEY_LEN] = "YOUR_KEY";
+    uint8_t iv[AES_BLOCKLEN] = "YOUR_IV";
+    null_sink sink;
+    frame_assembler assembler(key, iv, sink);
+    udp_batch batch(batch_size);
+
+    uint64_t frames_sent = 0;
+    std::thread send_thread(sender, port, frame_len, &frames_sent);
+
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::seconds(seconds);
+    uint64_t calls = 0;
+    while(std::chrono::steady_clock::now() < end) {
+        int n = batch.receive(fd, 100);
+        calls++;
+        for(int i = 0; i < n; i++) {
+            assembler.datagram(batch.data(i), batch.length(i));
+        }
+    }
+    running = false;
+    send_thread.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const frame_assembler::counters &c = assembler.stats();
+    printf("Frame %u bytes, batch %u, %.1f s\n", frame_len, batch_size, elapsed);
+    printf("Sent %llu frames, assembled %llu, incomplete %llu\n", (unsigned long long)frames_sent,
+        (unsigned long long)c.frames, (unsigned long long)c.incomplete);
+    printf("%.0f datagrams/s, %.1f datagrams per receive call\n", c.datagrams / elapsed, (double)c.datagrams / calls);
+    printf("%.1f fps, %.1f MB/s, %.0f cameras at 30 fps\n", c.frames / elapsed, c.bytes / elapsed / 1e6, c.frames / elapsed / 30);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "frame_assembler.h"
+#include "frame_sink.h"
+#include "udp_batch.h"
+
+/**
+ * Native receiver for the camera stream, replaces udp_server.py when it can't keep up
+ *
+ * Usage: arducam_receiver [options]
+ *   -p PORT  UDP port to listen on (default 20001)
+ *   -o SINK  where frames go: http:PORT (default http:8080), file:DIR, pipe or null
+ *   -k KEY   key, same as the firmware's (default YOUR_KEY)
+ *   -i IV    AES IV, same as the firmware's (default YOUR_IV)
+ *   -t S     stop after S seconds (default 0, run forever)
+ *   -r MS    NACK missing fragments and wait up to MS milliseconds for them to be resent,
+ *            the firmware needs RETRANSMIT_FRAMES (default 0, off)
+ *   -a       only accept authenticated fragments, the firmware needs ENCRYPT_AEAD
+ *
+ * Prints frames and bytes per second and the loss counters once a second on stderr, and
+ * sends the fragment loss of that second back to the camera for its rate controller.
+ */
+
+// Loss report for the second that just ended, to where the stream last came from
+static void send_report(int fd, const sockaddr_in &to, uint16_t stream_id, uint64_t datagrams, uint64_t missing, double dt) {
+    uint64_t expected = datagrams + missing;
+    stream_report r = { stream_id, (uint16_t)(expected ? missing * 1000 / expected : 0),
+        (uint16_t)std::min<uint64_t>(datagrams, UINT16_MAX), (uint16_t)std::min<double>(dt * 1000, UINT16_MAX) };
+    uint8_t out[STREAM_REPORT_SIZE];
+    stream_report_write(out, &r);
+    sendto(fd, out, sizeof(out), 0, (const sockaddr*)&to, sizeof(to));
+}
+
+int main(int argc, char **argv) {
+    uint16_t port = 20001;
+    std::string sink_spec = "http:8080";
+    // Zero padded like the firmware's string literals
+    uint8_t key[STREAM_KEY_LEN] = "YOUR_KEY";
+    uint8_t iv[AES_BLOCKLEN] = "YOUR_IV";
+    unsigned seconds = 0;
+    unsigned retransmit_ms = 0;
+    bool require_auth = false;
+
+    int opt;
+    while((opt = getopt(argc, argv, "p:o:k:i:t:r:a")) != -1) {
+        switch(opt) {
+            case 'p': port = strtoul(optarg, nullptr, 0); break;
+            case 'o': sink_spec = optarg; break;
+            case 'k': memset(key, 0, sizeof(key)); memcpy(key, optarg, strnlen(optarg, sizeof(key))); break;
+            case 'i': memset(iv, 0, sizeof(iv)); memcpy(iv, optarg, strnlen(optarg, sizeof(iv))); break;
+            case 't': seconds = strtoul(optarg, nullptr, 0); break;
+            case 'r': retransmit_ms = strtoul(optarg, nullptr, 0); break;
+            case 'a': require_auth = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-p port] [-o http:PORT|file:DIR|pipe|null] [-k key] [-i iv] [-t seconds] [-r wait_ms] [-a]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    std::unique_ptr<frame_sink> sink = make_sink(sink_spec);
+    if(!sink) {
+        fprintf(stderr, "Unknown sink %s\n", sink_spec.c_str());
+        return 1;
+    }
+    int fd = udp_listen(port);
+    if(fd < 0) {
+        return 1;
+    }
+
+    // Frames waiting for resent fragments hold on to their slab, at 30 fps that's a few more
+    frame_assembler assembler(key, iv, *sink, 256 * 1024, retransmit_ms ? 4 + retransmit_ms * 30 / 1000 : 4);
+    assembler.require_auth(require_auth);
+    udp_nack_sink nacks(fd);
+    if(retransmit_ms) {
+        assembler.enable_retransmit(nacks, retransmit_ms * 1000);
+    }
+    udp_batch batch;
+    auto start = std::chrono::steady_clock::now();
+    auto last_report = start;
+    frame_assembler::counters last = assembler.stats();
+    sockaddr_in source;
+    bool have_source = false;
+    uint16_t stream_id = 0;
+    while(true) {
+        // NACKs are only sent from poll(), it has to run often
+        int n = batch.receive(fd, retransmit_ms ? 5 : 100);
+        if(n < 0) {
+            perror("recvmmsg");
+            return 1;
+        }
+        for(int i = 0; i < n; i++) {
+            assembler.datagram(batch.data(i), batch.length(i));
+        }
+        if(n > 0) {
+            source = batch.source(n - 1);
+            have_source = true;
+            stream_header h;
+            if(stream_header_read(batch.data(n - 1), batch.length(n - 1), &h)) {
+                stream_id = h.stream_id;
+            }
+            nacks.set_destination(source);
+        }
+        assembler.poll();
+
+        auto now = std::chrono::steady_clock::now();
+        if(now - last_report >= std::chrono::seconds(1)) {
+            double dt = std::chrono::duration<double>(now - last_report).count();
+            const frame_assembler::counters &c = assembler.stats();
+            fprintf(stderr, "%.1f fps, %.1f KB/s, incomplete %llu (%llu fragments), recovered %llu, NACKs %llu, resent %llu, late %llu, duplicate %llu, malformed %llu, unauthenticated %llu, corrupt %llu\n",
+                (c.frames - last.frames) / dt, (c.bytes - last.bytes) / dt / 1000,
+                (unsigned long long)c.incomplete, (unsigned long long)c.missing_fragments, (unsigned long long)c.recovered,
+                (unsigned long long)c.nacks, (unsigned long long)c.retransmitted,
+                (unsigned long long)c.late, (unsigned long long)c.duplicate, (unsigned long long)c.malformed,
+                (unsigned long long)c.unauthenticated, (unsigned long long)c.corrupt);
+            if(have_source) {
+                send_report(fd, source, stream_id, c.datagrams - last.datagrams, c.missing_fragments - last.missing_fragments, dt);
+            }
+            last = c;
+            last_report = now;
+            if(seconds && now - start >= std::chrono::seconds(seconds)) {
+                break;
+            }
+        }
+    }
+    close(fd);
+    return 0;
+}
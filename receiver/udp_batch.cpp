@@ -0,0 +1,66 @@
+#include "udp_batch.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+
+udp_batch::udp_batch(unsigned batch) : buffers_(batch * MAX_DATAGRAM), iovecs_(batch), headers_(batch), sources_(batch) {
+    for(unsigned i = 0; i < batch; i++) {
+        iovecs_[i].iov_base = &buffers_[i * MAX_DATAGRAM];
+        iovecs_[i].iov_len = MAX_DATAGRAM;
+        memset(&headers_[i], 0, sizeof(mmsghdr));
+        headers_[i].msg_hdr.msg_iov = &iovecs_[i];
+        headers_[i].msg_hdr.msg_iovlen = 1;
+        headers_[i].msg_hdr.msg_name = &sources_[i];
+    }
+}
+
+int udp_batch::receive(int fd, int timeout_ms) {
+    pollfd p = { fd, POLLIN, 0 };
+    int ready = poll(&p, 1, timeout_ms > 0 ? timeout_ms : -1);
+    if(ready <= 0) {
+        return (ready == 0 || errno == EINTR) ? 0 : -1;
+    }
+    for(mmsghdr &h : headers_) {
+        h.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    }
+    int n = recvmmsg(fd, headers_.data(), headers_.size(), MSG_DONTWAIT, nullptr);
+    if(n < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    return n;
+}
+
+void udp_nack_sink::nack(const uint8_t *data, size_t len) {
+    if(known_) {
+        sendto(fd_, data, len, 0, (const sockaddr*)&to_, sizeof(to_));
+    }
+}
+
+int udp_listen(uint16_t port, bool reuse_port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    int on = 1;
+    if(reuse_port) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    }
+    // Enough kernel buffering to ride out a scheduling hiccup at full rate
+    int rcvbuf = 8 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(bind(fd, (sockaddr*)&addr, sizeof(addr))) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
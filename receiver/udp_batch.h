@@ -0,0 +1,62 @@
+#ifndef _UDP_BATCH_H_
+#define _UDP_BATCH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "frame_sink.h"
+
+/**
+ * Receives datagrams in batches with recvmmsg(), one system call for up to "batch" datagrams
+ */
+class udp_batch {
+public:
+    // Largest datagram kept, longer ones are truncated
+    static const size_t MAX_DATAGRAM = 2048;
+
+    explicit udp_batch(unsigned batch = 64);
+
+    /**
+     * Waits for at least one datagram and takes whatever else is already queued
+     * @param timeout_ms Gives up after this long, 0 waits forever
+     * @returns Number of datagrams received, 0 on timeout, -1 on error
+     */
+    int receive(int fd, int timeout_ms);
+
+    const uint8_t *data(unsigned i) const { return &buffers_[i * MAX_DATAGRAM]; }
+    size_t length(unsigned i) const { return headers_[i].msg_len; }
+    const sockaddr_in &source(unsigned i) const { return sources_[i]; }
+
+private:
+    std::vector<uint8_t> buffers_;
+    std::vector<iovec> iovecs_;
+    std::vector<mmsghdr> headers_;
+    std::vector<sockaddr_in> sources_;
+};
+
+/**
+ * Sends NACKs from the receiving socket to the address the stream last came from
+ */
+class udp_nack_sink : public nack_sink {
+public:
+    explicit udp_nack_sink(int fd) : fd_(fd) {}
+    void set_destination(const sockaddr_in &to) { to_ = to; known_ = true; }
+    void nack(const uint8_t *data, size_t len) override;
+
+private:
+    int fd_;
+    sockaddr_in to_;
+    bool known_ = false;
+};
+
+/**
+ * Opens a UDP socket bound to "port" on all addresses
+ * @param reuse_port Lets several sockets bind the same port (SO_REUSEPORT)
+ * @returns The socket, -1 on error
+ */
+int udp_listen(uint16_t port, bool reuse_port = false);
+
+#endif // _UDP_BATCH_H_
@@ -0,0 +1,515 @@
+#include <errno.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "hal.h"
+#include "frame_check.h"
+#include "latency_hist.h"
+#include "sim_camera.h"
+#include "hal_sim.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * Linux implementation of hal.h
+ * SPI goes to the simulated ArduCAM in sim_camera.c, background reads run on a thread
+ * that stands in for the DMA channels, the second core is a thread and UDP is a socket.
+ */
+
+static int sock = -1;
+static int trace_sock = -1;
+// Loss injection, drop threshold out of 2^32
+static uint32_t loss_threshold = 0;
+static uint32_t loss_state = 1;
+static uint64_t bytes_copied = 0;
+// Link rate model, set from the main thread
+static volatile uint32_t link_rate = 0;
+static volatile uint32_t link_queue_limit = 0;
+static hal_udp_recv_fn recv_callback;
+
+// Doorbells between the cores, a rung bell stays set until the core waits on it
+static pthread_mutex_t core_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t core_cond;
+static bool core_bell[2];
+static pthread_once_t core_once = PTHREAD_ONCE_INIT;
+static volatile uint64_t idle_us[2];
+static pthread_t core1;
+
+// Background read, the "DMA" thread picks it up and calls read_done when it is finished
+static pthread_mutex_t dma_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dma_cond = PTHREAD_COND_INITIALIZER;
+static uint8_t *dma_dst = NULL;
+static size_t dma_len = 0;
+static hal_read_done_fn read_done;
+// Stands in for the DMA sniffer, only touched by the "DMA" thread between hal_spi_crc_start() and the read done
+static uint32_t dma_crc = 0;
+
+void hal_init(uint32_t spi_hz) {
+    sim_camera_set_clock(spi_hz);
+}
+
+void hal_cs_put(bool level) {
+    sim_camera_cs(level);
+}
+
+void hal_spi_write_read(const uint8_t *tx, uint8_t *rx, size_t len) {
+    sim_camera_transfer(tx, rx, len);
+}
+
+void hal_spi_read(uint8_t repeated_tx, uint8_t *dst, size_t len) {
+    (void)repeated_tx;
+    sim_camera_read(dst, len);
+}
+
+// The condition variable waits on the monotonic clock hal_time_us() uses
+static void core_init() {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&core_cond, &attr);
+}
+
+static void ring(uint8_t core) {
+    pthread_once(&core_once, core_init);
+    pthread_mutex_lock(&core_lock);
+    core_bell[core] = true;
+    pthread_cond_broadcast(&core_cond);
+    pthread_mutex_unlock(&core_lock);
+}
+
+static void *dma_thread(void *arg) {
+    (void)arg;
+    while(true) {
+        pthread_mutex_lock(&dma_lock);
+        while(!dma_dst) {
+            pthread_cond_wait(&dma_cond, &dma_lock);
+        }
+        uint8_t *dst = dma_dst;
+        size_t len = dma_len;
+        dma_dst = NULL;
+        pthread_mutex_unlock(&dma_lock);
+
+        sim_camera_read(dst, len);
+        dma_crc = frame_crc32(dma_crc, dst, len);
+        // Stands in for the DMA interrupt, may start the next read, and wakes core 1 like it
+        read_done();
+        ring(1);
+    }
+    return NULL;
+}
+
+void hal_spi_async_init(hal_read_done_fn done) {
+    read_done = done;
+    pthread_t thread;
+    pthread_create(&thread, NULL, dma_thread, NULL);
+    pthread_detach(thread);
+}
+
+void hal_spi_read_async(uint8_t *dst, size_t len) {
+    pthread_mutex_lock(&dma_lock);
+    dma_dst = dst;
+    dma_len = len;
+    pthread_cond_signal(&dma_cond);
+    pthread_mutex_unlock(&dma_lock);
+}
+
+void hal_spi_crc_start() {
+    dma_crc = 0;
+}
+
+uint32_t hal_spi_crc() {
+    return dma_crc;
+}
+
+uint64_t hal_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void hal_sleep_us(uint64_t us) {
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+void hal_sleep_ms(uint32_t ms) {
+    hal_sleep_us((uint64_t)ms * 1000);
+}
+
+// Threads standing in for core 1 set this
+static __thread uint8_t core_num = 0;
+
+uint8_t hal_core_num() {
+    return core_num;
+}
+
+static void *core1_thread(void *arg) {
+    core_num = 1;
+    ((void (*)(void))arg)();
+    return NULL;
+}
+
+void hal_launch_core1(void (*entry)(void)) {
+    pthread_create(&core1, NULL, core1_thread, (void*)entry);
+    pthread_detach(core1);
+}
+
+void hal_core_notify() {
+    ring(core_num ^ 1);
+}
+
+void hal_core_wait(uint64_t until_us) {
+    pthread_once(&core_once, core_init);
+    uint64_t start = hal_time_us();
+    struct timespec until = { until_us / 1000000, (until_us % 1000000) * 1000 };
+    pthread_mutex_lock(&core_lock);
+    while(!core_bell[core_num] && pthread_cond_timedwait(&core_cond, &core_lock, &until) == 0) {
+    }
+    core_bell[core_num] = false;
+    pthread_mutex_unlock(&core_lock);
+    idle_us[core_num] += hal_time_us() - start;
+}
+
+uint64_t hal_core_idle_us(uint8_t core) {
+    return idle_us[core];
+}
+
+// CPU time the thread used, in microseconds
+static uint64_t thread_cpu_us(pthread_t thread) {
+    clockid_t clock;
+    struct timespec ts;
+    if(pthread_getcpuclockid(thread, &clock) || clock_gettime(clock, &ts)) {
+        return 0;
+    }
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void hal_sim_core_report(pthread_t core0, uint64_t elapsed_us) {
+    pthread_t threads[2] = { core0, core1 };
+    for(int core = 0; core < 2; core++) {
+        printf("Core %d: busy %.1f%% of the CPU, asleep in waits %.1f%% of the time\n", core,
+            100.0 * thread_cpu_us(threads[core]) / elapsed_us, 100.0 * idle_us[core] / elapsed_us);
+    }
+}
+
+void hal_watchdog_update() {
+}
+
+uint32_t hal_random32() {
+    uint32_t r = 0;
+    if(getrandom(&r, sizeof(r), 0) != sizeof(r)) {
+        r = (uint32_t)hal_time_us() ^ (uint32_t)getpid();
+    }
+    return r;
+}
+
+static int udp_open(const char *ip, uint16_t port) {
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    if(s < 0) {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if(inet_pton(AF_INET, ip, &addr.sin_addr) != 1 || connect(s, (struct sockaddr*)&addr, sizeof(addr))) {
+        perror("connect");
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+bool hal_udp_connect(const char *ip, uint16_t port) {
+    sock = udp_open(ip, port);
+    return sock >= 0;
+}
+
+void hal_sim_set_loss(double percent, uint32_t seed) {
+    loss_threshold = percent <= 0 ? 0 : percent >= 100 ? UINT32_MAX : (uint32_t)(percent / 100 * 4294967296.0);
+    loss_state = seed ? seed : 1;
+}
+
+// Time the driver buffers on the radio, sends past it wait
+#define SIM_LINK_QUEUE_US 20000
+// Datagrams the link can hold, whatever their size
+#define SIM_LINK_SLOTS 256
+
+// Datagrams waiting for the link, sent from link_thread at the link rate
+struct link_datagram {
+    uint64_t queued_us;
+    uint16_t len;
+    uint8_t data[2048];
+};
+static struct link_datagram link_queue[SIM_LINK_SLOTS];
+static uint32_t link_head = 0;
+static uint32_t link_tail = 0;
+static uint32_t link_bytes = 0;
+static pthread_mutex_t link_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t link_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t link_room = PTHREAD_COND_INITIALIZER;
+static bool link_started = false;
+// Totals, under link_lock
+static uint64_t link_datagrams = 0;
+static uint64_t link_dropped = 0;
+static uint32_t link_peak = 0;
+// Time from hal_udp_send() to the datagram leaving the link, written by link_thread only
+static struct latency_hist link_delay;
+
+static void *link_thread(void *arg) {
+    (void)arg;
+    uint64_t free_us = 0;
+    while(true) {
+        pthread_mutex_lock(&link_lock);
+        while(link_head == link_tail) {
+            pthread_cond_wait(&link_ready, &link_lock);
+        }
+        struct link_datagram *d = &link_queue[link_tail % SIM_LINK_SLOTS];
+        pthread_mutex_unlock(&link_lock);
+
+        // The link sends one datagram at a time, each takes its length over the rate
+        uint32_t rate = link_rate;
+        if(free_us < d->queued_us) {
+            free_us = d->queued_us;
+        }
+        if(rate) {
+            free_us += (uint64_t)d->len * 1000000 / rate;
+            uint64_t now = hal_time_us();
+            if(free_us > now) {
+                hal_sleep_us(free_us - now);
+            }
+        }
+        // Nobody listening on loopback is fine here as well
+        send(sock, d->data, d->len, 0);
+        latency_record(&link_delay, hal_time_us() - d->queued_us);
+
+        pthread_mutex_lock(&link_lock);
+        link_bytes -= d->len;
+        link_tail++;
+        pthread_cond_signal(&link_room);
+        pthread_mutex_unlock(&link_lock);
+    }
+    return NULL;
+}
+
+void hal_sim_set_link(uint32_t bytes_per_s) {
+    link_rate = bytes_per_s;
+    if(bytes_per_s && !link_started) {
+        link_started = true;
+        pthread_t thread;
+        pthread_create(&thread, NULL, link_thread, NULL);
+        pthread_detach(thread);
+    }
+}
+
+void hal_sim_set_link_queue(uint32_t bytes) {
+    link_queue_limit = bytes;
+}
+
+/**
+ * Queues a datagram on the rate limited link
+ * With a queue limit a datagram that doesn't fit is dropped, otherwise the sender waits.
+ */
+static void link_send(const struct msghdr *msg, uint32_t len) {
+    pthread_mutex_lock(&link_lock);
+    link_datagrams++;
+    uint32_t limit = link_queue_limit;
+    if(limit && (link_bytes + len > limit || link_head - link_tail == SIM_LINK_SLOTS)) {
+        link_dropped++;
+        pthread_mutex_unlock(&link_lock);
+        return;
+    }
+    uint32_t wait_bytes = (uint64_t)link_rate * SIM_LINK_QUEUE_US / 1000000;
+    while(link_head - link_tail == SIM_LINK_SLOTS || (!limit && link_bytes > wait_bytes)) {
+        pthread_cond_wait(&link_room, &link_lock);
+    }
+    pthread_mutex_unlock(&link_lock);
+
+    // Only core 0 adds datagrams, the slot can be filled outside the lock
+    struct link_datagram *d = &link_queue[link_head % SIM_LINK_SLOTS];
+    d->len = 0;
+    for(size_t i = 0; i < msg->msg_iovlen; i++) {
+        memcpy(&d->data[d->len], msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
+        d->len += msg->msg_iov[i].iov_len;
+    }
+    d->queued_us = hal_time_us();
+
+    pthread_mutex_lock(&link_lock);
+    link_bytes += len;
+    link_head++;
+    if(link_head - link_tail > link_peak) {
+        link_peak = link_head - link_tail;
+    }
+    pthread_cond_signal(&link_ready);
+    pthread_mutex_unlock(&link_lock);
+}
+
+void hal_sim_link_report() {
+    if(!link_started) {
+        return;
+    }
+    pthread_mutex_lock(&link_lock);
+    uint64_t datagrams = link_datagrams;
+    uint64_t dropped = link_dropped;
+    pthread_mutex_unlock(&link_lock);
+    printf("Link: %llu datagrams, dropped %llu (%.2f%%), queueing delay p50 %u us p99 %u us max %u us\n",
+        (unsigned long long)datagrams, (unsigned long long)dropped, datagrams ? 100.0 * dropped / datagrams : 0.0,
+        latency_percentile(&link_delay, 50), latency_percentile(&link_delay, 99), link_delay.max);
+}
+
+// xorshift32, only called from core 0, for both directions
+static bool drop_datagram() {
+    if(!loss_threshold) {
+        return false;
+    }
+    loss_state ^= loss_state << 13;
+    loss_state ^= loss_state >> 17;
+    loss_state ^= loss_state << 5;
+    return loss_state < loss_threshold;
+}
+
+int hal_udp_send(const uint8_t *header, uint16_t header_len, const uint8_t *payload, uint16_t len, struct hal_udp_pin *pin) {
+    // The kernel copies synchronously, nothing stays pinned. Copies are counted like the Pico does them.
+    struct iovec iov[2] = {
+        { (void*)header, header_len },
+        { (void*)payload, len }
+    };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    bytes_copied += pin ? header_len : header_len + len;
+    if(drop_datagram()) {
+        // Lost on the way, as far as the sender can tell it went out fine
+        return 0;
+    }
+    if(link_started) {
+        link_send(&msg, header_len + len);
+        return 0;
+    }
+    // Nobody listening on loopback is not an error for the stream
+    if(sendmsg(sock, &msg, 0) < 0 && errno != ECONNREFUSED) {
+        return -1;
+    }
+    return 0;
+}
+
+uint64_t hal_udp_bytes_copied() {
+    return bytes_copied;
+}
+
+uint32_t hal_pool_stats(struct hal_pool_stats *stats, uint32_t max) {
+    // The kernel owns the socket buffers, the only fixed pool is the simulated link's queue
+    if(!link_started || max == 0) {
+        return 0;
+    }
+    pthread_mutex_lock(&link_lock);
+    stats[0] = (struct hal_pool_stats) {
+        .name = "link",
+        .block_size = sizeof(link_queue[0].data),
+        .count = SIM_LINK_SLOTS,
+        .in_use = link_head - link_tail,
+        .peak = link_peak,
+        .failures = link_dropped,
+    };
+    pthread_mutex_unlock(&link_lock);
+    return 1;
+}
+
+void hal_mem_usage(struct hal_mem_usage *usage) {
+    // Linker symbols for the start of the data segment and the end of bss
+    extern char __data_start, end;
+    struct mallinfo2 info = mallinfo2();
+    usage->static_bytes = &end - &__data_start;
+    usage->heap_peak = info.arena + info.hblkhd;
+    usage->heap_in_use = info.uordblks + info.hblkhd;
+    usage->ram_bytes = 0;
+}
+
+uint32_t hal_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return (uint32_t)__rdtsc() & HAL_CYCLES_MASK;
+#else
+    // Nanoseconds, cycles of a 1 GHz clock
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ull + ts.tv_nsec) & HAL_CYCLES_MASK;
+#endif
+}
+
+// There is no bus fabric to count on, every count stays zero
+void hal_bus_count_select(uint8_t region_a, uint8_t region_b) {
+    (void)region_a;
+    (void)region_b;
+}
+
+void hal_bus_count_clear() {
+}
+
+void hal_bus_count_add(struct hal_bus_count *counts) {
+    (void)counts;
+}
+
+void hal_cache_count_add(struct hal_cache_count *count) {
+    (void)count;
+}
+
+void hal_cache_flush() {
+}
+
+void hal_udp_unpin(struct hal_udp_pin *pin) {
+    (void)pin;
+}
+
+bool hal_trace_connect(const char *ip, uint16_t port) {
+    trace_sock = udp_open(ip, port);
+    return trace_sock >= 0;
+}
+
+void hal_trace_send(const uint8_t *data, uint16_t len) {
+    send(trace_sock, data, len, 0);
+}
+
+void hal_udp_set_recv(hal_udp_recv_fn recv) {
+    recv_callback = recv;
+}
+
+// Datagrams from the server go through the same lossy link as the stream
+static void receive_pending() {
+    uint8_t data[64];
+    ssize_t len;
+    while(recv_callback && (len = recv(sock, data, sizeof(data), MSG_DONTWAIT)) >= 0) {
+        if(!drop_datagram()) {
+            recv_callback(data, len);
+        }
+    }
+}
+
+void hal_net_poll() {
+    receive_pending();
+    sched_yield();
+}
+
+void hal_net_wait_until(uint64_t time_us) {
+    // Wakes up every millisecond for datagrams from the server, like the driver's interrupt would
+    uint64_t start = hal_time_us();
+    while(true) {
+        receive_pending();
+        uint64_t now = hal_time_us();
+        if(now >= time_us) {
+            break;
+        }
+        hal_sleep_us(time_us - now < 1000 ? time_us - now : 1000);
+    }
+    idle_us[core_num] += hal_time_us() - start;
+}
@@ -0,0 +1,45 @@
+#ifndef _HAL_SIM_H_
+#define _HAL_SIM_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * Simulator only additions to hal.h
+ */
+
+/**
+ * Drops datagrams in hal_udp_send() at random, as a lossy link would
+ * @param percent Share of datagrams dropped, 0 for none
+ * @param seed Seed of the random sequence, the same seed drops the same datagrams
+ */
+void hal_sim_set_loss(double percent, uint32_t seed);
+
+/**
+ * Limits hal_udp_send() to a link of the given rate. Datagrams queue up on the link and a
+ * thread sends them on at its rate. A send that finds more than SIM_LINK_QUEUE_US of them
+ * queued waits, as the radio would.
+ * @param bytes_per_s Link rate, 0 for unlimited. Can be changed while the stream runs.
+ */
+void hal_sim_set_link(uint32_t bytes_per_s);
+
+/**
+ * Gives the rate limited link a queue like a congested access point has: datagrams that
+ * don't fit are dropped instead of making the sender wait
+ * @param bytes Queue size, 0 = the sender waits (default)
+ */
+void hal_sim_set_link_queue(uint32_t bytes);
+
+/**
+ * Prints what the rate limited link sent and dropped, and how long datagrams queued on it
+ */
+void hal_sim_link_report();
+
+/**
+ * Prints how much CPU time the threads standing in for the two cores used and how long they
+ * slept in the HAL's wait functions
+ * @param core0 Thread running core 0's loop
+ */
+void hal_sim_core_report(pthread_t core0, uint64_t elapsed_us);
+
+#endif // _HAL_SIM_H_
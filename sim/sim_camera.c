@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sim_camera.h"
+
+struct sim_frame {
+    uint8_t *data;
+    uint32_t len;
+};
+
+static struct sim_frame *frames;
+static int frame_count;
+static int next_frame = 0;
+static uint32_t captures = 0;
+
+static uint32_t spi_hz = 8 * 1000 * 1000;
+static uint32_t exposure_us;
+
+// Registers and FIFO
+static bool capture_running = false;
+static bool capture_done = false;
+static uint64_t capture_done_time = 0;
+static const struct sim_frame *fifo = NULL;
+static uint32_t fifo_pos = 0;
+
+// Resolution (0x21) and quality (0x2A) registers, as camera_start() leaves them: VGA, default quality
+static uint8_t resolution = 2;
+static uint8_t quality = 1;
+// Frame scaled to the current mode, the FIFO points here when it isn't the default one
+static struct sim_frame scaled = { NULL, 0 };
+
+// Injected corruption, see sim_camera_set_corruption()
+static uint32_t corrupt_threshold = 0;
+static uint32_t corrupt_random = 1;
+static uint32_t corrupted = 0;
+// Corrupted copy of the frame, the FIFO points here when the capture was hit
+static struct sim_frame damaged = { NULL, 0 };
+
+// Current SPI transaction, byte 0 after CS went low is the register address
+static uint32_t byte_index = 0;
+static uint8_t address = 0;
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Makes a transfer take as long as it would on the wire
+static void spi_delay(size_t len) {
+    uint64_t ns = (uint64_t)len * 8 * 1000000000ull / spi_hz;
+    struct timespec ts = { ns / 1000000000ull, ns % 1000000000ull };
+    nanosleep(&ts, NULL);
+}
+
+static bool load_file(const char *path, struct sim_frame *frame) {
+    FILE *f = fopen(path, "rb");
+    if(!f) {
+        printf("Can't open %s\n", path);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    frame->data = malloc(size);
+    frame->len = size;
+    bool ok = fread(frame->data, 1, size, f) == (size_t)size;
+    fclose(f);
+    return ok;
+}
+
+// SOI, APP0 marker and pseudo random entropy coded data ending in EOI
+static void make_synthetic(struct sim_frame *frame, uint32_t size, uint32_t seed) {
+    frame->data = malloc(size);
+    frame->len = size;
+    uint32_t x = seed * 2654435761u + 1;
+    for(uint32_t i = 0; i < size; i++) {
+        x = x * 1103515245u + 12345u;
+        frame->data[i] = x >> 16;
+        // 0xFF would start a marker inside the entropy coded data
+        if(frame->data[i] == 0xFF) {
+            frame->data[i] = 0xFE;
+        }
+    }
+    frame->data[0] = 0xFF;
+    frame->data[1] = 0xD8;
+    frame->data[2] = 0xFF;
+    frame->data[3] = 0xE0;
+    frame->data[size - 2] = 0xFF;
+    frame->data[size - 1] = 0xD9;
+}
+
+void sim_camera_init_synthetic(const uint32_t *sizes, int count, uint32_t exposure) {
+    exposure_us = exposure;
+    frame_count = count;
+    frames = calloc(frame_count, sizeof(struct sim_frame));
+    for(int i = 0; i < frame_count; i++) {
+        make_synthetic(&frames[i], sizes[i], i);
+    }
+}
+
+bool sim_camera_init(char **files, int count, uint32_t synthetic_size, uint32_t exposure) {
+    exposure_us = exposure;
+    if(count == 0) {
+        // A few different frames so consecutive frames don't look the same
+        uint32_t sizes[4];
+        for(int i = 0; i < 4; i++) {
+            sizes[i] = synthetic_size - (synthetic_size / 16) * i;
+        }
+        sim_camera_init_synthetic(sizes, 4, exposure);
+        return true;
+    }
+    frame_count = count;
+    frames = calloc(frame_count, sizeof(struct sim_frame));
+    for(int i = 0; i < count; i++) {
+        if(!load_file(files[i], &frames[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void sim_camera_set_clock(uint32_t hz) {
+    spi_hz = hz;
+}
+
+uint32_t sim_camera_captures() {
+    return captures;
+}
+
+void sim_camera_set_corruption(double percent) {
+    // Compared against 16 random bits per capture
+    corrupt_threshold = percent <= 0 ? 0 : percent >= 100 ? 65536 : (uint32_t)(percent * 655.36);
+}
+
+uint32_t sim_camera_corrupted() {
+    return corrupted;
+}
+
+/**
+ * Frame size in the current mode relative to VGA at default quality, in 1/256
+ * Rough ratios of what the sensor produces: QVGA is about a third of VGA, high and
+ * low quality about 35% bigger and 30% smaller than default.
+ */
+static uint32_t mode_scale() {
+    uint32_t scale = resolution == 1 ? 90 : 256;
+    if(quality == 0) {
+        scale = scale * 345 / 256;
+    } else if(quality == 2) {
+        scale = scale * 179 / 256;
+    }
+    return scale;
+}
+
+// The replayed frame cut or stretched to the current mode's size, still SOI ... EOI
+static const struct sim_frame *scale_frame(const struct sim_frame *frame) {
+    uint32_t scale = mode_scale();
+    if(scale == 256) {
+        return frame;
+    }
+    uint32_t len = (uint64_t)frame->len * scale / 256;
+    if(len < 4) {
+        len = 4;
+    }
+    if(len > scaled.len) {
+        scaled.data = realloc(scaled.data, len);
+    }
+    scaled.len = len;
+    for(uint32_t done = 0; done < len; ) {
+        uint32_t n = len - done < frame->len ? len - done : frame->len;
+        memcpy(&scaled.data[done], frame->data, n);
+        done += n;
+    }
+    scaled.data[len - 2] = 0xFF;
+    scaled.data[len - 1] = 0xD9;
+    return &scaled;
+}
+
+// Copy of "frame" with a glitch in it, or "frame" itself if this capture isn't hit
+static const struct sim_frame *corrupt_frame(const struct sim_frame *frame) {
+    corrupt_random = corrupt_random * 1103515245u + 12345u;
+    if((corrupt_random >> 16) >= corrupt_threshold || frame->len < 4) {
+        return frame;
+    }
+    if(frame->len > damaged.len) {
+        damaged.data = realloc(damaged.data, frame->len);
+    }
+    damaged.len = frame->len;
+    if(corrupted++ % 2 == 0) {
+        // The FIFO ran dry three quarters in
+        uint32_t cut = frame->len * 3 / 4;
+        memcpy(damaged.data, frame->data, cut);
+        memset(&damaged.data[cut], 0, frame->len - cut);
+    } else {
+        // A byte was lost at the start, everything after it is one early
+        memcpy(damaged.data, &frame->data[1], frame->len - 1);
+        damaged.data[frame->len - 1] = 0;
+    }
+    return &damaged;
+}
+
+// Moves a finished capture into the FIFO
+static void update_capture() {
+    if(capture_running && now_us() >= capture_done_time) {
+        capture_running = false;
+        capture_done = true;
+        fifo = corrupt_frame(scale_frame(&frames[next_frame]));
+        fifo_pos = 0;
+        next_frame = (next_frame + 1) % frame_count;
+        captures++;
+    }
+}
+
+static void write_reg(uint8_t reg, uint8_t value) {
+    switch(reg) {
+        case 0x04:
+            if(value & 0x01) {
+                // Clear FIFO done flag
+                capture_done = false;
+            }
+            if(value & 0x02) {
+                capture_running = true;
+                capture_done = false;
+                capture_done_time = now_us() + exposure_us;
+            }
+            break;
+        case 0x07:
+            capture_running = false;
+            capture_done = false;
+            fifo = NULL;
+            quality = 1;
+            break;
+        case 0x21:
+            resolution = value & 0x0F;
+            break;
+        case 0x2A:
+            quality = value;
+            break;
+        default:
+            // Format and debug registers don't change the replayed frames
+            break;
+    }
+}
+
+static uint8_t read_reg(uint8_t reg) {
+    update_capture();
+    uint32_t len = fifo ? fifo->len : 0;
+    switch(reg) {
+        case 0x44:
+            // Bits 0-1 = 2: sensor idle, bit 2: capture done
+            return 0x02 | (capture_done ? 0x04 : 0);
+        case 0x45:
+            return len;
+        case 0x46:
+            return len >> 8;
+        case 0x47:
+            return len >> 16;
+        default:
+            return 0;
+    }
+}
+
+static uint8_t fifo_byte() {
+    if(!fifo || fifo_pos >= fifo->len) {
+        return 0;
+    }
+    return fifo->data[fifo_pos++];
+}
+
+void sim_camera_cs(bool level) {
+    if(!level) {
+        byte_index = 0;
+    }
+}
+
+void sim_camera_transfer(const uint8_t *tx, uint8_t *rx, size_t len) {
+    for(size_t i = 0; i < len; i++) {
+        uint8_t out = 0;
+        if(byte_index == 0) {
+            address = tx[i];
+        } else if(address & 0x80) {
+            if(byte_index == 1) {
+                write_reg(address & 0x7F, tx[i]);
+            }
+        } else if(byte_index >= 2) {
+            // Reads answer with a dummy byte first
+            out = (address == 0x3C) ? fifo_byte() : read_reg(address);
+        }
+        rx[i] = out;
+        byte_index++;
+    }
+}
+
+void sim_camera_read(uint8_t *dst, size_t len) {
+    if(address == 0x3C && byte_index >= 2 && fifo) {
+        // Burst read straight out of the FIFO
+        uint32_t available = fifo_pos < fifo->len ? fifo->len - fifo_pos : 0;
+        uint32_t n = len < available ? len : available;
+        memcpy(dst, &fifo->data[fifo_pos], n);
+        memset(dst + n, 0, len - n);
+        fifo_pos += n;
+        byte_index += len;
+        spi_delay(len);
+        return;
+    }
+    uint8_t zero = 0;
+    for(size_t i = 0; i < len; i++) {
+        sim_camera_transfer(&zero, &dst[i], 1);
+    }
+    spi_delay(len);
+}
@@ -0,0 +1,69 @@
+#ifndef _SIM_CAMERA_H_
+#define _SIM_CAMERA_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Simulated ArduCAM Mega on the other end of the SPI bus.
+ * Implements the registers used by src/arducam.c (0x04 FIFO control, 0x07 reset,
+ * 0x44 status, 0x45-0x47 FIFO length, 0x3C burst read) and replays JPEG files
+ * from disk as the captured frames. The replayed frames are taken to be VGA at default
+ * quality, other resolutions (0x21) and qualities (0x2A) scale their size. SPI transfers take as long as they would at the
+ * configured SPI clock.
+ */
+
+/**
+ * Loads the frames that are replayed, one per capture, in order and then from the start again
+ * @param files JPEG files, if count is 0 synthetic JPEGs of "synthetic_size" bytes are used
+ * @param exposure_us Time from capture trigger until the capture done flag is set
+ * @returns false if a file could not be read
+ */
+bool sim_camera_init(char **files, int count, uint32_t synthetic_size, uint32_t exposure_us);
+
+/**
+ * Replays synthetic JPEGs, one per entry of "sizes"
+ * Each frame is SOI, APP0 and pseudo random data ending in EOI, the same for the same size and position.
+ * @param exposure_us Time from capture trigger until the capture done flag is set
+ */
+void sim_camera_init_synthetic(const uint32_t *sizes, int count, uint32_t exposure_us);
+
+/**
+ * Sets the SPI clock that transfers are paced at
+ */
+void sim_camera_set_clock(uint32_t spi_hz);
+
+/**
+ * Chip select, a transfer starts when it goes low
+ */
+void sim_camera_cs(bool level);
+
+/**
+ * Full duplex transfer of "len" bytes
+ */
+void sim_camera_transfer(const uint8_t *tx, uint8_t *rx, size_t len);
+
+/**
+ * Reads "len" bytes, FIFO data when in burst mode
+ */
+void sim_camera_read(uint8_t *dst, size_t len);
+
+/**
+ * @returns Number of frames captured since start
+ */
+uint32_t sim_camera_captures();
+
+/**
+ * Corrupts "percent" of the captured frames on their way out of the FIFO, like a glitch on the
+ * SPI bus would: every other one is cut short (the rest reads as 0, no EOI), the others lose their
+ * first byte (no SOI). Which frames are hit is the same in every run.
+ */
+void sim_camera_set_corruption(double percent);
+
+/**
+ * @returns Number of frames corrupted since start
+ */
+uint32_t sim_camera_corrupted();
+
+#endif // _SIM_CAMERA_H_
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "hal.h"
+#include "aes.h"
+#include "arducam.h"
+#include "streamer.h"
+#include "stream_header.h"
+#include "rate_control.h"
+#include "trace.h"
+#include "sim_camera.h"
+#include "hal_sim.h"
+
+/**
+ * Host build of the streaming pipeline: the same camera_poll() and streamer_send_loop()
+ * as the firmware, run against the simulated ArduCAM in sim_camera.c and a UDP socket.
+ *
+ * Usage: Arducam_Streamer_sim [options] [frame.jpg ...]
+ *   -s HZ   SPI clock (default 8000000)
+ *   -e US   exposure time per capture (default 20000)
+ *   -n B    size of the synthetic frames used when no JPEG files are given (default 12000)
+ *   -t S    seconds to run for (default 10)
+ *   -a IP   destination address (default 127.0.0.1)
+ *   -p PORT destination port (default 20001)
+ *   -c NAME replay a fixed corpus instead of files: qvga (320x240) or vga (640x480)
+ *   -k      receive the stream on a loopback sink and report what arrived
+ *   -l PCT  drop this percentage of datagrams at random before they are sent
+ *   -f K    send an XOR parity fragment for every K fragments (FEC, default FEC_GROUP)
+ *   -r N    keep the last N sent frames to resend fragments the receiver NACKs (default 0,
+ *           at most RETRANSMIT_FRAMES)
+ *   -R      let the rate controller change camera mode and pacing (off by default so runs compare)
+ *   -b KBPS limit the link to this many KB/s (default unlimited)
+ *   -B S:KBPS change the link rate to KBPS after S seconds, can be given more than once.
+ *           With -R or -B a line per second shows the link, what arrived and the camera mode.
+ *   -q B    drop datagrams that don't fit into a B byte queue in front of the link, like a
+ *           congested access point, instead of making the sender wait
+ *   -P KBPS[:BURST] pace sends at KBPS KB/s with BURST bytes back to back (default unpaced).
+ *           0 spreads each frame over the time between frames.
+ *   -x PCT  corrupt this percentage of the frames read from the camera (see sim_camera_set_corruption())
+ *
+ * Built with PIPELINE_PROFILE (Arducam_Streamer_bench) it prints per stage latencies at the end.
+ */
+
+/**
+ * Fixed frame sizes in the range the ArduCAM Mega produces at default JPEG quality.
+ * The frames are synthetic (see sim_camera_init_synthetic()) so every run sends the same bytes.
+ */
+static const uint32_t corpus_qvga[] = { 7412, 7630, 7288, 8104, 7950, 7371, 7702, 8216 };
+static const uint32_t corpus_vga[] = { 21876, 22410, 21530, 23982, 23315, 21904, 22768, 24540 };
+
+// Loopback sink totals
+static volatile uint64_t sink_datagrams = 0;
+static volatile uint64_t sink_bytes = 0;
+// Frames whose last fragment arrived
+static volatile uint64_t sink_frames = 0;
+
+// Link rate changes given with -B
+#define MAX_LINK_STEPS 8
+struct link_step {
+    uint32_t at_s;
+    uint32_t kbps;
+};
+
+static void *sink_thread(void *arg) {
+    int sock = *(int*)arg;
+    uint8_t datagram[2048];
+    while(true) {
+        ssize_t n = recv(sock, datagram, sizeof(datagram), 0);
+        if(n > 0) {
+            sink_datagrams++;
+            sink_bytes += n;
+            struct stream_header h;
+            if(stream_header_read(datagram, n, &h) && (h.flags & STREAM_FLAG_LAST) &&
+                !(h.flags & (STREAM_FLAG_PARITY | STREAM_FLAG_RETRANSMIT))) {
+                sink_frames++;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Binds the sink before anything is sent so no datagram is refused
+static bool start_sink(const char *ip, uint16_t port) {
+    static int sock;
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, ip, &addr.sin_addr);
+    if(sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr))) {
+        perror("sink");
+        return false;
+    }
+    // Room for a few frames so the sink doesn't drop while it is descheduled
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    pthread_t thread;
+    pthread_create(&thread, NULL, sink_thread, &sock);
+    pthread_detach(thread);
+    return true;
+}
+
+// One line per second while the link changes under the stream
+static void run_timeline(uint32_t seconds, uint32_t link_kbps, const struct link_step *steps, int step_count) {
+    static const char *const resolutions[] = { "?", "QVGA", "VGA" };
+    static const char *const qualities[] = { "high", "default", "low" };
+    printf("%4s %9s %9s %6s %-13s %10s\n", "s", "link KB/s", "recv KB/s", "fps", "mode", "pacing ms");
+    uint64_t bytes = sink_bytes;
+    uint64_t frames = sink_frames;
+    for(uint32_t s = 1; s <= seconds; s++) {
+        sleep(1);
+        uint64_t now_bytes = sink_bytes;
+        uint64_t now_frames = sink_frames;
+        uint8_t mode;
+        uint32_t interval_us;
+        streamer_rate_state(&mode, &interval_us);
+        printf("%4u %9u %9.1f %6llu %4s %-8s %10.1f\n", s, link_kbps, (now_bytes - bytes) / 1000.0,
+            (unsigned long long)(now_frames - frames), resolutions[rate_modes[mode].resolution],
+            qualities[rate_modes[mode].quality], interval_us / 1000.0);
+        bytes = now_bytes;
+        frames = now_frames;
+        for(int i = 0; i < step_count; i++) {
+            if(steps[i].at_s == s) {
+                link_kbps = steps[i].kbps;
+                hal_sim_set_link(link_kbps * 1000);
+            }
+        }
+    }
+}
+
+static void *send_thread(void *arg) {
+    (void)arg;
+    streamer_send_loop();
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    uint32_t spi_hz = 8 * 1000 * 1000;
+    uint32_t exposure_us = 20000;
+    uint32_t synthetic_size = 12000;
+    uint32_t seconds = 10;
+    const char *ip = "127.0.0.1";
+    uint16_t port = 20001;
+    const char *corpus = NULL;
+    bool sink = false;
+    double loss = 0;
+    double corruption = 0;
+    int fec = -1;
+    uint8_t retransmit = 0;
+    bool rate = false;
+    uint32_t link_kbps = 0;
+    struct link_step steps[MAX_LINK_STEPS];
+    int step_count = 0;
+    uint32_t link_queue = 0;
+    bool pace = false;
+    uint32_t pace_kbps = 0;
+    uint32_t pace_burst = SEND_PACING_BURST;
+
+    int opt;
+    while((opt = getopt(argc, argv, "s:e:n:t:a:p:c:kl:f:r:Rb:B:q:P:x:")) != -1) {
+        switch(opt) {
+            case 's': spi_hz = strtoul(optarg, NULL, 0); break;
+            case 'e': exposure_us = strtoul(optarg, NULL, 0); break;
+            case 'n': synthetic_size = strtoul(optarg, NULL, 0); break;
+            case 't': seconds = strtoul(optarg, NULL, 0); break;
+            case 'a': ip = optarg; break;
+            case 'p': port = strtoul(optarg, NULL, 0); break;
+            case 'c': corpus = optarg; break;
+            case 'k': sink = true; break;
+            case 'l': loss = strtod(optarg, NULL); break;
+            case 'f': fec = strtoul(optarg, NULL, 0); break;
+            case 'r': retransmit = strtoul(optarg, NULL, 0); break;
+            case 'R': rate = true; break;
+            case 'b': link_kbps = strtoul(optarg, NULL, 0); break;
+            case 'B':
+                if(step_count == MAX_LINK_STEPS ||
+                    sscanf(optarg, "%u:%u", &steps[step_count].at_s, &steps[step_count].kbps) != 2) {
+                    fprintf(stderr, "Bad link step %s, at most %d of S:KBPS\n", optarg, MAX_LINK_STEPS);
+                    return 1;
+                }
+                step_count++;
+                break;
+            case 'q': link_queue = strtoul(optarg, NULL, 0); break;
+            case 'x': corruption = strtod(optarg, NULL); break;
+            case 'P':
+                pace = true;
+                sscanf(optarg, "%u:%u", &pace_kbps, &pace_burst);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s spi_hz] [-e exposure_us] [-n synthetic_size] [-t seconds] [-a ip] [-p port] [-c qvga|vga] [-k] [-l loss_percent] [-f fec_group] [-r window] [-R] [-b link_kbps] [-B s:kbps] [-q link_queue] [-P kbps[:burst]] [-x corrupt_percent] [frame.jpg ...]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if(corpus && strcmp(corpus, "qvga") == 0) {
+        sim_camera_init_synthetic(corpus_qvga, sizeof(corpus_qvga) / sizeof(corpus_qvga[0]), exposure_us);
+    } else if(corpus && strcmp(corpus, "vga") == 0) {
+        sim_camera_init_synthetic(corpus_vga, sizeof(corpus_vga) / sizeof(corpus_vga[0]), exposure_us);
+    } else if(corpus) {
+        fprintf(stderr, "Unknown corpus %s, use qvga or vga\n", corpus);
+        return 1;
+    } else if(!sim_camera_init(&argv[optind], argc - optind, synthetic_size, exposure_us)) {
+        return 1;
+    }
+
+    if(sink && !start_sink(ip, port)) {
+        return 1;
+    }
+
+    hal_init(spi_hz);
+    sim_camera_set_corruption(corruption);
+    camera_start();
+    if(!hal_udp_connect(ip, port)) {
+        return 1;
+    }
+
+    uint8_t key[STREAM_KEY_LEN] = "YOUR_KEY";
+    uint8_t iv[AES_BLOCKLEN] = "YOUR_IV";
+    streamer_init(key, iv);
+    if(fec >= 0) {
+        streamer_set_fec_group(fec);
+    }
+    streamer_set_retransmit(retransmit, RETRANSMIT_DEADLINE_US);
+    streamer_set_rate_control(rate);
+    streamer_set_pacing(pace, pace_kbps * 1000, pace_burst);
+    hal_sim_set_loss(loss, 1);
+    hal_sim_set_link_queue(link_queue);
+    hal_sim_set_link(link_kbps * 1000);
+    trace_init(ip);
+
+    // Core 0's loop runs on its own thread so the main thread can stop the run
+    uint64_t start = hal_time_us();
+    hal_launch_core1(camera_poll);
+    pthread_t core0;
+    pthread_create(&core0, NULL, send_thread, NULL);
+
+    if(rate || step_count) {
+        run_timeline(seconds, link_kbps, steps, step_count);
+    } else {
+        sleep(seconds);
+    }
+    uint64_t elapsed_us = hal_time_us() - start;
+    printf("Captured %u frames in %u s\n", sim_camera_captures(), seconds);
+    if(corruption > 0) {
+        printf("Camera corrupted %u frames\n", sim_camera_corrupted());
+    }
+    streamer_profile_report(elapsed_us);
+    if(sink) {
+        printf("Sink received %llu datagrams, %llu bytes: %.1f KB/s\n", (unsigned long long)sink_datagrams,
+            (unsigned long long)sink_bytes, sink_bytes / (elapsed_us / 1e6) / 1000);
+    }
+    hal_sim_link_report();
+    hal_sim_core_report(core0, elapsed_us);
+    return 0;
+}
@@ -43,6 +43,7 @@ NOTE:   String length must be evenly divisible by 16byte (str_len % 16 == 0)
 /*****************************************************************************/
 #include <string.h> // CBC mode, for memset
 #include "aes.h"
+#include "sram_layout.h"
 
 /*****************************************************************************/
 /* Defines:                                                                  */
@@ -82,7 +83,7 @@ typedef uint8_t state_t[4][4];
 // The lookup-tables are marked const so they can be placed in read-only storage instead of RAM
 // The numbers below can be computed dynamically trading ROM for RAM - 
 // This can be useful in (embedded) bootloader applications, where ROM is often limited.
-static const uint8_t sbox[256] = {
+static const uint8_t sbox[256] SRAM_TABLE(AES_SRAM, "aes_sbox") = {
   //0     1    2      3     4    5     6     7      8    9     A      B    C     D     E     F
   0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
   0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
@@ -101,6 +102,45 @@ static const uint8_t sbox[256] = {
   0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
   0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16 };
 
+#if defined(AES_TTABLE) && (AES_TTABLE == 1)
+// Combined SubBytes/MixColumns lookup table for the 32-bit round function.
+// Each entry holds the column {02}.s, s, s, {03}.s (row 0 in the least significant byte),
+// the other three classic T-tables are byte rotations of this one, which keeps the table at 1KB.
+static const uint32_t Te0[256] SRAM_TABLE(AES_SRAM, "aes_te0") = {
+  0xa56363c6, 0x847c7cf8, 0x997777ee, 0x8d7b7bf6, 0x0df2f2ff, 0xbd6b6bd6, 0xb16f6fde, 0x54c5c591,
+  0x50303060, 0x03010102, 0xa96767ce, 0x7d2b2b56, 0x19fefee7, 0x62d7d7b5, 0xe6abab4d, 0x9a7676ec,
+  0x45caca8f, 0x9d82821f, 0x40c9c989, 0x877d7dfa, 0x15fafaef, 0xeb5959b2, 0xc947478e, 0x0bf0f0fb,
+  0xecadad41, 0x67d4d4b3, 0xfda2a25f, 0xeaafaf45, 0xbf9c9c23, 0xf7a4a453, 0x967272e4, 0x5bc0c09b,
+  0xc2b7b775, 0x1cfdfde1, 0xae93933d, 0x6a26264c, 0x5a36366c, 0x413f3f7e, 0x02f7f7f5, 0x4fcccc83,
+  0x5c343468, 0xf4a5a551, 0x34e5e5d1, 0x08f1f1f9, 0x937171e2, 0x73d8d8ab, 0x53313162, 0x3f15152a,
+  0x0c040408, 0x52c7c795, 0x65232346, 0x5ec3c39d, 0x28181830, 0xa1969637, 0x0f05050a, 0xb59a9a2f,
+  0x0907070e, 0x36121224, 0x9b80801b, 0x3de2e2df, 0x26ebebcd, 0x6927274e, 0xcdb2b27f, 0x9f7575ea,
+  0x1b090912, 0x9e83831d, 0x742c2c58, 0x2e1a1a34, 0x2d1b1b36, 0xb26e6edc, 0xee5a5ab4, 0xfba0a05b,
+  0xf65252a4, 0x4d3b3b76, 0x61d6d6b7, 0xceb3b37d, 0x7b292952, 0x3ee3e3dd, 0x712f2f5e, 0x97848413,
+  0xf55353a6, 0x68d1d1b9, 0x00000000, 0x2cededc1, 0x60202040, 0x1ffcfce3, 0xc8b1b179, 0xed5b5bb6,
+  0xbe6a6ad4, 0x46cbcb8d, 0xd9bebe67, 0x4b393972, 0xde4a4a94, 0xd44c4c98, 0xe85858b0, 0x4acfcf85,
+  0x6bd0d0bb, 0x2aefefc5, 0xe5aaaa4f, 0x16fbfbed, 0xc5434386, 0xd74d4d9a, 0x55333366, 0x94858511,
+  0xcf45458a, 0x10f9f9e9, 0x06020204, 0x817f7ffe, 0xf05050a0, 0x443c3c78, 0xba9f9f25, 0xe3a8a84b,
+  0xf35151a2, 0xfea3a35d, 0xc0404080, 0x8a8f8f05, 0xad92923f, 0xbc9d9d21, 0x48383870, 0x04f5f5f1,
+  0xdfbcbc63, 0xc1b6b677, 0x75dadaaf, 0x63212142, 0x30101020, 0x1affffe5, 0x0ef3f3fd, 0x6dd2d2bf,
+  0x4ccdcd81, 0x140c0c18, 0x35131326, 0x2fececc3, 0xe15f5fbe, 0xa2979735, 0xcc444488, 0x3917172e,
+  0x57c4c493, 0xf2a7a755, 0x827e7efc, 0x473d3d7a, 0xac6464c8, 0xe75d5dba, 0x2b191932, 0x957373e6,
+  0xa06060c0, 0x98818119, 0xd14f4f9e, 0x7fdcdca3, 0x66222244, 0x7e2a2a54, 0xab90903b, 0x8388880b,
+  0xca46468c, 0x29eeeec7, 0xd3b8b86b, 0x3c141428, 0x79dedea7, 0xe25e5ebc, 0x1d0b0b16, 0x76dbdbad,
+  0x3be0e0db, 0x56323264, 0x4e3a3a74, 0x1e0a0a14, 0xdb494992, 0x0a06060c, 0x6c242448, 0xe45c5cb8,
+  0x5dc2c29f, 0x6ed3d3bd, 0xefacac43, 0xa66262c4, 0xa8919139, 0xa4959531, 0x37e4e4d3, 0x8b7979f2,
+  0x32e7e7d5, 0x43c8c88b, 0x5937376e, 0xb76d6dda, 0x8c8d8d01, 0x64d5d5b1, 0xd24e4e9c, 0xe0a9a949,
+  0xb46c6cd8, 0xfa5656ac, 0x07f4f4f3, 0x25eaeacf, 0xaf6565ca, 0x8e7a7af4, 0xe9aeae47, 0x18080810,
+  0xd5baba6f, 0x887878f0, 0x6f25254a, 0x722e2e5c, 0x241c1c38, 0xf1a6a657, 0xc7b4b473, 0x51c6c697,
+  0x23e8e8cb, 0x7cdddda1, 0x9c7474e8, 0x211f1f3e, 0xdd4b4b96, 0xdcbdbd61, 0x868b8b0d, 0x858a8a0f,
+  0x907070e0, 0x423e3e7c, 0xc4b5b571, 0xaa6666cc, 0xd8484890, 0x05030306, 0x01f6f6f7, 0x120e0e1c,
+  0xa36161c2, 0x5f35356a, 0xf95757ae, 0xd0b9b969, 0x91868617, 0x58c1c199, 0x271d1d3a, 0xb99e9e27,
+  0x38e1e1d9, 0x13f8f8eb, 0xb398982b, 0x33111122, 0xbb6969d2, 0x70d9d9a9, 0x898e8e07, 0xa7949433,
+  0xb69b9b2d, 0x221e1e3c, 0x92878715, 0x20e9e9c9, 0x49cece87, 0xff5555aa, 0x78282850, 0x7adfdfa5,
+  0x8f8c8c03, 0xf8a1a159, 0x80898909, 0x170d0d1a, 0xdabfbf65, 0x31e6e6d7, 0xc6424284, 0xb86868d0,
+  0xc3414182, 0xb0999929, 0x772d2d5a, 0x110f0f1e, 0xcbb0b07b, 0xfc5454a8, 0xd6bbbb6d, 0x3a16162c };
+#endif
+
 #if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
 static const uint8_t rsbox[256] = {
   0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
@@ -232,7 +272,7 @@ void AES_init_ctx_iv(struct AES_ctx* ctx, const uint8_t* key, const uint8_t* iv)
   KeyExpansion(ctx->RoundKey, key);
   memcpy (ctx->Iv, iv, AES_BLOCKLEN);
 }
-void AES_ctx_set_iv(struct AES_ctx* ctx, const uint8_t* iv)
+void SRAM_FUNC(CIPHER_CODE_SRAM, AES_ctx_set_iv)(struct AES_ctx* ctx, const uint8_t* iv)
 {
   memcpy (ctx->Iv, iv, AES_BLOCKLEN);
 }
@@ -240,7 +280,7 @@ void AES_ctx_set_iv(struct AES_ctx* ctx, const uint8_t* iv)
 
 // This function adds the round key to state.
 // The round key is added to the state by an XOR function.
-static void AddRoundKey(uint8_t round, state_t* state, const uint8_t* RoundKey)
+static void SRAM_FUNC(CIPHER_CODE_SRAM, AddRoundKey)(uint8_t round, state_t* state, const uint8_t* RoundKey)
 {
   uint8_t i,j;
   for (i = 0; i < 4; ++i)
@@ -252,9 +292,10 @@ static void AddRoundKey(uint8_t round, state_t* state, const uint8_t* RoundKey)
   }
 }
 
+#if !defined(AES_TTABLE) || (AES_TTABLE == 0)
 // The SubBytes Function Substitutes the values in the
 // state matrix with values in an S-box.
-static void SubBytes(state_t* state)
+static void SRAM_FUNC(CIPHER_CODE_SRAM, SubBytes)(state_t* state)
 {
   uint8_t i, j;
   for (i = 0; i < 4; ++i)
@@ -269,7 +310,7 @@ static void SubBytes(state_t* state)
 // The ShiftRows() function shifts the rows in the state to the left.
 // Each row is shifted with different offset.
 // Offset = Row number. So the first row is not shifted.
-static void ShiftRows(state_t* state)
+static void SRAM_FUNC(CIPHER_CODE_SRAM, ShiftRows)(state_t* state)
 {
   uint8_t temp;
 
@@ -297,13 +338,16 @@ static void ShiftRows(state_t* state)
   (*state)[1][3] = temp;
 }
 
-static uint8_t xtime(uint8_t x)
+#endif // #if !defined(AES_TTABLE) || (AES_TTABLE == 0)
+
+static uint8_t SRAM_FUNC(CIPHER_CODE_SRAM, xtime)(uint8_t x)
 {
   return ((x<<1) ^ (((x>>7) & 1) * 0x1b));
 }
 
+#if !defined(AES_TTABLE) || (AES_TTABLE == 0)
 // MixColumns function mixes the columns of the state matrix
-static void MixColumns(state_t* state)
+static void SRAM_FUNC(CIPHER_CODE_SRAM, MixColumns)(state_t* state)
 {
   uint8_t i;
   uint8_t Tmp, Tm, t;
@@ -317,6 +361,7 @@ static void MixColumns(state_t* state)
     Tm  = (*state)[i][3] ^ t ;              Tm = xtime(Tm);  (*state)[i][3] ^= Tm ^ Tmp ;
   }
 }
+#endif // #if !defined(AES_TTABLE) || (AES_TTABLE == 0)
 
 // Multiply is used to multiply numbers in the field GF(2^8)
 // Note: The last call to xtime() is unneeded, but often ends up generating a smaller binary
@@ -415,8 +460,73 @@ static void InvShiftRows(state_t* state)
 }
 #endif // #if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
 
+#if defined(AES_TTABLE) && (AES_TTABLE == 1)
+#define ROTL8(x)  (((x) << 8) | ((x) >> 24))
+#define ROTL16(x) (((x) << 16) | ((x) >> 16))
+#define ROTL24(x) (((x) << 24) | ((x) >> 8))
+
+// The state and round keys are plain byte arrays that are not guaranteed to be word aligned
+// (the Cortex-M0+ faults on unaligned word access), so columns are assembled byte by byte.
+// Row 0 of a column ends up in the least significant byte.
+#define LOAD32(p) ((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8) | ((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+#define STORE32(p, v)              \
+  do {                             \
+    (p)[0] = (uint8_t)(v);         \
+    (p)[1] = (uint8_t)((v) >> 8);  \
+    (p)[2] = (uint8_t)((v) >> 16); \
+    (p)[3] = (uint8_t)((v) >> 24); \
+  } while (0)
+
+// One full round on a column: SubBytes, ShiftRows and MixColumns folded into four table lookups.
+// Row r of the output column c comes from input column (c + r) % 4.
+#define TROUND(a, b, c, d) \
+  (Te0[(a) & 0xff] ^ ROTL8(Te0[((b) >> 8) & 0xff]) ^ ROTL16(Te0[((c) >> 16) & 0xff]) ^ ROTL24(Te0[(d) >> 24]))
+
+// Last round has no MixColumns, only SubBytes and ShiftRows.
+#define TFINAL(a, b, c, d)                                                     \
+  ((uint32_t)getSBoxValue((a) & 0xff) | ((uint32_t)getSBoxValue(((b) >> 8) & 0xff) << 8) | \
+   ((uint32_t)getSBoxValue(((c) >> 16) & 0xff) << 16) | ((uint32_t)getSBoxValue((d) >> 24) << 24))
+
+// Cipher is the main function that encrypts the PlainText.
+// 32-bit T-table version, produces exactly the same output as the byte-wise version below.
+static void SRAM_FUNC(CIPHER_CODE_SRAM, Cipher)(state_t* state, const uint8_t* RoundKey)
+{
+  uint8_t* s = (uint8_t*)state;
+  const uint8_t* rk = RoundKey;
+  uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+  uint8_t round;
+
+  // Add the First round key to the state before starting the rounds.
+  s0 = LOAD32(s)      ^ LOAD32(rk);
+  s1 = LOAD32(s + 4)  ^ LOAD32(rk + 4);
+  s2 = LOAD32(s + 8)  ^ LOAD32(rk + 8);
+  s3 = LOAD32(s + 12) ^ LOAD32(rk + 12);
+
+  // The first Nr-1 rounds are identical.
+  for (round = 1; round < Nr; ++round)
+  {
+    rk += AES_BLOCKLEN;
+    t0 = TROUND(s0, s1, s2, s3) ^ LOAD32(rk);
+    t1 = TROUND(s1, s2, s3, s0) ^ LOAD32(rk + 4);
+    t2 = TROUND(s2, s3, s0, s1) ^ LOAD32(rk + 8);
+    t3 = TROUND(s3, s0, s1, s2) ^ LOAD32(rk + 12);
+    s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+  }
+
+  // Add round key to last round
+  rk += AES_BLOCKLEN;
+  t0 = TFINAL(s0, s1, s2, s3) ^ LOAD32(rk);
+  t1 = TFINAL(s1, s2, s3, s0) ^ LOAD32(rk + 4);
+  t2 = TFINAL(s2, s3, s0, s1) ^ LOAD32(rk + 8);
+  t3 = TFINAL(s3, s0, s1, s2) ^ LOAD32(rk + 12);
+  STORE32(s,      t0);
+  STORE32(s + 4,  t1);
+  STORE32(s + 8,  t2);
+  STORE32(s + 12, t3);
+}
+#else
 // Cipher is the main function that encrypts the PlainText.
-static void Cipher(state_t* state, const uint8_t* RoundKey)
+static void SRAM_FUNC(CIPHER_CODE_SRAM, Cipher)(state_t* state, const uint8_t* RoundKey)
 {
   uint8_t round = 0;
 
@@ -440,6 +550,7 @@ static void Cipher(state_t* state, const uint8_t* RoundKey)
   // Add round key to last round
   AddRoundKey(Nr, state, RoundKey);
 }
+#endif // #if defined(AES_TTABLE) && (AES_TTABLE == 1)
 
 #if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
 static void InvCipher(state_t* state, const uint8_t* RoundKey)
@@ -473,7 +584,7 @@ static void InvCipher(state_t* state, const uint8_t* RoundKey)
 #if defined(ECB) && (ECB == 1)
 
 
-void AES_ECB_encrypt(const struct AES_ctx* ctx, uint8_t* buf)
+void SRAM_FUNC(CIPHER_CODE_SRAM, AES_ECB_encrypt)(const struct AES_ctx* ctx, uint8_t* buf)
 {
   // The next function call encrypts the PlainText with the Key using AES algorithm.
   Cipher((state_t*)buf, ctx->RoundKey);
@@ -495,7 +606,7 @@ void AES_ECB_decrypt(const struct AES_ctx* ctx, uint8_t* buf)
 #if defined(CBC) && (CBC == 1)
 
 
-static void XorWithIv(uint8_t* buf, const uint8_t* Iv)
+static void SRAM_FUNC(CIPHER_CODE_SRAM, XorWithIv)(uint8_t* buf, const uint8_t* Iv)
 {
   uint8_t i;
   for (i = 0; i < AES_BLOCKLEN; ++i) // The block in AES is always 128bit no matter the key size
@@ -504,7 +615,7 @@ static void XorWithIv(uint8_t* buf, const uint8_t* Iv)
   }
 }
 
-void AES_CBC_encrypt_buffer(struct AES_ctx *ctx, uint8_t* buf, size_t length)
+void SRAM_FUNC(CIPHER_CODE_SRAM, AES_CBC_encrypt_buffer)(struct AES_ctx *ctx, uint8_t* buf, size_t length)
 {
   size_t i;
   uint8_t *Iv = ctx->Iv;
@@ -541,7 +652,7 @@ void AES_CBC_decrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, size_t length)
 #if defined(CTR) && (CTR == 1)
 
 /* Symmetrical operation: same function for encrypting as for decrypting. Note any IV/nonce should never be reused with the same key */
-void AES_CTR_xcrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, size_t length)
+void SRAM_FUNC(CIPHER_CODE_SRAM, AES_CTR_xcrypt_buffer)(struct AES_ctx* ctx, uint8_t* buf, size_t length)
 {
   uint8_t buffer[AES_BLOCKLEN];
   
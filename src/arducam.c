@@ -1,24 +1,44 @@
+#include <stdio.h>
 #include "arducam.h"
+#include "frame_check.h"
+
+// Capture scheduler state, only touched by the core that drives the camera
+static bool capture_pending = false;
+static uint64_t capture_trigger_time = 0;
+static uint64_t readout_start_time = 0;
+static uint64_t last_readout_end_time = 0;
+static struct camera_timing last_timing;
+// Capture time last measured while waiting for the done flag, not inflated by time nobody was looking
+static uint32_t capture_estimate_us = 0;
+// Minimum time between capture triggers, 0 = no pacing
+static uint32_t frame_interval_us = 0;
+
+// Totals since the last camera_timing_report()
+static uint32_t report_frames = 0;
+static uint64_t report_capture_us = 0;
+static uint64_t report_readout_us = 0;
+static uint64_t report_idle_us = 0;
+static uint64_t report_period_us = 0;
 
 uint8_t read_register(uint8_t reg) {
     uint8_t ret;
     reg &= 0x7F; //read bit set to 0
-    gpio_put(PICO_DEFAULT_SPI_CSN_PIN, 0);
-    spi_write_read_blocking(spi_default, &reg, &ret, 1);
+    hal_cs_put(0);
+    hal_spi_write_read(&reg, &ret, 1);
     reg = 0;
-    spi_write_read_blocking(spi_default, &reg, &ret, 1);
-    spi_write_read_blocking(spi_default, &reg, &ret, 1);
-    gpio_put(PICO_DEFAULT_SPI_CSN_PIN, 1);
+    hal_spi_write_read(&reg, &ret, 1);
+    hal_spi_write_read(&reg, &ret, 1);
+    hal_cs_put(1);
     return ret;
 }
 
 void write_register(uint8_t buf[2]) {
     buf[0] |= 0x80; // for write bit set to 1
     uint8_t temp;
-    gpio_put(PICO_DEFAULT_SPI_CSN_PIN, 0);
-    spi_write_read_blocking(spi_default, &buf[0], &temp, 1);
-    spi_write_read_blocking(spi_default, &buf[1], &temp, 1);
-    gpio_put(PICO_DEFAULT_SPI_CSN_PIN, 1);
+    hal_cs_put(0);
+    hal_spi_write_read(&buf[0], &temp, 1);
+    hal_spi_write_read(&buf[1], &temp, 1);
+    hal_cs_put(1);
 }
 
 uint32_t camera_get_picture_length()
@@ -32,34 +52,248 @@ uint32_t camera_get_picture_length()
     return length;
 }
 
+// Sleeps until "time_us", with EVENT_WAITS the time counts as idle
+static void camera_sleep_until(uint64_t time_us) {
+#if EVENT_WAITS
+    uint64_t now;
+    while((now = hal_time_us()) < time_us) {
+        hal_core_wait(time_us);
+    }
+#else
+    uint64_t now = hal_time_us();
+    if(now < time_us) {
+        hal_sleep_us(time_us - now);
+    }
+#endif
+}
+
+// Gap between two status register reads
+static void poll_delay() {
+#if EVENT_WAITS
+    camera_sleep_until(hal_time_us() + CAMERA_POLL_US);
+#endif
+}
+
 void camera_wait() {
     while((read_register(0x44) & 0x03) != (1 << 1)) {
+        poll_delay();
     }
 }
 
-uint32_t camera_take_picture() {
+// Waits for the capture done flag of the pending capture and sets its capture time
+static void wait_capture_done() {
+    if(read_register(0x44) & 0x04) {
+        // Done before anyone looked, e.g. with CAMERA_PIPELINE while core 1 waited for a free slot.
+        // The time since the trigger includes that wait, the last measured capture time stands in.
+        uint32_t elapsed = hal_time_us() - capture_trigger_time;
+        last_timing.capture_us = capture_estimate_us && capture_estimate_us < elapsed ? capture_estimate_us : elapsed;
+        return;
+    }
+#if EVENT_WAITS
+    // The sensor takes about as long as last time, most of that is slept through in one go
+    camera_sleep_until(capture_trigger_time + capture_estimate_us * 7 / 8);
+#endif
+    while((read_register(0x44) & 0x04) == 0) {
+        poll_delay();
+    }
+    last_timing.capture_us = hal_time_us() - capture_trigger_time;
+    capture_estimate_us = last_timing.capture_us;
+}
+
+// Clears the FIFO and starts a capture without waiting for it
+static void camera_trigger() {
     uint8_t clear_fifo_flag[] = {0x04, 0x01};
     write_register(clear_fifo_flag);
     uint8_t take_picture[] = {0x04, 0x02};
     write_register(take_picture);
+    capture_pending = true;
+    capture_trigger_time = hal_time_us();
+}
+
+uint32_t camera_take_picture() {
+    if(frame_interval_us && !capture_pending) {
+        // Paced: waits until the next capture is due
+        camera_sleep_until(capture_trigger_time + frame_interval_us);
+    }
+#if CAMERA_PIPELINE
+    // Usually already triggered at the end of the previous readout
+    if(!capture_pending) {
+        camera_trigger();
+    }
+#else
+    camera_trigger();
+#endif
 
     //waits for camera to take picture
-    while((read_register(0x44) & 0x04) == 0){}
+    wait_capture_done();
+    capture_pending = false;
     return camera_get_picture_length();
 }
 
-void load_image(uint8_t *buf, uint32_t size) {
+// Called when a readout starts
+static void readout_started() {
+    readout_start_time = hal_time_us();
+}
+
+// Called when the whole frame has been read from the FIFO
+static void readout_finished() {
+    uint64_t now = hal_time_us();
+    last_timing.readout_us = now - readout_start_time;
+    if(last_readout_end_time != 0) {
+        // Everything in the frame period that was neither capture nor readout
+        last_timing.period_us = now - last_readout_end_time;
+        uint32_t busy = last_timing.capture_us + last_timing.readout_us;
+        last_timing.idle_us = last_timing.period_us > busy ? last_timing.period_us - busy : 0;
+
+        report_frames++;
+        report_capture_us += last_timing.capture_us;
+        report_readout_us += last_timing.readout_us;
+        report_idle_us += last_timing.idle_us;
+        report_period_us += last_timing.period_us;
+    }
+    last_readout_end_time = now;
+
+#if CAMERA_PIPELINE
+    // The FIFO is empty again, the sensor can work on the next frame while this one is handed off
+    if(frame_interval_us == 0) {
+        camera_trigger();
+    }
+#endif
+}
+
+const struct camera_timing *camera_last_timing() {
+    return &last_timing;
+}
+
+void camera_timing_report() {
+    if(report_frames == 0) {
+        return;
+    }
+    printf("Camera %lu.%02lu fps, capture %lu us, readout %lu us, idle %lu us per frame\n",
+        (unsigned long)(report_frames * 1000000ull / report_period_us),
+        (unsigned long)(report_frames * 100000000ull / report_period_us % 100),
+        (unsigned long)(report_capture_us / report_frames),
+        (unsigned long)(report_readout_us / report_frames),
+        (unsigned long)(report_idle_us / report_frames));
+    report_frames = 0;
+    report_capture_us = 0;
+    report_readout_us = 0;
+    report_idle_us = 0;
+    report_period_us = 0;
+}
+
+// Selects burst read mode and leaves CS low so the FIFO can be clocked out
+static void fifo_burst_begin() {
     uint8_t fifo_burst[] = {0x3C, 0};
     uint8_t temp;
-    gpio_put(PICO_DEFAULT_SPI_CSN_PIN, 0);
-    spi_write_read_blocking(spi_default, &fifo_burst[0], &temp, 1);
-    spi_write_read_blocking(spi_default, &fifo_burst[1], &temp, 1);
+    hal_cs_put(0);
+    hal_spi_write_read(&fifo_burst[0], &temp, 1);
+    hal_spi_write_read(&fifo_burst[1], &temp, 1);
+}
+
+#if CAMERA_DMA
+// State of the chunked burst read, the chunk counters are updated from the read done callback
+static uint8_t *dma_buf;
+static uint32_t dma_size;
+static uint32_t dma_chunk_len;
+static uint32_t dma_bytes_done;
+static volatile uint32_t dma_chunks_done;
 
-    spi_read_blocking(spi_default, 0, buf, size);
-    gpio_put(PICO_DEFAULT_SPI_CSN_PIN, 1);
+// Starts reading the next chunk of the frame, CS stays low between chunks so the burst continues
+static void dma_start_chunk() {
+    uint32_t remaining = dma_size - dma_bytes_done;
+    dma_chunk_len = remaining < CAMERA_DMA_CHUNK ? remaining : CAMERA_DMA_CHUNK;
+    hal_spi_read_async(&dma_buf[dma_bytes_done], dma_chunk_len);
 }
 
+// A chunk is in the buffer, runs in interrupt context on the Pico
+static void dma_chunk_done() {
+    uint32_t done = dma_bytes_done + dma_chunk_len;
+    // Release so the chunk data is visible before the count that covers it
+    __atomic_store_n(&dma_bytes_done, done, __ATOMIC_RELEASE);
+    dma_chunks_done++;
+    if(done < dma_size) {
+        dma_start_chunk();
+    }
+}
+
+void camera_dma_init() {
+    hal_spi_async_init(dma_chunk_done);
+}
+
+void load_image_start(uint8_t *buf, uint32_t size) {
+    dma_buf = buf;
+    dma_size = size;
+    dma_bytes_done = 0;
+    dma_chunks_done = 0;
+    readout_started();
+    fifo_burst_begin();
+#if FRAME_CHECK
+    hal_spi_crc_start();
+#endif
+    if(size == 0) {
+        return;
+    }
+    dma_start_chunk();
+}
+
+uint32_t load_image_progress() {
+    return __atomic_load_n(&dma_bytes_done, __ATOMIC_ACQUIRE);
+}
+
+uint32_t load_image_chunks() {
+    return dma_chunks_done;
+}
+
+#if FRAME_CHECK
+uint32_t load_image_crc() {
+    // Worked out by the DMA as it read the chunks
+    return hal_spi_crc();
+}
+#endif
+
+void load_image_finish() {
+    while(load_image_progress() < dma_size) {
+#if EVENT_WAITS
+        // Woken by the DMA interrupt
+        hal_core_wait(hal_time_us() + CAMERA_POLL_US);
+#endif
+    }
+    hal_cs_put(1);
+    readout_finished();
+}
+
+void load_image(uint8_t *buf, uint32_t size) {
+    load_image_start(buf, size);
+    load_image_finish();
+}
+#else
+#if FRAME_CHECK
+static uint32_t image_crc;
+
+uint32_t load_image_crc() {
+    return image_crc;
+}
+#endif
+
+void load_image(uint8_t *buf, uint32_t size) {
+    readout_started();
+    fifo_burst_begin();
+    hal_spi_read(0, buf, size);
+    hal_cs_put(1);
+    readout_finished();
+#if FRAME_CHECK
+    // Nothing reads along with the CPU here, it goes over the frame once more
+    image_crc = frame_crc32(0, buf, size);
+#endif
+}
+#endif
+
 void camera_start() {
+    // Any capture in flight is thrown away by the reset
+    capture_pending = false;
+    last_readout_end_time = 0;
+
     uint8_t reset_camera[] = {0x07, (1 << 6) | (1 << 7) | (1 << 1)};
     // Reset the camera
     write_register(reset_camera);
@@ -77,10 +311,27 @@ void camera_start() {
 
     //1 = 320 x 240 and 2 = 640x480 (only possible modes resolutions supported?)
     //Changed to normal capture mode(To change back change to (1 << 7))
-    uint8_t set_video_resolution[] = {0x21 , (1 << 1) | (1 << 7)};
+    uint8_t set_video_resolution[] = {0x21 , CAMERA_RES_VGA | (1 << 7)};
     write_register(set_video_resolution);
     camera_wait();
+    frame_interval_us = 0;
 
     //Allow camera to adjust to lighting
-    sleep_ms(500);
-}
\ No newline at end of file
+    hal_sleep_ms(500);
+}
+void camera_set_mode(enum camera_resolution resolution, enum camera_quality quality) {
+    if(capture_pending) {
+        wait_capture_done();
+        capture_pending = false;
+    }
+    uint8_t set_resolution[] = {0x21, resolution | (1 << 7)};
+    write_register(set_resolution);
+    camera_wait();
+    uint8_t set_quality[] = {0x2A, quality};
+    write_register(set_quality);
+    camera_wait();
+}
+
+void camera_set_frame_interval(uint32_t interval_us) {
+    frame_interval_us = interval_us;
+}
@@ -0,0 +1,273 @@
+#include <string.h>
+#include "chacha20poly1305.h"
+#include "sram_layout.h"
+
+static inline uint32_t load32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void store32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static inline void store64(uint8_t *p, uint64_t v) {
+    store32(p, (uint32_t)v);
+    store32(p + 4, (uint32_t)(v >> 32));
+}
+
+// Compiles to a single ROR on the M0+
+#define ROTL(v, n) ((v) << (n) | (v) >> (32 - (n)))
+
+#define QUARTER_ROUND(a, b, c, d) \
+    a += b; d ^= a; d = ROTL(d, 16); \
+    c += d; b ^= c; b = ROTL(b, 12); \
+    a += b; d ^= a; d = ROTL(d, 8); \
+    c += d; b ^= c; b = ROTL(b, 7);
+
+// 64 bytes of keystream for the state in "in"
+static void SRAM_FUNC(CIPHER_CODE_SRAM, chacha20_block)(const uint32_t *in, uint32_t *out) {
+    uint32_t x0 = in[0], x1 = in[1], x2 = in[2], x3 = in[3];
+    uint32_t x4 = in[4], x5 = in[5], x6 = in[6], x7 = in[7];
+    uint32_t x8 = in[8], x9 = in[9], x10 = in[10], x11 = in[11];
+    uint32_t x12 = in[12], x13 = in[13], x14 = in[14], x15 = in[15];
+    for(int i = 0; i < 10; i++) {
+        QUARTER_ROUND(x0, x4, x8, x12)
+        QUARTER_ROUND(x1, x5, x9, x13)
+        QUARTER_ROUND(x2, x6, x10, x14)
+        QUARTER_ROUND(x3, x7, x11, x15)
+        QUARTER_ROUND(x0, x5, x10, x15)
+        QUARTER_ROUND(x1, x6, x11, x12)
+        QUARTER_ROUND(x2, x7, x8, x13)
+        QUARTER_ROUND(x3, x4, x9, x14)
+    }
+    out[0] = x0 + in[0]; out[1] = x1 + in[1]; out[2] = x2 + in[2]; out[3] = x3 + in[3];
+    out[4] = x4 + in[4]; out[5] = x5 + in[5]; out[6] = x6 + in[6]; out[7] = x7 + in[7];
+    out[8] = x8 + in[8]; out[9] = x9 + in[9]; out[10] = x10 + in[10]; out[11] = x11 + in[11];
+    out[12] = x12 + in[12]; out[13] = x13 + in[13]; out[14] = x14 + in[14]; out[15] = x15 + in[15];
+}
+
+static void chacha20_setup(uint32_t *state, const uint8_t *key, const uint8_t *nonce, uint32_t counter) {
+    // "expand 32-byte k"
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for(int i = 0; i < 8; i++) {
+        state[4 + i] = load32(&key[i * 4]);
+    }
+    state[12] = counter;
+    state[13] = load32(&nonce[0]);
+    state[14] = load32(&nonce[4]);
+    state[15] = load32(&nonce[8]);
+}
+
+void SRAM_FUNC(CIPHER_CODE_SRAM, chacha20_xor)(const uint8_t *key, const uint8_t *nonce, uint32_t counter, uint8_t *buf, size_t len) {
+    uint32_t state[16];
+    uint32_t stream[16];
+    chacha20_setup(state, key, nonce, counter);
+    while(len) {
+        chacha20_block(state, stream);
+        state[12]++;
+        size_t n = len < 64 ? len : 64;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        // Word at a time when aligned, fragments start at multiples of FRAME_SIZE
+        if(n == 64 && ((uintptr_t)buf & 3) == 0) {
+            uint32_t *w = (uint32_t*)buf;
+            for(int i = 0; i < 16; i++) {
+                w[i] ^= stream[i];
+            }
+            buf += 64;
+            len -= 64;
+            continue;
+        }
+#endif
+        for(size_t i = 0; i < n; i++) {
+            buf[i] ^= (uint8_t)(stream[i / 4] >> (8 * (i % 4)));
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+void poly1305_init(struct poly1305_ctx *ctx, const uint8_t *key) {
+    uint32_t t0 = load32(&key[0]);
+    uint32_t t1 = load32(&key[4]);
+    uint32_t t2 = load32(&key[8]);
+    uint32_t t3 = load32(&key[12]);
+    // r is clamped as the RFC says and split into 26-bit limbs
+    ctx->r[0] = t0 & 0x3ffffff;
+    ctx->r[1] = ((t0 >> 26) | (t1 << 6)) & 0x3ffff03;
+    ctx->r[2] = ((t1 >> 20) | (t2 << 12)) & 0x3ffc0ff;
+    ctx->r[3] = ((t2 >> 14) | (t3 << 18)) & 0x3f03fff;
+    ctx->r[4] = (t3 >> 8) & 0x00fffff;
+    for(int i = 0; i < 5; i++) {
+        ctx->h[i] = 0;
+    }
+    for(int i = 0; i < 4; i++) {
+        ctx->pad[i] = load32(&key[16 + i * 4]);
+    }
+    ctx->buf_len = 0;
+}
+
+/**
+ * h = (h + block) * r mod 2^130 - 5 for every 16 byte block
+ * @param hibit 1 << 24 for full blocks, 0 for the final short block that carries its own 1 byte
+ */
+static void SRAM_FUNC(CIPHER_CODE_SRAM, poly1305_blocks)(struct poly1305_ctx *ctx, const uint8_t *m, size_t len, uint32_t hibit) {
+    const uint32_t r0 = ctx->r[0], r1 = ctx->r[1], r2 = ctx->r[2], r3 = ctx->r[3], r4 = ctx->r[4];
+    const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2], h3 = ctx->h[3], h4 = ctx->h[4];
+    while(len >= 16) {
+        uint32_t t0 = load32(&m[0]);
+        uint32_t t1 = load32(&m[4]);
+        uint32_t t2 = load32(&m[8]);
+        uint32_t t3 = load32(&m[12]);
+        h0 += t0 & 0x3ffffff;
+        h1 += ((t0 >> 26) | (t1 << 6)) & 0x3ffffff;
+        h2 += ((t1 >> 20) | (t2 << 12)) & 0x3ffffff;
+        h3 += ((t2 >> 14) | (t3 << 18)) & 0x3ffffff;
+        h4 += (t3 >> 8) | hibit;
+
+        uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+        uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+        uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+        uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+        uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+        // Partial carry, the limbs stay small enough for the next block's products
+        uint32_t c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+        d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+        d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+        d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+        d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+        h1 += c;
+
+        m += 16;
+        len -= 16;
+    }
+    ctx->h[0] = h0;
+    ctx->h[1] = h1;
+    ctx->h[2] = h2;
+    ctx->h[3] = h3;
+    ctx->h[4] = h4;
+}
+
+void SRAM_FUNC(CIPHER_CODE_SRAM, poly1305_update)(struct poly1305_ctx *ctx, const uint8_t *data, size_t len) {
+    if(ctx->buf_len) {
+        size_t n = 16 - ctx->buf_len < len ? 16 - ctx->buf_len : len;
+        memcpy(&ctx->buf[ctx->buf_len], data, n);
+        ctx->buf_len += n;
+        data += n;
+        len -= n;
+        if(ctx->buf_len < 16) {
+            return;
+        }
+        poly1305_blocks(ctx, ctx->buf, 16, 1 << 24);
+        ctx->buf_len = 0;
+    }
+    size_t full = len & ~(size_t)15;
+    poly1305_blocks(ctx, data, full, 1 << 24);
+    memcpy(ctx->buf, data + full, len - full);
+    ctx->buf_len = len - full;
+}
+
+void poly1305_pad(struct poly1305_ctx *ctx) {
+    if(ctx->buf_len) {
+        memset(&ctx->buf[ctx->buf_len], 0, 16 - ctx->buf_len);
+        poly1305_blocks(ctx, ctx->buf, 16, 1 << 24);
+        ctx->buf_len = 0;
+    }
+}
+
+void poly1305_finish(struct poly1305_ctx *ctx, uint8_t *tag) {
+    if(ctx->buf_len) {
+        ctx->buf[ctx->buf_len] = 1;
+        memset(&ctx->buf[ctx->buf_len + 1], 0, 15 - ctx->buf_len);
+        poly1305_blocks(ctx, ctx->buf, 16, 0);
+        ctx->buf_len = 0;
+    }
+    uint32_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2], h3 = ctx->h[3], h4 = ctx->h[4];
+
+    // Full carry
+    uint32_t c = h1 >> 26; h1 &= 0x3ffffff;
+    h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+    h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+    h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+    h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+    h1 += c;
+
+    // g = h - (2^130 - 5), taken instead of h when it doesn't go negative, without branching
+    uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+    uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+    uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+    uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+    uint32_t g4 = h4 + c - (1u << 26);
+    uint32_t mask = (g4 >> 31) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+
+    // Back to 4 words, plus the pad, mod 2^128
+    uint32_t w0 = h0 | (h1 << 26);
+    uint32_t w1 = (h1 >> 6) | (h2 << 20);
+    uint32_t w2 = (h2 >> 12) | (h3 << 14);
+    uint32_t w3 = (h3 >> 18) | (h4 << 8);
+    uint64_t f = (uint64_t)w0 + ctx->pad[0];
+    store32(&tag[0], (uint32_t)f);
+    f = (uint64_t)w1 + ctx->pad[1] + (f >> 32);
+    store32(&tag[4], (uint32_t)f);
+    f = (uint64_t)w2 + ctx->pad[2] + (f >> 32);
+    store32(&tag[8], (uint32_t)f);
+    f = (uint64_t)w3 + ctx->pad[3] + (f >> 32);
+    store32(&tag[12], (uint32_t)f);
+}
+
+void chacha20poly1305_tag(const uint8_t *key, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+    const uint8_t *ciphertext, size_t len, uint8_t *tag) {
+    // The Poly1305 key is the first 32 bytes of keystream block 0, the message starts at block 1
+    uint8_t one_time_key[64] = { 0 };
+    chacha20_xor(key, nonce, 0, one_time_key, sizeof(one_time_key));
+    struct poly1305_ctx poly;
+    poly1305_init(&poly, one_time_key);
+    poly1305_update(&poly, aad, aad_len);
+    poly1305_pad(&poly);
+    poly1305_update(&poly, ciphertext, len);
+    poly1305_pad(&poly);
+    uint8_t lengths[16];
+    store64(&lengths[0], aad_len);
+    store64(&lengths[8], len);
+    poly1305_update(&poly, lengths, sizeof(lengths));
+    poly1305_finish(&poly, tag);
+}
+
+void chacha20poly1305_encrypt(const uint8_t *key, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+    uint8_t *buf, size_t len, uint8_t *tag) {
+    chacha20_xor(key, nonce, 1, buf, len);
+    chacha20poly1305_tag(key, nonce, aad, aad_len, buf, len, tag);
+}
+
+bool chacha20poly1305_verify(const uint8_t *key, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+    const uint8_t *ciphertext, size_t len, const uint8_t *tag) {
+    uint8_t expected[POLY1305_TAGLEN];
+    chacha20poly1305_tag(key, nonce, aad, aad_len, ciphertext, len, expected);
+    uint8_t diff = 0;
+    for(int i = 0; i < POLY1305_TAGLEN; i++) {
+        diff |= expected[i] ^ tag[i];
+    }
+    return diff == 0;
+}
+
+bool chacha20poly1305_decrypt(const uint8_t *key, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+    uint8_t *buf, size_t len, const uint8_t *tag) {
+    if(!chacha20poly1305_verify(key, nonce, aad, aad_len, buf, len, tag)) {
+        return false;
+    }
+    chacha20_xor(key, nonce, 1, buf, len);
+    return true;
+}
@@ -0,0 +1,17 @@
+#include "fec.h"
+#include "sram_layout.h"
+
+void SRAM_FUNC(SEND_CODE_SRAM, fec_xor)(uint8_t *parity, const uint8_t *data, uint32_t len) {
+    uint32_t i = 0;
+    // Word at a time when both are aligned, fragments start at multiples of FRAME_SIZE
+    if((((uintptr_t)parity | (uintptr_t)data) & 3) == 0) {
+        uint32_t *p = (uint32_t*)parity;
+        const uint32_t *d = (const uint32_t*)data;
+        for(; i + 4 <= len; i += 4) {
+            *p++ ^= *d++;
+        }
+    }
+    for(; i < len; i++) {
+        parity[i] ^= data[i];
+    }
+}
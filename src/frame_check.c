@@ -0,0 +1,32 @@
+#include "frame_check.h"
+
+// Four bits at a time, the 16 entry table is small enough to keep in flash on the Pico
+static const uint32_t crc_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t frame_crc32(uint32_t crc, const uint8_t *data, size_t len) {
+    crc = ~crc;
+    for(size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ crc_table[crc & 0x0F];
+        crc = (crc >> 4) ^ crc_table[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+bool frame_check_end(const uint8_t *buf, uint32_t len) {
+    if(len < 4) {
+        return false;
+    }
+    uint32_t stop = len > FRAME_CHECK_TAIL + 2 ? len - FRAME_CHECK_TAIL - 2 : 0;
+    for(uint32_t i = len - 2; ; i--) {
+        if(buf[i] == 0xFF && buf[i + 1] == 0xD9) {
+            return true;
+        }
+        if(i == stop) {
+            return false;
+        }
+    }
+}
@@ -0,0 +1,108 @@
+#include <stddef.h>
+#include "frame_queue.h"
+
+// head and tail are free running counters, the slot is the counter modulo FRAME_QUEUE_SLOTS
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+void frame_queue_init(struct frame_queue *q, uint8_t *storage, uint32_t slot_size, enum frame_queue_policy policy) {
+    for(uint32_t i = 0; i < FRAME_QUEUE_SLOTS; i++) {
+        q->slots[i].buf = storage + i * slot_size;
+        q->slots[i].len = 0;
+        q->slots[i].ready = 0;
+        q->slots[i].kept = 0;
+        q->slots[i].crc = 0;
+    }
+    q->slot_size = slot_size;
+    q->policy = policy;
+    q->head = 0;
+    q->tail = 0;
+    q->read = 0;
+    q->producer_waiting = 0;
+    q->full = 0;
+    q->dropped_capture = 0;
+    q->dropped_corrupt = 0;
+    q->dropped_stale = 0;
+    q->dropped_send = 0;
+}
+
+struct frame_slot *frame_queue_write_slot(struct frame_queue *q) {
+    uint32_t head = q->head;
+    // Slots up to tail were given back by the consumer, acquire so it is done reading them
+    if(head - load_acquire(&q->tail) == FRAME_QUEUE_SLOTS) {
+        // Counted once per wait, not for every poll of a full ring. Both are read by the consumer,
+        // relaxed like its loads, only the producer writes them
+        if(!q->producer_waiting) {
+            __atomic_store_n(&q->full, q->full + 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&q->producer_waiting, 1, __ATOMIC_RELAXED);
+        }
+        return NULL;
+    }
+    if(q->producer_waiting) {
+        __atomic_store_n(&q->producer_waiting, 0, __ATOMIC_RELAXED);
+    }
+    return &q->slots[head % FRAME_QUEUE_SLOTS];
+}
+
+void frame_queue_publish(struct frame_queue *q, uint32_t len) {
+    uint32_t head = q->head;
+    q->slots[head % FRAME_QUEUE_SLOTS].len = len;
+    q->slots[head % FRAME_QUEUE_SLOTS].ready = len;
+    // Release so the frame data and length are visible before the slot is
+    store_release(&q->head, head + 1);
+}
+
+void frame_queue_publish_partial(struct frame_queue *q, uint32_t len) {
+    uint32_t head = q->head;
+    q->slots[head % FRAME_QUEUE_SLOTS].len = len;
+    q->slots[head % FRAME_QUEUE_SLOTS].ready = 0;
+    store_release(&q->head, head + 1);
+}
+
+void frame_queue_set_ready(struct frame_queue *q, uint32_t ready) {
+    // Release so the data up to "ready" is visible before the count is
+    store_release(&q->slots[(q->head - 1) % FRAME_QUEUE_SLOTS].ready, ready);
+}
+
+// Gives back every read slot up to the oldest kept one
+static void advance_tail(struct frame_queue *q) {
+    uint32_t tail = q->tail;
+    while(tail != q->read && !q->slots[tail % FRAME_QUEUE_SLOTS].kept) {
+        tail++;
+    }
+    if(tail != q->tail) {
+        store_release(&q->tail, tail);
+    }
+}
+
+struct frame_slot *frame_queue_read_slot(struct frame_queue *q) {
+    uint32_t queued = load_acquire(&q->head) - q->read;
+    if(queued == 0) {
+        return NULL;
+    }
+    if(q->policy == FRAME_QUEUE_DROP_OLDEST && queued > 1) {
+        // Older frames are given back to the producer straight away, or once the kept slots before them are
+        q->dropped_stale += queued - 1;
+        q->read += queued - 1;
+        advance_tail(q);
+    }
+    return &q->slots[q->read % FRAME_QUEUE_SLOTS];
+}
+
+void frame_queue_release(struct frame_queue *q) {
+    q->read++;
+    advance_tail(q);
+}
+
+void frame_queue_keep(struct frame_queue *q) {
+    q->slots[q->read % FRAME_QUEUE_SLOTS].kept = 1;
+    q->read++;
+}
+
+void frame_queue_release_kept(struct frame_queue *q) {
+    // advance_tail() always stops at the oldest kept slot
+    if(q->tail != q->read) {
+        q->slots[q->tail % FRAME_QUEUE_SLOTS].kept = 0;
+        advance_tail(q);
+    }
+}
@@ -0,0 +1,495 @@
+#include <stdio.h>
+#include <malloc.h>
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "pico/multicore.h"
+#include "pico/rand.h"
+#include "hardware/spi.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/watchdog.h"
+#include "hardware/structs/busctrl.h"
+#include "hardware/structs/systick.h"
+#include "hardware/structs/xip_ctrl.h"
+#include <lwip/udp.h>
+#include "hal.h"
+#include "mem_pool.h"
+#include "streamer.h"
+#include "stream_header.h"
+#include "sram_layout.h"
+
+// Zero copy datagrams in flight at the same time, a send falls back to copying when all are in use
+#define HAL_UDP_REFS 32
+// Copied datagrams in flight at the same time, the driver copies them out straight away
+// unless they wait for ARP
+#define HAL_UDP_BUFFERS 8
+
+// Room in front of the data for the headers lwIP puts in front of it
+#define TX_HEADROOM LWIP_MEM_ALIGN_SIZE(PBUF_LINK_ENCAPSULATION_HLEN + PBUF_LINK_HLEN + PBUF_IP_HLEN + PBUF_TRANSPORT_HLEN)
+// Stream header and auth block in front of a zero copy payload
+#define TX_HEADER_MAX (STREAM_HEADER_SIZE + STREAM_AUTH_SIZE)
+// A whole copied fragment
+#define TX_DATAGRAM_MAX (TX_HEADER_MAX + FRAME_SIZE)
+
+// Network buffer taken from one of the pools, pbuf_custom has to be the first member
+struct pool_pbuf {
+    struct pbuf_custom pc;
+    struct mem_pool *pool;
+    // lwIP moves the payload back into this for its headers, so it has to come after the pbuf
+    uint8_t data[];
+};
+
+// Every pbuf the stream sends comes from these, lwIP's heap isn't used while streaming
+MEM_POOL_STORAGE(header_blocks, sizeof(struct pool_pbuf) + TX_HEADROOM + TX_HEADER_MAX, HAL_UDP_REFS);
+MEM_POOL_STORAGE(datagram_blocks, sizeof(struct pool_pbuf) + TX_HEADROOM + TX_DATAGRAM_MAX, HAL_UDP_BUFFERS);
+static struct mem_pool header_pool;
+static struct mem_pool datagram_pool;
+
+// Custom pbuf pointing into a frame buffer, pbuf_custom has to be the first member
+struct udp_ref {
+    struct pbuf_custom pc;
+    struct hal_udp_pin *pin;
+    volatile bool in_use;
+};
+
+static struct udp_pcb *pcb;
+static struct udp_pcb *trace_pcb;
+static struct udp_ref udp_refs[HAL_UDP_REFS];
+static uint32_t next_ref = 0;
+static uint64_t bytes_copied = 0;
+static hal_udp_recv_fn recv_callback;
+// Time each core slept in the wait functions
+static volatile uint64_t idle_us[2];
+
+#if CORE1_STACK_SRAM != SRAM_SCRATCH_X
+// The SDK's own core 1 stack is in SRAM4, this one goes where CORE1_STACK_SRAM says
+static uint32_t core1_stack[PICO_CORE1_STACK_SIZE / sizeof(uint32_t)] SRAM_DATA(CORE1_STACK_SRAM, "core1_stack");
+#endif
+
+// Bus fabric performance counter events per hal_bus_region, accesses and contested accesses
+static const uint8_t bus_events[HAL_BUS_REGIONS][2] = {
+    { arbiter_sram0_perf_event_access, arbiter_sram0_perf_event_access_contested },
+    { arbiter_sram1_perf_event_access, arbiter_sram1_perf_event_access_contested },
+    { arbiter_sram2_perf_event_access, arbiter_sram2_perf_event_access_contested },
+    { arbiter_sram3_perf_event_access, arbiter_sram3_perf_event_access_contested },
+    { arbiter_sram4_perf_event_access, arbiter_sram4_perf_event_access_contested },
+    { arbiter_sram5_perf_event_access, arbiter_sram5_perf_event_access_contested },
+    { arbiter_xip_main_perf_event_access, arbiter_xip_main_perf_event_access_contested },
+};
+
+static int dma_tx;
+static int dma_rx;
+static hal_read_done_fn read_done;
+// Clocked out on MOSI while reading, the camera ignores it in burst mode
+static const uint8_t dma_dummy = 0;
+
+void hal_init(uint32_t spi_hz) {
+    mem_pool_init(&header_pool, "header", header_blocks, sizeof(struct pool_pbuf) + TX_HEADROOM + TX_HEADER_MAX, HAL_UDP_REFS);
+    mem_pool_init(&datagram_pool, "datagram", datagram_blocks, sizeof(struct pool_pbuf) + TX_HEADROOM + TX_DATAGRAM_MAX, HAL_UDP_BUFFERS);
+    // SysTick free running on the processor clock as hal_cycles(), on core 0
+    systick_hw->rvr = HAL_CYCLES_MASK;
+    systick_hw->cvr = 0;
+    systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+    spi_init(spi_default, spi_hz);
+    gpio_set_function(PICO_DEFAULT_SPI_RX_PIN, GPIO_FUNC_SPI);
+    gpio_set_function(PICO_DEFAULT_SPI_SCK_PIN, GPIO_FUNC_SPI);
+    gpio_set_function(PICO_DEFAULT_SPI_TX_PIN, GPIO_FUNC_SPI);
+    gpio_init(PICO_DEFAULT_SPI_CSN_PIN);
+    gpio_set_dir(PICO_DEFAULT_SPI_CSN_PIN, GPIO_OUT);
+    gpio_put(PICO_DEFAULT_SPI_CSN_PIN, 1);
+}
+
+void hal_cs_put(bool level) {
+    gpio_put(PICO_DEFAULT_SPI_CSN_PIN, level);
+}
+
+void hal_spi_write_read(const uint8_t *tx, uint8_t *rx, size_t len) {
+    spi_write_read_blocking(spi_default, tx, rx, len);
+}
+
+void hal_spi_read(uint8_t repeated_tx, uint8_t *dst, size_t len) {
+    spi_read_blocking(spi_default, repeated_tx, dst, len);
+}
+
+// RX channel finished
+static void dma_irq() {
+    dma_hw->ints1 = 1u << dma_rx;
+    read_done();
+}
+
+void hal_spi_async_init(hal_read_done_fn done) {
+    read_done = done;
+    dma_tx = dma_claim_unused_channel(true);
+    dma_rx = dma_claim_unused_channel(true);
+
+    // TX: same dummy byte over and over, paced by the SPI TX FIFO
+    dma_channel_config c = dma_channel_get_default_config(dma_tx);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_dreq(&c, spi_get_dreq(spi_default, true));
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    dma_channel_configure(dma_tx, &c, &spi_get_hw(spi_default)->dr, &dma_dummy, 0, false);
+
+    // RX: SPI data register into the frame buffer, paced by the SPI RX FIFO
+    c = dma_channel_get_default_config(dma_rx);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_dreq(&c, spi_get_dreq(spi_default, false));
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    dma_channel_configure(dma_rx, &c, NULL, &spi_get_hw(spi_default)->dr, 0, false);
+
+    // The sniffer follows the RX channel: CRC-32 over bit reversed data, read back reversed and
+    // inverted, is the reflected CRC-32 of frame_crc32() once seeded with all ones
+    dma_sniffer_enable(dma_rx, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+    dma_sniffer_set_output_reverse_enabled(true);
+    dma_sniffer_set_output_invert_enabled(true);
+
+    // IRQ 1 is enabled on the calling core, which is the one that reads the camera
+    dma_channel_set_irq1_enabled(dma_rx, true);
+    irq_set_exclusive_handler(DMA_IRQ_1, dma_irq);
+    irq_set_enabled(DMA_IRQ_1, true);
+}
+
+void hal_spi_read_async(uint8_t *dst, size_t len) {
+    dma_channel_set_write_addr(dma_rx, dst, false);
+    dma_channel_set_trans_count(dma_rx, len, false);
+    dma_channel_set_trans_count(dma_tx, len, false);
+    // Both channels start together so every byte written to the SPI is read back
+    dma_start_channel_mask((1u << dma_tx) | (1u << dma_rx));
+}
+
+void hal_spi_crc_start() {
+    dma_hw->sniff_data = 0xFFFFFFFF;
+}
+
+uint32_t hal_spi_crc() {
+    return dma_hw->sniff_data;
+}
+
+uint64_t hal_time_us() {
+    return time_us_64();
+}
+
+void hal_sleep_us(uint64_t us) {
+    sleep_us(us);
+}
+
+void hal_sleep_ms(uint32_t ms) {
+    sleep_ms(ms);
+}
+
+void hal_launch_core1(void (*entry)(void)) {
+#if CORE1_STACK_SRAM == SRAM_SCRATCH_X
+    multicore_launch_core1(entry);
+#else
+    multicore_launch_core1_with_stack(entry, core1_stack, sizeof(core1_stack));
+#endif
+}
+
+uint8_t hal_core_num() {
+    return get_core_num();
+}
+
+void hal_core_notify() {
+    // Sets the event flag of both cores, a core in WFE wakes up, one that isn't yet doesn't sleep
+    __sev();
+}
+
+void hal_core_wait(uint64_t until_us) {
+    uint64_t start = time_us_64();
+    // A single WFE, any event or interrupt taken on this core ends it
+    best_effort_wfe_or_timeout(from_us_since_boot(until_us));
+    idle_us[get_core_num()] += time_us_64() - start;
+}
+
+uint64_t hal_core_idle_us(uint8_t core) {
+    return idle_us[core];
+}
+
+void hal_watchdog_update() {
+    watchdog_update();
+}
+
+uint32_t hal_random32() {
+    // Seeded from the ring oscillator and the bus performance counters
+    return get_rand_32();
+}
+
+bool hal_udp_connect(const char *ip, uint16_t port) {
+    // With the threadsafe_background arch lwIP runs from an interrupt, every call into it is
+    // made between cyw43_arch_lwip_begin() and cyw43_arch_lwip_end(). They do nothing with poll.
+    cyw43_arch_lwip_begin();
+    pcb = udp_new();
+    if(!pcb) {
+        cyw43_arch_lwip_end();
+        printf("Couldn't allocate pcb\n");
+        return false;
+    }
+    err_t err = udp_bind(pcb, &(cyw43_state.netif[0].ip_addr), 0);
+    if(err != ERR_OK) {
+        cyw43_arch_lwip_end();
+        printf("ERROR Binding: %d\n", err);
+        return false;
+    }
+
+    ip_addr_t server_ip;
+    ipaddr_aton(ip, &server_ip);
+    err = udp_connect(pcb, &server_ip, port);
+    cyw43_arch_lwip_end();
+    if(err) {
+        printf("Failed to connect\n");
+        return false;
+    }
+    return true;
+}
+
+// Called by lwIP when the last reference to a zero copy payload is dropped
+static void SRAM_FUNC(SEND_CODE_SRAM, udp_ref_free)(struct pbuf *p) {
+    struct udp_ref *ref = (struct udp_ref*)p;
+    // Release: the driver is done with the payload before hal_udp_unpin() can see the count drop
+    __atomic_store_n(&ref->pin->pending, ref->pin->pending - 1, __ATOMIC_RELEASE);
+    ref->in_use = false;
+}
+
+// Called by lwIP when a pool pbuf is freed
+static void SRAM_FUNC(SEND_CODE_SRAM, pool_pbuf_free)(struct pbuf *p) {
+    struct pool_pbuf *b = (struct pool_pbuf*)p;
+    mem_pool_free(b->pool, b);
+}
+
+/**
+ * pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM) from one of the pools instead of lwIP's heap
+ * @returns NULL if the pool is empty or "len" doesn't fit its blocks
+ */
+static struct pbuf *SRAM_FUNC(SEND_CODE_SRAM, pool_pbuf_alloc)(struct mem_pool *pool, uint16_t len) {
+    struct pool_pbuf *b = mem_pool_alloc(pool);
+    if(!b) {
+        return NULL;
+    }
+    b->pool = pool;
+    b->pc.custom_free_function = pool_pbuf_free;
+    struct pbuf *p = pbuf_alloced_custom(PBUF_TRANSPORT, len, PBUF_RAM, &b->pc, b->data, pool->block_size - sizeof(struct pool_pbuf));
+    if(!p) {
+        mem_pool_free(pool, b);
+        pool->failures++;
+    }
+    return p;
+}
+
+// hal_udp_send() with lwIP already locked
+static int SRAM_FUNC(SEND_CODE_SRAM, udp_send_locked)(const uint8_t *header, uint16_t header_len, const uint8_t *payload, uint16_t len, struct hal_udp_pin *pin) {
+    struct pbuf *p;
+    struct udp_ref *ref = NULL;
+    if(pin) {
+        ref = &udp_refs[next_ref];
+        if(ref->in_use) {
+            ref = NULL;
+        } else {
+            next_ref = (next_ref + 1) % HAL_UDP_REFS;
+        }
+    }
+
+    if(ref) {
+        // Header pbuf has room in front for the UDP/IP headers, the payload pbuf chained
+        // behind it points straight into the frame buffer
+        p = pool_pbuf_alloc(&header_pool, header_len);
+        if(!p) {
+            return ERR_MEM;
+        }
+        pbuf_take(p, header, header_len);
+        ref->pin = pin;
+        ref->in_use = true;
+        ref->pc.custom_free_function = udp_ref_free;
+        struct pbuf *data = pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, &ref->pc, (void*)payload, len);
+        __atomic_store_n(&pin->pending, pin->pending + 1, __ATOMIC_RELAXED);
+        pbuf_cat(p, data);
+        bytes_copied += header_len;
+    } else {
+        p = pool_pbuf_alloc(&datagram_pool, header_len + len);
+        if(!p) {
+            return ERR_MEM;
+        }
+        pbuf_take(p, header, header_len);
+        pbuf_take_at(p, payload, len, header_len);
+        bytes_copied += header_len + len;
+    }
+
+    err_t err = udp_send(pcb, p);
+    pbuf_free(p);
+    return err;
+}
+
+int SRAM_FUNC(SEND_CODE_SRAM, hal_udp_send)(const uint8_t *header, uint16_t header_len, const uint8_t *payload, uint16_t len, struct hal_udp_pin *pin) {
+    // Also keeps udp_ref_free() from running between the checks and updates of the refs
+    cyw43_arch_lwip_begin();
+    int err = udp_send_locked(header, header_len, payload, len, pin);
+    cyw43_arch_lwip_end();
+    // Lets the driver send it straight away with the poll arch
+    cyw43_arch_poll();
+    return err;
+}
+
+uint64_t hal_udp_bytes_copied() {
+    return bytes_copied;
+}
+
+void hal_udp_unpin(struct hal_udp_pin *pin) {
+    // Runs lwIP until nothing references the frame buffer anymore
+    uint64_t deadline_us = time_us_64() + UNPIN_TIMEOUT_US;
+    bool stuck = false;
+    while(__atomic_load_n(&pin->pending, __ATOMIC_ACQUIRE) != 0) {
+        cyw43_arch_poll();
+#if EVENT_WAITS
+        // The driver's interrupt ends the wait, with either arch
+        if(__atomic_load_n(&pin->pending, __ATOMIC_ACQUIRE) != 0) {
+            hal_core_wait(time_us_64() + 1000);
+        }
+#endif
+        if(time_us_64() < deadline_us) {
+            watchdog_update();
+        } else if(!stuck) {
+            // The driver lost a buffer, the slot can't be given back until the reset
+            printf("%u datagrams still reference a frame buffer, waiting for the watchdog\n",
+                (unsigned)__atomic_load_n(&pin->pending, __ATOMIC_RELAXED));
+            stuck = true;
+        }
+    }
+}
+
+// lwIP receive callback, runs on core 0 from cyw43_arch_poll() or with the threadsafe_background
+// arch from the driver's low priority interrupt
+static void udp_received(void *arg, struct udp_pcb *upcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    (void)arg;
+    (void)upcb;
+    (void)addr;
+    (void)port;
+    // Only small control datagrams are expected, anything longer is cut off
+    uint8_t data[64];
+    uint16_t len = pbuf_copy_partial(p, data, sizeof(data), 0);
+    pbuf_free(p);
+    if(recv_callback) {
+        recv_callback(data, len);
+    }
+}
+
+void hal_udp_set_recv(hal_udp_recv_fn recv) {
+    recv_callback = recv;
+    cyw43_arch_lwip_begin();
+    udp_recv(pcb, udp_received, NULL);
+    cyw43_arch_lwip_end();
+}
+
+bool hal_trace_connect(const char *ip, uint16_t port) {
+    cyw43_arch_lwip_begin();
+    trace_pcb = udp_new();
+    if(!trace_pcb) {
+        cyw43_arch_lwip_end();
+        return false;
+    }
+    ip_addr_t server_ip;
+    ipaddr_aton(ip, &server_ip);
+    err_t err = udp_connect(trace_pcb, &server_ip, port);
+    cyw43_arch_lwip_end();
+    return err == ERR_OK;
+}
+
+void hal_trace_send(const uint8_t *data, uint16_t len) {
+    cyw43_arch_lwip_begin();
+    struct pbuf *p = pool_pbuf_alloc(&datagram_pool, len);
+    if(p) {
+        pbuf_take(p, data, len);
+        udp_send(trace_pcb, p);
+        pbuf_free(p);
+    }
+    cyw43_arch_lwip_end();
+}
+
+void hal_net_poll() {
+    cyw43_arch_poll();
+}
+
+static void pool_stats(const struct mem_pool *pool, struct hal_pool_stats *stats) {
+    stats->name = pool->name;
+    stats->block_size = pool->block_size;
+    stats->count = pool->count;
+    stats->in_use = pool->in_use;
+    stats->peak = pool->peak;
+    stats->failures = pool->failures;
+}
+
+uint32_t hal_pool_stats(struct hal_pool_stats *stats, uint32_t max) {
+    const struct mem_pool *pools[] = { &header_pool, &datagram_pool };
+    uint32_t n = 0;
+    cyw43_arch_lwip_begin();
+    for(; n < max && n < sizeof(pools) / sizeof(pools[0]); n++) {
+        pool_stats(pools[n], &stats[n]);
+    }
+    cyw43_arch_lwip_end();
+    return n;
+}
+
+// From the linker script, static data ends here and the heap starts
+extern char __bss_end__;
+
+void hal_mem_usage(struct hal_mem_usage *usage) {
+    struct mallinfo info = mallinfo();
+    // The banked linker script puts RAM at the non-striped alias
+    uintptr_t ram_start = (uintptr_t)&__bss_end__ >= SRAM0_BASE ? SRAM0_BASE : SRAM_BASE;
+    usage->ram_bytes = SRAM_END - SRAM_BASE;
+    usage->static_bytes = (uintptr_t)&__bss_end__ - ram_start;
+    // newlib never gives memory back to sbrk, the arena is the most the heap ever took
+    usage->heap_peak = info.arena;
+    usage->heap_in_use = info.uordblks;
+}
+
+uint32_t hal_cycles() {
+    // SysTick counts down
+    return HAL_CYCLES_MASK - systick_hw->cvr;
+}
+
+void hal_bus_count_select(uint8_t region_a, uint8_t region_b) {
+    bus_ctrl_hw->counter[0].sel = bus_events[region_a][0];
+    bus_ctrl_hw->counter[1].sel = bus_events[region_a][1];
+    bus_ctrl_hw->counter[2].sel = bus_events[region_b][0];
+    bus_ctrl_hw->counter[3].sel = bus_events[region_b][1];
+    hal_bus_count_clear();
+}
+
+void hal_bus_count_clear() {
+    // Any write clears a counter
+    for(int i = 0; i < 4; i++) {
+        bus_ctrl_hw->counter[i].value = 0;
+    }
+    xip_ctrl_hw->ctr_acc = 0;
+    xip_ctrl_hw->ctr_hit = 0;
+}
+
+void hal_bus_count_add(struct hal_bus_count *counts) {
+    // The counters saturate at 24 bits, the spans measured are far shorter
+    counts[0].accesses += bus_ctrl_hw->counter[0].value;
+    counts[0].contested += bus_ctrl_hw->counter[1].value;
+    counts[1].accesses += bus_ctrl_hw->counter[2].value;
+    counts[1].contested += bus_ctrl_hw->counter[3].value;
+}
+
+void hal_cache_count_add(struct hal_cache_count *count) {
+    count->accesses += xip_ctrl_hw->ctr_acc;
+    count->hits += xip_ctrl_hw->ctr_hit;
+}
+
+void hal_cache_flush() {
+    xip_ctrl_hw->flush = 1;
+    // The read stalls until the flush is done
+    (void)xip_ctrl_hw->flush;
+}
+
+void hal_net_wait_until(uint64_t time_us) {
+    absolute_time_t until = from_us_since_boot(time_us);
+    uint64_t start = time_us_64();
+    do {
+        cyw43_arch_poll();
+        // Returns early when the driver has work, e.g. a datagram came in
+        cyw43_arch_wait_for_work_until(until);
+    } while(!time_reached(until));
+    idle_us[get_core_num()] += time_us_64() - start;
+}
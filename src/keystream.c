@@ -0,0 +1,93 @@
+#include <string.h>
+#include "keystream.h"
+#include "stream_header.h"
+#include "sram_layout.h"
+
+// head and tail are free running counters, the entry is the counter modulo KEYSTREAM_FRAGMENTS
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define load_relaxed(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define store_relaxed(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+
+void keystream_init(struct keystream_ring *k, uint8_t *storage, uint32_t entry_size, const uint8_t *key,
+    const uint8_t *iv, uint32_t first_id) {
+    memset(k, 0, sizeof(*k));
+    k->storage = storage;
+    k->entry_size = entry_size;
+    AES_init_ctx(&k->ctx, key);
+    memcpy(k->iv, iv, AES_BLOCKLEN);
+    k->next_id = first_id;
+    k->first_id = first_id;
+    k->fragments_hint = KEYSTREAM_FRAGMENTS;
+}
+
+// Orders tags the way fragments are sent
+static inline bool tag_before(const struct keystream_tag *t, uint32_t frame_id, uint16_t fragment) {
+    return t->frame_id != frame_id ? (int32_t)(t->frame_id - frame_id) < 0 : t->fragment < fragment;
+}
+
+bool SRAM_FUNC(CIPHER_CODE_SRAM, keystream_fill)(struct keystream_ring *k) {
+    uint32_t head = k->head;
+    // Acquire so the consumer is done reading the entries it gave back
+    if(head - load_acquire(&k->tail) == KEYSTREAM_FRAGMENTS) {
+        return false;
+    }
+    uint32_t first = load_relaxed(&k->first_id);
+    if((int32_t)(k->next_id - first) < 0) {
+        // Fell behind, whatever it would generate now is already too late
+        k->next_id = first;
+        k->next_fragment = 0;
+    }
+    uint16_t limit = load_relaxed(&k->fragments_hint) + KEYSTREAM_MARGIN;
+    if(k->next_fragment >= limit) {
+        k->next_id++;
+        k->next_fragment = 0;
+    }
+
+    uint32_t index = head % KEYSTREAM_FRAGMENTS;
+    uint8_t *entry = &k->storage[index * k->entry_size];
+    uint8_t counter[AES_BLOCKLEN];
+    stream_ctr_counter(counter, k->iv, k->next_id, k->next_fragment);
+    AES_ctx_set_iv(&k->ctx, counter);
+    // CTR over zeroes is the keystream itself
+    memset(entry, 0, k->entry_size);
+    AES_CTR_xcrypt_buffer(&k->ctx, entry, k->entry_size);
+    k->tags[index].frame_id = k->next_id;
+    k->tags[index].fragment = k->next_fragment;
+    k->next_fragment++;
+    // Release so the entry and its tag are visible before it is
+    store_release(&k->head, head + 1);
+    return true;
+}
+
+const uint8_t *keystream_take(struct keystream_ring *k, uint32_t frame_id, uint16_t fragment) {
+    uint32_t tail = k->tail;
+    uint32_t head = load_acquire(&k->head);
+    while(tail != head) {
+        const struct keystream_tag *t = &k->tags[tail % KEYSTREAM_FRAGMENTS];
+        if(!tag_before(t, frame_id, fragment)) {
+            break;
+        }
+        k->skipped++;
+        tail++;
+    }
+    store_release(&k->tail, tail);
+    if(tail != head) {
+        const struct keystream_tag *t = &k->tags[tail % KEYSTREAM_FRAGMENTS];
+        if(t->frame_id == frame_id && t->fragment == fragment) {
+            k->used++;
+            return &k->storage[(tail % KEYSTREAM_FRAGMENTS) * k->entry_size];
+        }
+    }
+    k->missed++;
+    return NULL;
+}
+
+void keystream_release(struct keystream_ring *k) {
+    store_release(&k->tail, k->tail + 1);
+}
+
+void keystream_frame_done(struct keystream_ring *k, uint32_t frame_id, uint16_t fragments) {
+    store_relaxed(&k->fragments_hint, fragments);
+    store_relaxed(&k->first_id, frame_id + 1);
+}
@@ -0,0 +1,53 @@
+#include "latency_hist.h"
+
+static uint32_t bucket_index(uint32_t us) {
+    if(us < LATENCY_LINEAR) {
+        return us;
+    }
+    uint32_t bit = 31 - __builtin_clz(us);
+    if(bit >= LATENCY_MAX_BIT) {
+        return LATENCY_BUCKETS - 1;
+    }
+    uint32_t sub = (us >> (bit - 4)) & (LATENCY_SUB_BUCKETS - 1);
+    return LATENCY_LINEAR + (bit - 6) * LATENCY_SUB_BUCKETS + sub;
+}
+
+// Middle of the range covered by a bucket
+static uint32_t bucket_value(uint32_t index) {
+    if(index < LATENCY_LINEAR) {
+        return index;
+    }
+    uint32_t bit = (index - LATENCY_LINEAR) / LATENCY_SUB_BUCKETS + 6;
+    uint32_t sub = (index - LATENCY_LINEAR) % LATENCY_SUB_BUCKETS;
+    uint32_t width = 1u << (bit - 4);
+    return (1u << bit) + sub * width + width / 2;
+}
+
+void latency_record(struct latency_hist *h, uint32_t us) {
+    h->buckets[bucket_index(us)]++;
+    h->count++;
+    h->sum += us;
+    if(us > h->max) {
+        h->max = us;
+    }
+}
+
+uint32_t latency_percentile(const struct latency_hist *h, uint32_t pct) {
+    if(h->count == 0) {
+        return 0;
+    }
+    // Rank of the sample, rounded up
+    uint64_t rank = ((uint64_t)h->count * pct + 99) / 100;
+    if(rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for(uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if(seen >= rank) {
+            uint32_t value = bucket_value(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+    return h->max;
+}
@@ -0,0 +1,41 @@
+#include <string.h>
+#include "mem_pool.h"
+#include "sram_layout.h"
+
+// A free block holds the index of the next free one in its first two bytes
+static inline uint16_t *next_free(struct mem_pool *pool, uint16_t index) {
+    return (uint16_t*)&pool->blocks[(uint32_t)index * pool->block_size];
+}
+
+void mem_pool_init(struct mem_pool *pool, const char *name, void *blocks, uint32_t size, uint16_t count) {
+    memset(pool, 0, sizeof(*pool));
+    pool->name = name;
+    pool->blocks = blocks;
+    pool->block_size = MEM_POOL_BLOCK_SIZE(size);
+    pool->count = count;
+    for(uint16_t i = 0; i < count; i++) {
+        *next_free(pool, i) = i + 1;
+    }
+    pool->free_head = 0;
+}
+
+void *SRAM_FUNC(SEND_CODE_SRAM, mem_pool_alloc)(struct mem_pool *pool) {
+    if(pool->free_head >= pool->count) {
+        pool->failures++;
+        return NULL;
+    }
+    uint16_t index = pool->free_head;
+    pool->free_head = *next_free(pool, index);
+    pool->allocs++;
+    if(++pool->in_use > pool->peak) {
+        pool->peak = pool->in_use;
+    }
+    return &pool->blocks[(uint32_t)index * pool->block_size];
+}
+
+void SRAM_FUNC(SEND_CODE_SRAM, mem_pool_free)(struct mem_pool *pool, void *block) {
+    uint16_t index = ((uint8_t*)block - pool->blocks) / pool->block_size;
+    *next_free(pool, index) = pool->free_head;
+    pool->free_head = index;
+    pool->in_use--;
+}
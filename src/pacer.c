@@ -0,0 +1,49 @@
+#include "pacer.h"
+
+// Adds the tokens that came in since the last update, up to the burst
+static void refill(struct pacer *p, uint64_t now_us) {
+    if(now_us <= p->updated_us) {
+        return;
+    }
+    int64_t tokens = p->tokens + (int64_t)((now_us - p->updated_us) * p->rate / 1000000);
+    p->tokens = tokens < (int64_t)p->burst ? tokens : (int64_t)p->burst;
+    p->updated_us = now_us;
+}
+
+void pacer_init(struct pacer *p, uint32_t rate, uint32_t burst, uint64_t now_us) {
+    p->rate = rate;
+    p->burst = burst;
+    p->tokens = burst;
+    p->updated_us = now_us;
+}
+
+void pacer_set_rate(struct pacer *p, uint32_t rate, uint32_t burst, uint64_t now_us) {
+    refill(p, now_us);
+    p->rate = rate;
+    p->burst = burst;
+    if(p->tokens > (int64_t)burst) {
+        p->tokens = burst;
+    }
+}
+
+uint64_t pacer_next_us(struct pacer *p, uint32_t len, uint64_t now_us) {
+    if(!p->rate) {
+        return now_us;
+    }
+    refill(p, now_us);
+    // Longer than the bucket: waits for a full one
+    int64_t needed = len < p->burst ? len : p->burst;
+    if(p->tokens >= needed) {
+        return now_us;
+    }
+    // Rounded up so the tokens are really there at that time
+    return now_us + ((uint64_t)(needed - p->tokens) * 1000000 + p->rate - 1) / p->rate;
+}
+
+void pacer_take(struct pacer *p, uint32_t len, uint64_t now_us) {
+    if(!p->rate) {
+        return;
+    }
+    refill(p, now_us);
+    p->tokens -= len;
+}
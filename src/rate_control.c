@@ -0,0 +1,101 @@
+#include "rate_control.h"
+
+const struct camera_mode rate_modes[RATE_MODES] = {
+    { CAMERA_RES_VGA, CAMERA_QUALITY_HIGH },
+    { CAMERA_RES_VGA, CAMERA_QUALITY_DEFAULT },
+    { CAMERA_RES_VGA, CAMERA_QUALITY_LOW },
+    { CAMERA_RES_QVGA, CAMERA_QUALITY_DEFAULT },
+    { CAMERA_RES_QVGA, CAMERA_QUALITY_LOW }
+};
+
+void rate_control_init(struct rate_control *rc, uint8_t best_mode, uint8_t start_mode) {
+    rc->best_mode = best_mode < RATE_MODES ? best_mode : RATE_MODES - 1;
+    rc->mode = start_mode < rc->best_mode ? rc->best_mode : start_mode;
+    if(rc->mode >= RATE_MODES) {
+        rc->mode = RATE_MODES - 1;
+    }
+    rc->frame_interval_us = 0;
+    rc->since_change = RATE_SETTLE;
+    rc->clean = 0;
+    rc->probe_after = RATE_PROBE_MIN;
+    rc->probing = false;
+}
+
+// More than one frame in eight waited for the link, the link asked to slow down or the receiver lost too much
+static bool congested(const struct rate_signals *s) {
+    return s->send_errors > 0 || s->backlog * 8 > s->frames_sent ||
+        (s->loss_permille != RATE_NO_REPORT && s->loss_permille >= RATE_LOSS_HIGH);
+}
+
+// Cheaper frames first, slower frames once there are no cheaper ones
+static void step_down(struct rate_control *rc, const struct rate_signals *s) {
+    if(rc->mode < RATE_MODES - 1) {
+        rc->mode++;
+        return;
+    }
+    // Starts just above the rate the link managed
+    uint32_t achieved = s->frames_sent ? s->interval_us / s->frames_sent : RATE_MAX_INTERVAL_US;
+    uint32_t interval = rc->frame_interval_us * 5 / 4;
+    if(interval < achieved * 9 / 8) {
+        interval = achieved * 9 / 8;
+    }
+    if(interval < RATE_MIN_INTERVAL_US) {
+        interval = RATE_MIN_INTERVAL_US;
+    }
+    rc->frame_interval_us = interval < RATE_MAX_INTERVAL_US ? interval : RATE_MAX_INTERVAL_US;
+}
+
+// Faster frames first, bigger frames once unpaced
+static bool step_up(struct rate_control *rc) {
+    if(rc->frame_interval_us) {
+        rc->frame_interval_us = rc->frame_interval_us * 7 / 8;
+        if(rc->frame_interval_us < RATE_MIN_INTERVAL_US) {
+            rc->frame_interval_us = 0;
+        }
+        return true;
+    }
+    if(rc->mode > rc->best_mode) {
+        rc->mode--;
+        return true;
+    }
+    return false;
+}
+
+bool rate_control_update(struct rate_control *rc, const struct rate_signals *s) {
+    if(rc->since_change < UINT16_MAX) {
+        rc->since_change++;
+    }
+    if(congested(s)) {
+        rc->clean = 0;
+        if(rc->since_change < RATE_SETTLE) {
+            // The last change hasn't had time to show yet
+            return false;
+        }
+        if(rc->probing) {
+            // Stepped up into congestion, wait longer before trying again
+            rc->probe_after = rc->probe_after * 2 < RATE_PROBE_MAX ? rc->probe_after * 2 : RATE_PROBE_MAX;
+            rc->probing = false;
+        }
+        uint8_t mode = rc->mode;
+        uint32_t interval = rc->frame_interval_us;
+        step_down(rc, s);
+        rc->since_change = 0;
+        return mode != rc->mode || interval != rc->frame_interval_us;
+    }
+
+    if(rc->probing && rc->since_change > RATE_SETTLE + 1) {
+        // The step up held, the next one can come sooner again
+        rc->probing = false;
+        rc->probe_after = rc->probe_after / 2 > RATE_PROBE_MIN ? rc->probe_after / 2 : RATE_PROBE_MIN;
+    }
+    if(++rc->clean < rc->probe_after) {
+        return false;
+    }
+    rc->clean = 0;
+    if(!step_up(rc)) {
+        return false;
+    }
+    rc->probing = true;
+    rc->since_change = 0;
+    return true;
+}
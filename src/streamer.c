@@ -0,0 +1,1212 @@
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+#include "arducam.h"
+#include "aes.h"
+#include "streamer.h"
+#include "latency_hist.h"
+#include "trace.h"
+#include "stream_header.h"
+#include "fec.h"
+#include "rate_control.h"
+#include "pacer.h"
+#include "chacha20poly1305.h"
+#include "sram_layout.h"
+#include "keystream.h"
+#include "frame_check.h"
+
+#if CUT_THROUGH && (ENCRYPT_MODE == ENCRYPT_CBC)
+#error "CUT_THROUGH needs ENCRYPT_CTR, CBC encrypts the whole frame at once"
+#endif
+#if CUT_THROUGH && !CAMERA_DMA
+#error "CUT_THROUGH needs CAMERA_DMA to read the frame in the background"
+#endif
+
+#if RETRANSMIT_FRAMES && RETRANSMIT_FRAMES + 2 > FRAME_QUEUE_SLOTS
+#error "FRAME_QUEUE_SLOTS has to fit RETRANSMIT_FRAMES plus a frame being sent and one being captured"
+#endif
+
+#if CTR_KEYSTREAM && ENCRYPT_MODE != ENCRYPT_CTR
+#error "CTR_KEYSTREAM precomputes AES-CTR keystream, it needs ENCRYPT_CTR"
+#endif
+
+#if BUFFER_SIZE / FRAME_SIZE >= FEC_PARITY_COUNTER
+#error "Too many fragments per frame, fragment indices would run into the parity counters"
+#endif
+
+#if ENCRYPT_MODE == ENCRYPT_CBC
+// Room left at the end of the buffer for PKCS#7 padding
+#define PADDING_SIZE AES_BLOCK
+#else
+#define PADDING_SIZE 0
+#endif
+
+// Flags every fragment carries for the encryption mode
+#if ENCRYPT_MODE == ENCRYPT_CBC
+#define MODE_FLAGS STREAM_FLAG_CBC
+#elif ENCRYPT_MODE == ENCRYPT_NONE
+#define MODE_FLAGS STREAM_FLAG_PLAIN
+#elif ENCRYPT_MODE == ENCRYPT_AEAD
+#define MODE_FLAGS STREAM_FLAG_AEAD
+#else
+#define MODE_FLAGS 0
+#endif
+
+// Auth block sent between the header and the payload
+#if ENCRYPT_MODE == ENCRYPT_AEAD
+#define AUTH_SIZE STREAM_AUTH_SIZE
+#else
+#define AUTH_SIZE 0
+#endif
+
+#if FRAME_SIZE + STREAM_HEADER_SIZE + AUTH_SIZE > 1472
+#error "Fragments would not fit in a 1500 byte MTU"
+#endif
+
+struct frame_queue frames;
+// Frame ring storage, laid out at link time so nothing is taken from the heap
+static uint8_t frame_buffers[FRAME_QUEUE_SLOTS][BUFFER_SIZE] SRAM_DATA(FRAME_SRAM, "frames") __attribute__((aligned(4)));
+#if SRAM_BANKED_LAYOUT && FRAME_SRAM == SRAM_BANKED
+_Static_assert(FRAME_QUEUE_SLOTS * BUFFER_SIZE <= SRAM_BANKED_SIZE,
+    "The frame ring doesn't fit in SRAM2-3 (128KB), use fewer FRAME_QUEUE_SLOTS or leave FRAME_SRAM striped");
+#endif
+
+#if ENCRYPT_MODE == ENCRYPT_CBC || ENCRYPT_MODE == ENCRYPT_CTR
+static struct AES_ctx ctx SRAM_DATA(AES_SRAM, "aes_ctx");
+static uint8_t iv[AES_BLOCKLEN];
+#define STREAM_CTX (&ctx)
+#else
+#define STREAM_CTX NULL
+#endif
+
+#if CTR_KEYSTREAM
+// Filled by core 1, XORed into the fragments by core 0. Frame ids start at 1.
+static struct keystream_ring keystream;
+static uint8_t keystream_buffers[KEYSTREAM_FRAGMENTS][FRAME_SIZE] __attribute__((aligned(4)));
+#define KEYSTREAM_FILL() keystream_fill(&keystream)
+#else
+#define KEYSTREAM_FILL() false
+#endif
+
+#if ENCRYPT_MODE == ENCRYPT_AEAD
+static uint8_t aead_key[CHACHA20_KEYLEN];
+// Random per boot, first part of every nonce so a restart doesn't reuse them
+static uint32_t session;
+#endif
+
+#if ZERO_COPY
+// Keeps each frame slot pinned while the network stack still holds references into it
+static struct hal_udp_pin slot_pins[FRAME_QUEUE_SLOTS];
+#endif
+
+#if STREAM_FEC
+// Data fragments per parity fragment, 0 = no FEC. Only read at the start of a frame.
+static volatile uint16_t fec_group = FEC_GROUP;
+// Parity of the current group of fragments
+static uint8_t fec_parity[FRAME_SIZE] __attribute__((aligned(4)));
+#endif
+
+#if RETRANSMIT_FRAMES
+// NACKs waiting to be served
+#define RETRANSMIT_NACKS 8
+
+// Frame kept after it was sent, its slot is the oldest kept one in the frame ring
+struct sent_frame {
+    struct frame_slot *slot;
+    // As the data fragments were sent, without STREAM_FLAG_LAST
+    struct stream_header header;
+#if FRAME_CHECK
+    // Fragments before this one went out before the CRC in "header" was known, and without it
+    uint32_t crc_from;
+#endif
+    uint64_t deadline_us;
+};
+
+// Oldest first, in the same order as the kept slots
+static struct sent_frame sent_frames[RETRANSMIT_FRAMES];
+static uint32_t sent_first = 0;
+static uint32_t sent_count = 0;
+static volatile uint8_t retransmit_window = RETRANSMIT_FRAMES;
+static volatile uint32_t retransmit_deadline_us = RETRANSMIT_DEADLINE_US;
+
+// Written by the receive callback (head) and read by the send loop (tail), both on core 0 but the
+// callback runs from an interrupt. Published with release and taken with acquire like the frame ring,
+// so an entry is filled in before its head is seen and read before its tail gives it back.
+static struct stream_nack nacks[RETRANSMIT_NACKS];
+static uint32_t nack_head = 0;
+static uint32_t nack_tail = 0;
+
+static uint32_t nacks_received = 0;
+// NACKs for frames no longer kept, or that didn't fit in the queue
+static uint32_t nacks_missed = 0;
+static uint32_t fragments_resent = 0;
+#endif
+
+#if RATE_CONTROL
+static struct rate_control rate;
+static volatile bool rate_enabled = true;
+// Loss in the latest receiver report, RATE_NO_REPORT once it has been used
+static volatile uint16_t rate_loss = RATE_NO_REPORT;
+// Counters at the start of the current update interval
+static uint64_t rate_start_us = 0;
+static uint32_t rate_start_id = 0;
+static uint32_t rate_start_stale = 0;
+static uint32_t rate_start_full = 0;
+static uint32_t rate_start_send = 0;
+// Camera settings asked for by core 0, applied by core 1 between frames
+static volatile uint8_t camera_mode = RATE_START_MODE;
+static volatile uint32_t camera_interval_us = 0;
+#endif
+
+#if SEND_PACING
+static struct pacer pacer;
+static volatile bool pacing_enabled = true;
+static volatile uint32_t pacing_rate = SEND_PACING_RATE;
+static volatile uint32_t pacing_burst = SEND_PACING_BURST;
+// Average time between two captures, seen from core 0, for the automatic rate
+static uint32_t capture_interval_us = 0;
+static uint32_t last_capture_us = 0;
+static uint32_t last_stale = 0;
+// Time spent waiting for tokens, since the last stats
+static uint64_t paced_wait_us = 0;
+#endif
+
+// Bytes copied into network buffers for the last frame
+static uint32_t frame_bytes_copied = 0;
+
+#if FRAME_CHECK
+// First data fragment of the last frame sent that carried its CRC, the fragment count if none did
+static uint32_t frame_crc_from = 0;
+#endif
+
+#if PIPELINE_PROFILE
+// Capture and readout are written by core 1, the rest by core 0
+static struct latency_hist stage_latency[STAGE_COUNT];
+static uint32_t profile_frames = 0;
+static uint64_t profile_bytes = 0;
+
+#define PROFILE_TIME() hal_time_us()
+#define PROFILE_RECORD(stage, us) latency_record(&stage_latency[stage], (uint32_t)(us))
+#else
+#define PROFILE_TIME() 0
+#define PROFILE_RECORD(stage, us) ((void)(us))
+#endif
+
+#if BUS_PROFILE
+// Memory the frame ring is in, striped it is spread evenly so one bank stands for all four
+#if FRAME_SRAM == SRAM_BANKED
+#define BUS_FRAME_REGION HAL_BUS_SRAM2
+#else
+#define BUS_FRAME_REGION HAL_BUS_SRAM0
+#endif
+// Memory the AES tables are read from
+#if AES_SRAM == SRAM_FLASH
+#define BUS_TABLE_REGION HAL_BUS_XIP
+#elif AES_SRAM == SRAM_SCRATCH_X
+#define BUS_TABLE_REGION HAL_BUS_SRAM4
+#elif AES_SRAM == SRAM_SCRATCH_Y
+#define BUS_TABLE_REGION HAL_BUS_SRAM5
+#else
+#define BUS_TABLE_REGION HAL_BUS_SRAM1
+#endif
+static const char *bus_region_names[HAL_BUS_REGIONS] = {
+    "SRAM0", "SRAM1", "SRAM2", "SRAM3", "SRAM4", "SRAM5", "XIP"
+};
+// Totals over every encryption since streamer_init(), core 0 only
+static struct hal_bus_count bus_counts[2];
+static struct hal_cache_count cache_counts;
+static uint64_t bus_cycles = 0;
+static uint64_t bus_bytes = 0;
+static uint32_t bus_start = 0;
+// Encryption cycles of the frame being sent, then summed per frame, apart for the frames sent
+// right after emptying the XIP cache (one every STATS_INTERVAL) where code and tables in flash all miss
+static uint32_t frame_cycles = 0;
+static bool frame_cold = false;
+static uint64_t warm_cycles = 0;
+static uint32_t warm_frames = 0;
+static uint64_t cold_cycles = 0;
+static uint32_t cold_frames = 0;
+#define BUS_BEGIN() bus_begin()
+#define BUS_END(bytes) bus_end(bytes)
+#define BUS_FRAME_BEGIN() bus_frame_begin()
+#define BUS_FRAME_END() bus_frame_end()
+
+static void bus_begin() {
+    hal_bus_count_clear();
+    bus_start = hal_cycles();
+}
+
+static void bus_end(uint32_t bytes) {
+    uint32_t cycles = (hal_cycles() - bus_start) & HAL_CYCLES_MASK;
+    bus_cycles += cycles;
+    frame_cycles += cycles;
+    hal_bus_count_add(bus_counts);
+    hal_cache_count_add(&cache_counts);
+    bus_bytes += bytes;
+}
+
+static void bus_frame_begin() {
+    frame_cycles = 0;
+    frame_cold = (warm_frames + cold_frames) % STATS_INTERVAL == STATS_INTERVAL - 1;
+    if(frame_cold) {
+        hal_cache_flush();
+    }
+}
+
+static void bus_frame_end() {
+    if(frame_cold) {
+        cold_cycles += frame_cycles;
+        cold_frames++;
+    } else {
+        warm_cycles += frame_cycles;
+        warm_frames++;
+    }
+}
+
+// Cycles per encrypted byte and per frame, the share of accesses that stalled behind another
+// master and how often the XIP cache hit
+static void print_bus() {
+    if(!bus_bytes) {
+        return;
+    }
+    printf("Encrypt %lu.%02lu cycles/byte, %lu cycles per frame", (unsigned long)(bus_cycles / bus_bytes),
+        (unsigned long)(bus_cycles * 100 / bus_bytes % 100),
+        warm_frames ? (unsigned long)(warm_cycles / warm_frames) : 0ul);
+    if(cold_frames) {
+        printf(", %lu after an XIP cache flush", (unsigned long)(cold_cycles / cold_frames));
+    }
+    printf("\n");
+    static const uint8_t regions[2] = { BUS_FRAME_REGION, BUS_TABLE_REGION };
+    bool counted = false;
+    for(int i = 0; i < 2; i++) {
+        const struct hal_bus_count *c = &bus_counts[i];
+        // Nothing is counted where there is no bus fabric
+        if(!c->accesses) {
+            continue;
+        }
+        printf("%s%s %s %llu accesses %llu.%02llu%% contested", counted ? ", " : "While encrypting: ",
+            i == 0 ? "frames" : "tables", bus_region_names[regions[i]], (unsigned long long)c->accesses,
+            (unsigned long long)c->contested * 100 / c->accesses,
+            (unsigned long long)c->contested * 10000 / c->accesses % 100);
+        counted = true;
+    }
+    if(cache_counts.accesses) {
+        printf("%sXIP cache %llu lookups %llu.%02llu%% hits", counted ? ", " : "While encrypting: ",
+            (unsigned long long)cache_counts.accesses,
+            (unsigned long long)cache_counts.hits * 100 / cache_counts.accesses,
+            (unsigned long long)cache_counts.hits * 10000 / cache_counts.accesses % 100);
+        counted = true;
+    }
+    if(counted) {
+        printf("\n");
+    }
+}
+#else
+#define BUS_BEGIN()
+#define BUS_END(bytes) ((void)(bytes))
+#define BUS_FRAME_BEGIN()
+#define BUS_FRAME_END()
+#endif
+
+void streamer_set_fec_group(uint16_t group) {
+#if STREAM_FEC
+    fec_group = group;
+#else
+    (void)group;
+#endif
+}
+
+#if RETRANSMIT_FRAMES
+// Only queues the NACK, it is served from the send loop
+static void nack_received(const uint8_t *data, uint16_t len) {
+    uint32_t head = nack_head;
+    if(head - __atomic_load_n(&nack_tail, __ATOMIC_ACQUIRE) == RETRANSMIT_NACKS) {
+        nacks_missed++;
+        return;
+    }
+    if(stream_nack_read(data, len, &nacks[head % RETRANSMIT_NACKS]) &&
+        nacks[head % RETRANSMIT_NACKS].stream_id == STREAM_ID) {
+        __atomic_store_n(&nack_head, head + 1, __ATOMIC_RELEASE);
+    }
+}
+#endif
+
+#if RETRANSMIT_FRAMES || RATE_CONTROL
+// Datagrams the receiver sends back, NACKs and loss reports. Called by the network stack on core 0.
+static void feedback_received(const uint8_t *data, uint16_t len) {
+#if RATE_CONTROL
+    struct stream_report report;
+    if(stream_report_read(data, len, &report)) {
+        if(report.stream_id == STREAM_ID) {
+            rate_loss = report.loss_permille;
+        }
+        return;
+    }
+#endif
+#if RETRANSMIT_FRAMES
+    nack_received(data, len);
+#endif
+}
+#endif
+
+void streamer_set_rate_control(bool enabled) {
+#if RATE_CONTROL
+    rate_enabled = enabled;
+    if(!enabled) {
+        rate_control_init(&rate, RATE_START_MODE, RATE_START_MODE);
+        camera_interval_us = 0;
+        camera_mode = RATE_START_MODE;
+    }
+#else
+    (void)enabled;
+#endif
+}
+
+void streamer_set_pacing(bool enabled, uint32_t rate, uint32_t burst) {
+#if SEND_PACING
+    pacing_rate = rate;
+    pacing_burst = burst;
+    pacing_enabled = enabled;
+#else
+    (void)enabled;
+    (void)rate;
+    (void)burst;
+#endif
+}
+
+void streamer_rate_state(uint8_t *mode, uint32_t *frame_interval_us) {
+#if RATE_CONTROL
+    *mode = camera_mode;
+    *frame_interval_us = camera_interval_us;
+#else
+    *mode = RATE_START_MODE;
+    *frame_interval_us = 0;
+#endif
+}
+
+void streamer_set_retransmit(uint8_t window, uint32_t deadline_us) {
+#if RETRANSMIT_FRAMES
+    retransmit_window = window < RETRANSMIT_FRAMES ? window : RETRANSMIT_FRAMES;
+    retransmit_deadline_us = deadline_us;
+#else
+    (void)window;
+    (void)deadline_us;
+#endif
+}
+
+// Static and heap RAM, then every fixed network buffer pool with its high water mark and failed allocations
+static void print_memory() {
+    struct hal_mem_usage usage;
+    hal_mem_usage(&usage);
+    printf("RAM static %lu B (frame ring %lu B), heap peak %lu B in use %lu B\n",
+        (unsigned long)usage.static_bytes, (unsigned long)sizeof(frame_buffers), (unsigned long)usage.heap_peak,
+        (unsigned long)usage.heap_in_use);
+    if(usage.ram_bytes) {
+        printf("RAM free %lu of %lu B\n", (unsigned long)(usage.ram_bytes - usage.static_bytes - usage.heap_peak),
+            (unsigned long)usage.ram_bytes);
+    }
+    struct hal_pool_stats pools[4];
+    uint32_t count = hal_pool_stats(pools, 4);
+    for(uint32_t i = 0; i < count; i++) {
+        printf("Pool %s %u x %lu B, in use %u peak %u, failed %lu\n", pools[i].name, pools[i].count,
+            (unsigned long)pools[i].block_size, pools[i].in_use, pools[i].peak, (unsigned long)pools[i].failures);
+    }
+}
+
+void streamer_init(const uint8_t *key, const uint8_t *stream_iv) {
+    frame_queue_init(&frames, frame_buffers[0], BUFFER_SIZE, FRAME_POLICY);
+#if BUS_PROFILE
+    hal_bus_count_select(BUS_FRAME_REGION, BUS_TABLE_REGION);
+#endif
+#if ENCRYPT_MODE == ENCRYPT_CBC || ENCRYPT_MODE == ENCRYPT_CTR
+    memcpy(iv, stream_iv, AES_BLOCKLEN);
+    AES_init_ctx_iv(&ctx, key, iv);
+#if CTR_KEYSTREAM
+    keystream_init(&keystream, keystream_buffers[0], FRAME_SIZE, key, iv, 1);
+#endif
+#elif ENCRYPT_MODE == ENCRYPT_AEAD
+    memcpy(aead_key, key, CHACHA20_KEYLEN);
+    session = hal_random32();
+    (void)stream_iv;
+#else
+    (void)key;
+    (void)stream_iv;
+#endif
+#if RATE_CONTROL
+    rate_control_init(&rate, RATE_START_MODE, RATE_START_MODE);
+    rate_start_us = hal_time_us();
+#endif
+#if RETRANSMIT_FRAMES || RATE_CONTROL
+    hal_udp_set_recv(feedback_received);
+#endif
+#if SEND_PACING
+    pacer_init(&pacer, 0, SEND_PACING_BURST, hal_time_us());
+#endif
+    print_memory();
+}
+
+#if ENCRYPT_MODE == ENCRYPT_CTR
+/**
+ * Sets the CTR counter block for one fragment
+ * Layout: IV[0..7] | frame id (32 bit BE) | fragment index (16 bit BE) | block counter (16 bit BE)
+ * A fragment is at most FRAME_SIZE / AES_BLOCK blocks so the block counter never carries
+ * into the fragment index.
+ */
+static void SRAM_FUNC(SEND_CODE_SRAM, set_fragment_counter)(struct AES_ctx *ctx, uint32_t id, uint32_t frag) {
+    uint8_t counter[AES_BLOCKLEN];
+    stream_ctr_counter(counter, iv, id, frag);
+    AES_ctx_set_iv(ctx, counter);
+}
+#endif
+
+#if ENCRYPT_MODE == ENCRYPT_AEAD
+/**
+ * Writes the auth block of a fragment after its header
+ * @param prefix Header already written by stream_header_write(), with STREAM_AUTH_SIZE bytes of room after it
+ * @param encrypt true to encrypt "buf" in place first, false for a fragment that already is
+ */
+static void SRAM_FUNC(SEND_CODE_SRAM, seal_fragment)(uint8_t *prefix, const struct stream_header *h, uint8_t *buf, uint16_t len, bool encrypt) {
+    uint8_t nonce[CHACHA20_NONCELEN];
+    uint8_t aad[STREAM_HEADER_SIZE];
+    stream_auth_nonce(nonce, session, h);
+    stream_auth_aad(aad, prefix);
+    stream_put32(&prefix[STREAM_HEADER_SIZE], session);
+    uint8_t *tag = &prefix[STREAM_HEADER_SIZE + 4];
+    if(encrypt) {
+        chacha20poly1305_encrypt(aead_key, nonce, aad, sizeof(aad), buf, len, tag);
+    } else {
+        chacha20poly1305_tag(aead_key, nonce, aad, sizeof(aad), buf, len, tag);
+    }
+}
+#endif
+
+#if SEND_PACING
+/**
+ * Sets the pacer up for the frame in "slot" before its first datagram
+ * @param wire_len Bytes the frame takes on the wire, stream headers and parity included
+ */
+static void pace_frame(const struct frame_slot *slot, uint32_t wire_len) {
+    // Frames skipped as stale were captured too, they count into the interval
+    uint32_t stale = frames.dropped_stale;
+    if(last_capture_us) {
+        uint32_t interval = (slot->time_us - last_capture_us) / (1 + stale - last_stale);
+        capture_interval_us = capture_interval_us ? capture_interval_us - capture_interval_us / 8 + interval / 8 : interval;
+    }
+    last_capture_us = slot->time_us;
+    last_stale = stale;
+
+    uint32_t rate = pacing_rate;
+    if(!pacing_enabled) {
+        rate = 0;
+    } else if(!rate && capture_interval_us) {
+        rate = (uint64_t)wire_len * 1000000 * 5 / 4 / capture_interval_us;
+    }
+    pacer_set_rate(&pacer, rate, pacing_burst, hal_time_us());
+}
+#endif
+
+/**
+ * Sends one datagram once the pacer lets it through, the network stack is served while it waits
+ * Same parameters and result as hal_udp_send()
+ */
+static int SRAM_FUNC(SEND_CODE_SRAM, paced_send)(const uint8_t *header, uint16_t header_len, const uint8_t *payload, uint16_t len, struct hal_udp_pin *pin) {
+#if SEND_PACING
+    uint64_t now = hal_time_us();
+    uint64_t at = pacer_next_us(&pacer, header_len + len, now);
+    if(at > now) {
+        hal_net_wait_until(at);
+        uint64_t woke = hal_time_us();
+        paced_wait_us += woke - now;
+        now = woke;
+    }
+    pacer_take(&pacer, header_len + len, now);
+#endif
+    return hal_udp_send(header, header_len, payload, len, pin);
+}
+
+#if FRAME_CHECK
+/**
+ * Puts the CRC of the frame in "slot" in "header" once core 1 has read and checked all of it,
+ * with CUT_THROUGH the fragments sent before that go without
+ */
+static inline void take_frame_crc(const struct frame_slot *slot, struct stream_header *header) {
+    if(!(header->flags & STREAM_FLAG_CRC) && frame_slot_ready(slot) == slot->len) {
+        header->frame_crc = slot->crc;
+        header->flags |= STREAM_FLAG_CRC;
+    }
+}
+#endif
+
+/**
+ * Encrypts the frame in "slot" and sends it over UDP split into FRAME_SIZE fragments
+ * Each fragment starts with a stream header (see stream_header.h) carrying the frame id,
+ * the fragment index and count, the frame length and the capture time, so the client can
+ * put the fragments back in place as they arrive and knows straight away what is missing.
+ * To see an example udp_server.py outputs this data into the console
+ * With ZERO_COPY the payload of each fragment is not copied, "pin" tracks the datagrams
+ * still pointing into the slot and it must not be reused until hal_udp_unpin() returns.
+ * With CUT_THROUGH each fragment is sent as soon as core 1 has read it from the camera,
+ * and sending stops if core 1 finds the frame corrupt before its last fragment.
+ * @param sent_header Set to the header the data fragments were sent with
+ * @returns false if any fragment could not be sent
+ */
+static bool SRAM_FUNC(SEND_CODE_SRAM, send_frame)(struct AES_ctx *ctx, struct frame_slot *slot, uint32_t id, struct hal_udp_pin *pin,
+    struct stream_header *sent_header) {
+    uint8_t *buf = slot->buf;
+    uint32_t len = slot->len;
+    // Time spent per stage on this frame, only kept with PIPELINE_PROFILE
+    uint64_t encrypt_us = 0;
+    uint64_t send_us = 0;
+    uint64_t wait_us = 0;
+    uint64_t t;
+#if ENCRYPT_MODE == ENCRYPT_NONE || ENCRYPT_MODE == ENCRYPT_AEAD
+    (void)ctx;
+#endif
+    BUS_FRAME_BEGIN();
+#if ENCRYPT_MODE == ENCRYPT_CBC
+    // The whole image is encrypted all in one go and then split into chunks,
+    // the receiver has to put every fragment back in order before decrypting
+    t = PROFILE_TIME();
+    len += pkcs7_padding_pad_buffer(buf, len, BUFFER_SIZE, AES_BLOCK);
+    PROFILE_RECORD(STAGE_PADDING, PROFILE_TIME() - t);
+    t = PROFILE_TIME();
+    BUS_BEGIN();
+    AES_CBC_encrypt_buffer(ctx, buf, len);
+    BUS_END(len);
+    encrypt_us = PROFILE_TIME() - t;
+#endif
+
+    uint64_t copied_before = hal_udp_bytes_copied();
+    bool sent = true;
+    uint64_t fragment_start = PROFILE_TIME();
+
+    // Breaks image into fragements to avoid IP fragmentation
+    uint32_t num_frags = (len + FRAME_SIZE - 1) / FRAME_SIZE;
+#if STREAM_FEC
+    uint16_t group = fec_group;
+#else
+    const uint16_t group = 0;
+#endif
+    struct stream_header header = {
+        .flags = MODE_FLAGS,
+        .frame_id = id,
+        .frame_len = len,
+        .fragment_count = num_frags,
+        .fragment_size = FRAME_SIZE,
+        .timestamp_us = slot->time_us,
+        .stream_id = STREAM_ID,
+        .fec_group = group
+    };
+    *sent_header = header;
+#if FRAME_CHECK
+    frame_crc_from = num_frags;
+#endif
+    uint8_t header_bytes[STREAM_HEADER_SIZE + AUTH_SIZE];
+#if SEND_PACING
+    uint32_t wire_len = len + num_frags * sizeof(header_bytes);
+    pace_frame(slot, group ? wire_len + wire_len / group : wire_len);
+#endif
+    for(uint32_t i = 0; i < num_frags; i++) {
+        uint32_t offset = i * FRAME_SIZE;
+        uint16_t frag_len = (len - offset < FRAME_SIZE) ? len - offset : FRAME_SIZE;
+
+#if CUT_THROUGH
+        // Waits for core 1 to finish reading this fragment from the camera
+        t = PROFILE_TIME();
+        while(frame_slot_ready(slot) < offset + frag_len) {
+            hal_net_poll();
+#if EVENT_WAITS
+            // Core 1 rings when more of the frame is in
+            if(frame_slot_ready(slot) < offset + frag_len) {
+                hal_core_wait(hal_time_us() + CORE_WAIT_US);
+            }
+#endif
+        }
+        wait_us += PROFILE_TIME() - t;
+#endif
+#if FRAME_CHECK
+        if(frame_slot_ready(slot) == FRAME_SLOT_CORRUPT) {
+            // Core 1 gave up on the frame, its last fragment never goes out
+            break;
+        }
+        take_frame_crc(slot, &header);
+        if((header.flags & STREAM_FLAG_CRC) && frame_crc_from == num_frags) {
+            frame_crc_from = i;
+        }
+#endif
+
+#if STREAM_FEC
+        if(group) {
+            // Parity is taken over what the receiver keeps before the final decryption,
+            // the plaintext with CTR and AEAD, the ciphertext with CBC
+            if(i % group == 0) {
+                memset(fec_parity, 0, FRAME_SIZE);
+            }
+            fec_xor(fec_parity, &buf[offset], frag_len);
+        }
+#endif
+
+#if ENCRYPT_MODE == ENCRYPT_CTR
+        // Encrypted just before it is sent, no need to wait for the rest of the frame
+        t = PROFILE_TIME();
+        BUS_BEGIN();
+#if CTR_KEYSTREAM
+        // Core 1 has most likely worked out this fragment's keystream already
+        const uint8_t *keys = keystream_take(&keystream, id, i);
+        if(keys) {
+            fec_xor(&buf[offset], keys, frag_len);
+            keystream_release(&keystream);
+        } else {
+            set_fragment_counter(ctx, id, i);
+            AES_CTR_xcrypt_buffer(ctx, &buf[offset], frag_len);
+        }
+#else
+        set_fragment_counter(ctx, id, i);
+        AES_CTR_xcrypt_buffer(ctx, &buf[offset], frag_len);
+#endif
+        BUS_END(frag_len);
+        encrypt_us += PROFILE_TIME() - t;
+#endif
+
+        header.fragment = i;
+        if(i == num_frags - 1) {
+            header.flags |= STREAM_FLAG_LAST;
+        }
+        stream_header_write(header_bytes, &header);
+#if ENCRYPT_MODE == ENCRYPT_AEAD
+        t = PROFILE_TIME();
+        BUS_BEGIN();
+        seal_fragment(header_bytes, &header, &buf[offset], frag_len, true);
+        BUS_END(frag_len);
+        encrypt_us += PROFILE_TIME() - t;
+#endif
+
+        t = PROFILE_TIME();
+        int err = paced_send(header_bytes, sizeof(header_bytes), &buf[offset], frag_len, pin);
+        send_us += PROFILE_TIME() - t;
+        if(err) {
+            trace_record(TRACE_SEND_ERROR, err);
+            sent = false;
+        }
+
+#if STREAM_FEC
+        if(group && ((i + 1) % group == 0 || i == num_frags - 1)) {
+            // Parity is as long as the group's first fragment, the longest one
+            uint32_t first = i - i % group;
+            uint16_t parity_len = (len - first * FRAME_SIZE < FRAME_SIZE) ? len - first * FRAME_SIZE : FRAME_SIZE;
+            struct stream_header parity = header;
+            parity.flags = MODE_FLAGS | STREAM_FLAG_PARITY | (header.flags & STREAM_FLAG_CRC);
+            parity.fragment = i / group;
+#if ENCRYPT_MODE == ENCRYPT_CTR
+            t = PROFILE_TIME();
+            BUS_BEGIN();
+            set_fragment_counter(ctx, id, FEC_PARITY_COUNTER | parity.fragment);
+            AES_CTR_xcrypt_buffer(ctx, fec_parity, parity_len);
+            BUS_END(parity_len);
+            encrypt_us += PROFILE_TIME() - t;
+#endif
+            stream_header_write(header_bytes, &parity);
+#if ENCRYPT_MODE == ENCRYPT_AEAD
+            t = PROFILE_TIME();
+            BUS_BEGIN();
+            seal_fragment(header_bytes, &parity, fec_parity, parity_len, true);
+            BUS_END(parity_len);
+            encrypt_us += PROFILE_TIME() - t;
+#endif
+            t = PROFILE_TIME();
+            // Copied, fec_parity is reused for the next group straight away
+            err = paced_send(header_bytes, sizeof(header_bytes), fec_parity, parity_len, NULL);
+            send_us += PROFILE_TIME() - t;
+            if(err) {
+                trace_record(TRACE_SEND_ERROR, err);
+                sent = false;
+            }
+        }
+#endif
+        hal_watchdog_update();
+    }
+    frame_bytes_copied = hal_udp_bytes_copied() - copied_before;
+#if FRAME_CHECK
+    // Resent fragments from frame_crc_from on carry it, the ones before go out as they did the first time
+    sent_header->flags |= header.flags & STREAM_FLAG_CRC;
+    sent_header->frame_crc = header.frame_crc;
+#endif
+#if CTR_KEYSTREAM
+    keystream_frame_done(&keystream, id, num_frags);
+#endif
+
+    // Whatever the loop spent outside of encryption, sending and waiting for the camera is fragmentation
+    uint64_t loop_us = PROFILE_TIME() - fragment_start;
+#if ENCRYPT_MODE != ENCRYPT_CBC
+    PROFILE_RECORD(STAGE_FRAGMENT, loop_us - encrypt_us - send_us - wait_us);
+#else
+    PROFILE_RECORD(STAGE_FRAGMENT, loop_us - send_us - wait_us);
+#endif
+    PROFILE_RECORD(STAGE_ENCRYPT, encrypt_us);
+    PROFILE_RECORD(STAGE_SEND, send_us);
+    BUS_FRAME_END();
+#if PIPELINE_PROFILE
+    profile_frames++;
+    profile_bytes += len;
+#endif
+    return sent;
+}
+
+#if RETRANSMIT_FRAMES
+/**
+ * Sends the fragments of "f" asked for by "nack" again, from the ciphertext still in its slot
+ * They are copied, the slot can be given back to core 1 while the network stack still holds them.
+ */
+static void resend_fragments(const struct sent_frame *f, const struct stream_nack *nack) {
+    struct stream_header header = f->header;
+    uint8_t header_bytes[STREAM_HEADER_SIZE + AUTH_SIZE];
+    uint32_t resent = 0;
+    for(uint32_t bit = 0; bit < nack->bitmap_len * 8u; bit++) {
+        uint32_t i = nack->first + bit;
+        if(i >= header.fragment_count) {
+            break;
+        }
+        if(!(nack->bitmap[bit / 8] & (1 << (bit % 8)))) {
+            continue;
+        }
+        uint32_t offset = i * FRAME_SIZE;
+        uint16_t frag_len = (header.frame_len - offset < FRAME_SIZE) ? header.frame_len - offset : FRAME_SIZE;
+        header.fragment = i;
+        header.flags = f->header.flags | STREAM_FLAG_RETRANSMIT | (i == header.fragment_count - 1u ? STREAM_FLAG_LAST : 0);
+#if FRAME_CHECK
+        if(i < f->crc_from) {
+            // The exact header of the first time: with AEAD a different one under the same nonce
+            // would give away the Poly1305 key
+            header.flags &= ~STREAM_FLAG_CRC;
+            header.frame_crc = 0;
+        } else {
+            header.frame_crc = f->header.frame_crc;
+        }
+#endif
+        stream_header_write(header_bytes, &header);
+#if ENCRYPT_MODE == ENCRYPT_AEAD
+        // Still encrypted in the slot, only the tag has to be worked out again
+        seal_fragment(header_bytes, &header, &f->slot->buf[offset], frag_len, false);
+#endif
+        int err = paced_send(header_bytes, sizeof(header_bytes), &f->slot->buf[offset], frag_len, NULL);
+        if(err) {
+            trace_record(TRACE_SEND_ERROR, err);
+            break;
+        }
+        resent++;
+    }
+    fragments_resent += resent;
+    trace_record(TRACE_RETRANSMIT, resent);
+}
+
+static void release_oldest_sent() {
+    sent_first = (sent_first + 1) % RETRANSMIT_FRAMES;
+    sent_count--;
+    frame_queue_release_kept(&frames);
+    hal_core_notify();
+}
+
+/**
+ * Keeps the frame just sent from "slot" for retransmission, or gives the slot straight back
+ */
+static void keep_sent(struct frame_slot *slot, const struct stream_header *header) {
+    uint8_t window = retransmit_window;
+    while(sent_count && sent_count >= window) {
+        release_oldest_sent();
+    }
+    if(window == 0) {
+        frame_queue_release(&frames);
+        return;
+    }
+    struct sent_frame *f = &sent_frames[(sent_first + sent_count) % RETRANSMIT_FRAMES];
+    f->slot = slot;
+    f->header = *header;
+#if FRAME_CHECK
+    f->crc_from = frame_crc_from;
+#endif
+    f->deadline_us = hal_time_us() + retransmit_deadline_us;
+    sent_count++;
+    frame_queue_keep(&frames);
+}
+
+/**
+ * Serves the queued NACKs and gives back kept frames that are past their deadline
+ * Runs between frames on core 0.
+ */
+static void retransmit_poll() {
+    uint32_t tail = nack_tail;
+    while(tail != __atomic_load_n(&nack_head, __ATOMIC_ACQUIRE)) {
+        const struct stream_nack *nack = &nacks[tail % RETRANSMIT_NACKS];
+        nacks_received++;
+        const struct sent_frame *found = NULL;
+        for(uint32_t i = 0; i < sent_count; i++) {
+            const struct sent_frame *f = &sent_frames[(sent_first + i) % RETRANSMIT_FRAMES];
+            if(f->header.frame_id == nack->frame_id) {
+                found = f;
+                break;
+            }
+        }
+        if(found) {
+            resend_fragments(found, nack);
+        } else {
+            nacks_missed++;
+        }
+        tail++;
+        __atomic_store_n(&nack_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    // New frames come first: while the camera waits for a slot the oldest kept frame goes
+    uint64_t now = hal_time_us();
+    while(sent_count && (sent_count > retransmit_window || now >= sent_frames[sent_first].deadline_us ||
+        __atomic_load_n(&frames.producer_waiting, __ATOMIC_RELAXED))) {
+        release_oldest_sent();
+    }
+}
+#endif
+
+#if RATE_CONTROL
+/**
+ * Feeds the rate controller every RATE_INTERVAL_US and hands its decision to core 1
+ * @param id Frames sent so far
+ */
+static void rate_poll(uint32_t id) {
+    uint64_t now = hal_time_us();
+    if(now - rate_start_us < RATE_INTERVAL_US) {
+        return;
+    }
+    // "full" is written by core 1, a count that is one behind only moves it to the next interval
+    uint32_t stale = frames.dropped_stale;
+    uint32_t full = __atomic_load_n(&frames.full, __ATOMIC_RELAXED);
+    uint32_t send = frames.dropped_send;
+    struct rate_signals s = {
+        .interval_us = now - rate_start_us,
+        .frames_sent = id - rate_start_id,
+        .backlog = (stale - rate_start_stale) + (full - rate_start_full),
+        .send_errors = send - rate_start_send,
+        .loss_permille = rate_loss
+    };
+    rate_loss = RATE_NO_REPORT;
+    rate_start_us = now;
+    rate_start_id = id;
+    rate_start_stale = stale;
+    rate_start_full = full;
+    rate_start_send = send;
+
+    if(rate_enabled && rate_control_update(&rate, &s)) {
+        camera_interval_us = rate.frame_interval_us;
+        camera_mode = rate.mode;
+        uint32_t interval_ms = rate.frame_interval_us / 1000;
+        trace_record(TRACE_RATE_CHANGE, rate.mode << 12 | (interval_ms < 0xFFF ? interval_ms : 0xFFF));
+        printf("Rate control: mode %u, frame interval %lu us\n", rate.mode, (unsigned long)rate.frame_interval_us);
+    }
+}
+#endif
+
+// Share of the time since the last call each core spent asleep in the HAL's wait functions
+static void print_idle() {
+    static uint64_t last_us = 0;
+    static uint64_t last_idle[2] = { 0, 0 };
+    uint64_t now = hal_time_us();
+    uint64_t idle[2] = { hal_core_idle_us(0), hal_core_idle_us(1) };
+    if(last_us) {
+        uint64_t span = now - last_us;
+        printf("Idle core 0 %lu%%, core 1 %lu%%\n", (unsigned long)((idle[0] - last_idle[0]) * 100 / span),
+            (unsigned long)((idle[1] - last_idle[1]) * 100 / span));
+    }
+    last_us = now;
+    last_idle[0] = idle[0];
+    last_idle[1] = idle[1];
+}
+
+// Prints how many bytes were copied into network buffers and how many frames were dropped, every STATS_INTERVAL frames
+static void print_stats(uint32_t id) {
+    if(id % STATS_INTERVAL == 0) {
+        printf("Copied %lu bytes last frame, %llu bytes average\n",
+            (unsigned long)frame_bytes_copied, (unsigned long long)(hal_udp_bytes_copied() / id));
+        printf("Ring full %lu, dropped capture %lu corrupt %lu stale %lu send %lu\n",
+            (unsigned long)frames.full, (unsigned long)frames.dropped_capture, (unsigned long)frames.dropped_corrupt,
+            (unsigned long)frames.dropped_stale, (unsigned long)frames.dropped_send);
+#if RETRANSMIT_FRAMES
+        printf("NACKs %lu, missed %lu, fragments resent %lu\n", (unsigned long)nacks_received,
+            (unsigned long)nacks_missed, (unsigned long)fragments_resent);
+#endif
+#if CTR_KEYSTREAM
+        printf("Keystream fragments used %lu, encrypted on core 0 %lu, unused %lu\n", (unsigned long)keystream.used,
+            (unsigned long)keystream.missed, (unsigned long)keystream.skipped);
+#endif
+        print_idle();
+        print_memory();
+#if BUS_PROFILE
+        print_bus();
+#endif
+#if SEND_PACING
+        if(pacer.rate) {
+            printf("Paced at %lu B/s, waited %lu us per frame\n", (unsigned long)pacer.rate,
+                (unsigned long)(paced_wait_us / STATS_INTERVAL));
+        }
+        paced_wait_us = 0;
+#endif
+    }
+}
+
+#if FRAME_CHECK
+// Frames that failed their checks in a row, core 1 only
+static uint32_t corrupt_run = 0;
+
+/**
+ * Checks the end of the frame just read into "slot" and sets its CRC
+ * @param started Whether the frame started with SOI, with CUT_THROUGH core 0 may have
+ *                encrypted the start in place by now
+ * @returns false if the frame is corrupt, it is counted and traced
+ */
+static bool check_frame(struct frame_slot *slot, uint32_t len, bool started) {
+    if(started && frame_check_end(slot->buf, len)) {
+        slot->crc = load_image_crc();
+        corrupt_run = 0;
+        return true;
+    }
+    trace_record(TRACE_FRAME_CORRUPT, len);
+    frames.dropped_corrupt++;
+    corrupt_run++;
+    return false;
+}
+#endif
+
+void camera_poll() {
+    uint32_t temp_len = 0;
+    uint32_t frames_read = 0;
+    bool waiting = false;
+#if RATE_CONTROL
+    // What the camera is set to now
+    uint8_t applied_mode = RATE_START_MODE;
+    uint32_t applied_interval = 0;
+#endif
+#if CAMERA_DMA
+    camera_dma_init();
+#endif
+    while(true) {
+#if RATE_CONTROL
+        // Between frames, nothing is being read from the camera
+        if(camera_mode != applied_mode) {
+            applied_mode = camera_mode;
+            camera_set_mode(rate_modes[applied_mode].resolution, rate_modes[applied_mode].quality);
+        }
+        if(camera_interval_us != applied_interval) {
+            applied_interval = camera_interval_us;
+            camera_set_frame_interval(applied_interval);
+        }
+#endif
+        //Checks if a frame slot is available to load new image data
+        struct frame_slot *slot = frame_queue_write_slot(&frames);
+        if(slot) {
+            if(waiting) {
+                trace_record(TRACE_SLOT_WAIT_END, 0);
+                waiting = false;
+            }
+            trace_record(TRACE_CAPTURE_BEGIN, 0);
+            temp_len = camera_take_picture();
+            trace_record(TRACE_CAPTURE_END, temp_len);
+            slot->time_us = hal_time_us();
+            if(temp_len < frames.slot_size - PADDING_SIZE) {
+                trace_record(TRACE_READOUT_BEGIN, temp_len);
+#if CUT_THROUGH
+                // Frame is handed to core 0 before it is read, the length is already known from the camera
+                // and core 0 follows the readout through the slot's ready count
+                load_image_start(slot->buf, temp_len);
+                frame_queue_publish_partial(&frames, temp_len);
+                hal_core_notify();
+                uint32_t ready = 0;
+#if FRAME_CHECK
+                // Nothing goes to core 0 before the frame is seen to start with SOI, and the
+                // bytes that may hold EOI only once the whole frame has been checked
+                bool corrupt = false;
+                uint32_t tail = temp_len > FRAME_CHECK_TAIL + 2 ? temp_len - FRAME_CHECK_TAIL - 2 : 0;
+#endif
+                while(ready < temp_len) {
+                    uint32_t progress = load_image_progress();
+                    if(progress == ready) {
+                        // The DMA reads the camera meanwhile
+                        if(KEYSTREAM_FILL()) {
+                            continue;
+                        }
+#if EVENT_WAITS
+                        // Woken by the DMA interrupt at the end of each chunk
+                        hal_core_wait(hal_time_us() + CORE_WAIT_US);
+#endif
+                        continue;
+                    }
+#if FRAME_CHECK
+                    if(ready == 0) {
+                        // First chunk, checked before core 0 can encrypt it in place
+                        corrupt = !frame_check_start(slot->buf, progress);
+                    }
+                    ready = progress;
+                    if(corrupt || ready > tail) {
+                        continue;
+                    }
+#else
+                    ready = progress;
+#endif
+                    frame_queue_set_ready(&frames, ready);
+                    hal_core_notify();
+                }
+                load_image_finish();
+#if FRAME_CHECK
+                bool good = check_frame(slot, temp_len, !corrupt);
+                frame_queue_set_ready(&frames, good ? temp_len : FRAME_SLOT_CORRUPT);
+                hal_core_notify();
+#endif
+#else
+                load_image(slot->buf, temp_len);
+#if FRAME_CHECK
+                // A corrupt frame is never queued, the slot is used again for the next capture
+                bool good = check_frame(slot, temp_len, frame_check_start(slot->buf, temp_len));
+                if(good) {
+                    frame_queue_publish(&frames, temp_len);
+                    hal_core_notify();
+                }
+#else
+                frame_queue_publish(&frames, temp_len);
+                hal_core_notify();
+#endif
+#endif
+                trace_record(TRACE_READOUT_END, temp_len);
+                PROFILE_RECORD(STAGE_CAPTURE, camera_last_timing()->capture_us);
+                PROFILE_RECORD(STAGE_READOUT, camera_last_timing()->readout_us);
+                hal_watchdog_update();
+                if(++frames_read % STATS_INTERVAL == 0) {
+                    camera_timing_report();
+                }
+#if FRAME_CHECK
+                if(!good && corrupt_run >= FRAME_CHECK_RESETS) {
+                    // The camera keeps sending broken frames
+                    corrupt_run = 0;
+                    trace_record(TRACE_CAMERA_RESET, temp_len);
+                    camera_start();
+#if RATE_CONTROL
+                    applied_mode = RATE_START_MODE;
+                    applied_interval = 0;
+#endif
+                }
+#endif
+            } else {
+                //Resets camera(Likely error occured)
+                trace_record(TRACE_CAMERA_RESET, temp_len);
+                frames.dropped_capture++;
+                camera_start();
+#if RATE_CONTROL
+                // The reset went back to camera_start()'s mode, the next loop sets it again
+                applied_mode = RATE_START_MODE;
+                applied_interval = 0;
+#endif
+            }
+        } else {
+            // Waiting for UDP socket to send image data
+            if(!waiting) {
+                trace_record(TRACE_SLOT_WAIT_BEGIN, 0);
+                waiting = true;
+            }
+            // Keystream for the frames core 0 is about to send, only sleeps once it is all there
+            if(KEYSTREAM_FILL()) {
+                continue;
+            }
+#if EVENT_WAITS
+            // Core 0 rings when it gives a slot back
+            hal_core_wait(hal_time_us() + CORE_WAIT_US);
+#else
+            hal_sleep_us(5);
+#endif
+        }
+    }
+}
+
+void streamer_send_loop() {
+    // Keeps track of frame
+    uint32_t id = 0;
+    bool waiting = false;
+    while(true) {
+        hal_net_poll();
+#if RETRANSMIT_FRAMES
+        retransmit_poll();
+#endif
+#if RATE_CONTROL
+        rate_poll(id);
+#endif
+        //printf("UDP loop\n");
+        struct frame_slot *slot = frame_queue_read_slot(&frames);
+        if(slot) {
+            if(waiting) {
+                trace_record(TRACE_FRAME_WAIT_END, 0);
+                waiting = false;
+            }
+            id++;
+            trace_record(TRACE_SEND_BEGIN, id);
+            struct stream_header header;
+#if ZERO_COPY
+            struct hal_udp_pin *pin = &slot_pins[frame_queue_index(&frames, slot)];
+            bool sent = send_frame(STREAM_CTX, slot, id, pin, &header);
+            hal_udp_unpin(pin);
+#else
+            bool sent = send_frame(STREAM_CTX, slot, id, NULL, &header);
+#endif
+            trace_record(TRACE_SEND_END, id);
+            if(!sent) {
+                frames.dropped_send++;
+            }
+#if RETRANSMIT_FRAMES && FRAME_CHECK
+            if(frame_slot_ready(slot) == FRAME_SLOT_CORRUPT) {
+                // Not kept, none of it may be sent again
+                frame_queue_release(&frames);
+            } else {
+                keep_sent(slot, &header);
+            }
+#elif RETRANSMIT_FRAMES
+            keep_sent(slot, &header);
+#else
+            frame_queue_release(&frames);
+#endif
+            hal_core_notify();
+            print_stats(id);
+            hal_watchdog_update();
+        } else {
+            if(!waiting) {
+                trace_record(TRACE_FRAME_WAIT_BEGIN, 0);
+                waiting = true;
+            }
+#if EVENT_WAITS
+            // Core 1 rings when it publishes a frame, the network stack's interrupt wakes it too
+            hal_core_wait(hal_time_us() + CORE_WAIT_US);
+#else
+            hal_sleep_us(5);
+#endif
+        }
+        trace_poll();
+    }
+}
+
+void streamer_profile_report(uint64_t elapsed_us) {
+#if PIPELINE_PROFILE
+    static const char *names[STAGE_COUNT] = {
+        "capture", "readout", "padding", "encrypt", "fragment", "udp_send"
+    };
+    double seconds = elapsed_us / 1e6;
+    printf("%-10s %8s %9s %9s %9s %9s\n", "stage", "frames", "mean us", "p50 us", "p99 us", "max us");
+    for(int i = 0; i < STAGE_COUNT; i++) {
+        const struct latency_hist *h = &stage_latency[i];
+        if(h->count == 0) {
+            printf("%-10s %8s\n", names[i], "-");
+            continue;
+        }
+        printf("%-10s %8lu %9lu %9lu %9lu %9lu\n", names[i], (unsigned long)h->count,
+            (unsigned long)(h->sum / h->count), (unsigned long)latency_percentile(h, 50),
+            (unsigned long)latency_percentile(h, 99), (unsigned long)h->max);
+    }
+    printf("Sent %lu frames in %.1f s: %.1f fps, %.1f KB/s\n", (unsigned long)profile_frames, seconds,
+        profile_frames / seconds, profile_bytes / seconds / 1000);
+#else
+    (void)elapsed_us;
+#endif
+#if BUS_PROFILE
+    print_bus();
+#endif
+}
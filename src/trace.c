@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+#include "trace.h"
+
+#if TRACE_ENABLED
+
+#if TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)
+#error "TRACE_RING_SIZE must be a power of two"
+#endif
+
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+struct trace_ring {
+    struct trace_event events[TRACE_RING_SIZE];
+    // Free running, written by the recording core only
+    uint32_t head;
+    // Written by the draining core only
+    uint32_t tail;
+    uint32_t lost;
+};
+
+static struct trace_ring rings[2];
+static uint64_t last_flush_us = 0;
+
+// Header plus events of the batch being drained
+static uint8_t batch[sizeof(struct trace_batch_header) + TRACE_BATCH * sizeof(struct trace_event)] __attribute__((aligned(4)));
+#if TRACE_SINK == TRACE_SINK_USB
+static char hex_line[2 + 2 * sizeof(batch) + 1];
+#endif
+
+void trace_init(const char *ip) {
+    memset(rings, 0, sizeof(rings));
+#if TRACE_SINK == TRACE_SINK_UDP
+    if(!hal_trace_connect(ip, TRACE_PORT)) {
+        printf("Couldn't open the trace socket\n");
+    }
+#else
+    (void)ip;
+#endif
+}
+
+void trace_record(uint16_t id, uint16_t arg) {
+    struct trace_ring *r = &rings[hal_core_num()];
+    uint32_t head = r->head;
+    struct trace_event *e = &r->events[head & (TRACE_RING_SIZE - 1)];
+    e->time_us = (uint32_t)hal_time_us();
+    e->id = id;
+    e->arg = arg;
+    store_release(&r->head, head + 1);
+}
+
+static void send_batch(uint32_t size) {
+#if TRACE_SINK == TRACE_SINK_UDP
+    hal_trace_send(batch, size);
+#else
+    static const char digits[] = "0123456789abcdef";
+    char *out = hex_line;
+    *out++ = 'T';
+    *out++ = ':';
+    for(uint32_t i = 0; i < size; i++) {
+        *out++ = digits[batch[i] >> 4];
+        *out++ = digits[batch[i] & 15];
+    }
+    *out = '\0';
+    puts(hex_line);
+#endif
+}
+
+/**
+ * Sends up to TRACE_BATCH events of one core
+ * @returns Events still left in the ring
+ */
+static uint32_t drain_ring(uint8_t core) {
+    struct trace_ring *r = &rings[core];
+    uint32_t head = load_acquire(&r->head);
+    uint32_t tail = r->tail;
+    if(head - tail > TRACE_RING_SIZE) {
+        r->lost += head - tail - TRACE_RING_SIZE;
+        tail = head - TRACE_RING_SIZE;
+    }
+    uint32_t count = head - tail;
+    if(count > TRACE_BATCH) {
+        count = TRACE_BATCH;
+    }
+
+    struct trace_event *events = (struct trace_event*)&batch[sizeof(struct trace_batch_header)];
+    for(uint32_t i = 0; i < count; i++) {
+        events[i] = r->events[(tail + i) & (TRACE_RING_SIZE - 1)];
+    }
+    // Anything the writer lapped while it was being copied, including the slot it may be
+    // writing right now, can be torn and is dropped
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint32_t overwritten = load_acquire(&r->head) - TRACE_RING_SIZE + 1 - tail;
+    uint32_t skip = 0;
+    if((int32_t)overwritten > 0) {
+        skip = overwritten < count ? overwritten : count;
+        memmove(events, &events[skip], (count - skip) * sizeof(struct trace_event));
+        r->lost += skip;
+    }
+    r->tail = tail + count;
+
+    struct trace_batch_header *header = (struct trace_batch_header*)batch;
+    header->magic[0] = 'T';
+    header->magic[1] = 'R';
+    header->version = TRACE_VERSION;
+    header->core = core;
+    header->lost = r->lost > 0xFFFF ? 0xFFFF : r->lost;
+    header->count = count - skip;
+    r->lost = 0;
+    if(header->count || header->lost) {
+        send_batch(sizeof(struct trace_batch_header) + header->count * sizeof(struct trace_event));
+    }
+    return head - r->tail;
+}
+
+void trace_poll() {
+    uint64_t now = hal_time_us();
+    bool filling = false;
+    for(int core = 0; core < 2; core++) {
+        if(load_acquire(&rings[core].head) - rings[core].tail >= TRACE_RING_SIZE / 2) {
+            filling = true;
+        }
+    }
+    if(!filling && now - last_flush_us < TRACE_FLUSH_US) {
+        return;
+    }
+    last_flush_us = now;
+    for(uint8_t core = 0; core < 2; core++) {
+        // A core that keeps recording while it is drained can't hold this up for long,
+        // draining stops once a ring has been gone through once
+        for(uint32_t batches = 0; batches < TRACE_RING_SIZE / TRACE_BATCH; batches++) {
+            if(drain_ring(core) == 0) {
+                break;
+            }
+        }
+    }
+}
+
+#endif
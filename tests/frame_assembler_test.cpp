@@ -0,0 +1,158 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "frame_assembler.h"
+#include "frame_sink.h"
+
+/**
+ * Headers the frame assembler has to turn away without touching a slab, and valid frames
+ * around them that still have to come out intact. Built with AddressSanitizer by CMake so a
+ * write past a slab fails the test even if the counters look right.
+ */
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if(!(cond)) { \
+        printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while(0)
+
+// Keeps the last delivered frame
+class keep_sink : public frame_sink {
+public:
+    void frame(const assembled_frame &f) override {
+        last.assign(f.data, f.data + f.len);
+        last_id = f.frame_id;
+        count++;
+    }
+    std::vector<uint8_t> last;
+    uint32_t last_id = 0;
+    unsigned count = 0;
+};
+
+static const uint8_t key[STREAM_KEY_LEN] = "YOUR_KEY";
+static const uint8_t iv[AES_BLOCKLEN] = "YOUR_IV";
+
+// Plain (unencrypted) datagram with "payload_len" bytes of "payload"
+static std::vector<uint8_t> datagram(stream_header h, const uint8_t *payload, size_t payload_len) {
+    std::vector<uint8_t> d(STREAM_HEADER_SIZE + payload_len);
+    h.flags |= STREAM_FLAG_PLAIN;
+    stream_header_write(d.data(), &h);
+    memcpy(d.data() + STREAM_HEADER_SIZE, payload, payload_len);
+    return d;
+}
+
+static stream_header header(uint32_t frame_id, uint32_t frame_len, uint16_t count, uint16_t fragment_size,
+    uint16_t fragment) {
+    stream_header h = {};
+    h.frame_id = frame_id;
+    h.frame_len = frame_len;
+    h.fragment_count = count;
+    h.fragment_size = fragment_size;
+    h.fragment = fragment;
+    return h;
+}
+
+static void feed(frame_assembler &a, const std::vector<uint8_t> &d) {
+    a.datagram(d.data(), d.size());
+}
+
+// Fragment counts that don't match the frame length, the offset of a late fragment would be past its end
+static void test_fragment_count() {
+    keep_sink sink;
+    frame_assembler a(key, iv, sink, 64 * 1024, 4);
+    std::vector<uint8_t> big(1400, 0xAB);
+
+    // The forged datagram: 100 byte frame in 5 fragments, fragment 3 would start at 4200
+    feed(a, datagram(header(1, 100, 5, 1400, 3), big.data(), big.size()));
+    // Same frame with a payload that fits the first fragment
+    feed(a, datagram(header(1, 100, 5, 1400, 0), big.data(), 100));
+    // Too few fragments for the length
+    feed(a, datagram(header(2, 3000, 2, 1400, 1), big.data(), 1400));
+    // Empty frame
+    feed(a, datagram(header(3, 0, 1, 1400, 0), big.data(), 0));
+    // Zero fragment size and zero count
+    feed(a, datagram(header(4, 100, 1, 0, 0), big.data(), 100));
+    feed(a, datagram(header(5, 100, 0, 1400, 0), big.data(), 100));
+    CHECK(a.stats().malformed == 6);
+    CHECK(sink.count == 0);
+
+    // Parity of a frame with too many fragments, recover() would rebuild one past the end
+    stream_header p = header(6, 100, 5, 1400, 0);
+    p.flags = STREAM_FLAG_PARITY;
+    p.fec_group = 8;
+    feed(a, datagram(p, big.data(), 1400));
+    CHECK(a.stats().malformed == 7);
+    CHECK(sink.count == 0);
+}
+
+// Payload longer or shorter than its fragment
+static void test_payload_length() {
+    keep_sink sink;
+    frame_assembler a(key, iv, sink, 64 * 1024, 4);
+    std::vector<uint8_t> big(1500, 0xCD);
+
+    feed(a, datagram(header(1, 2000, 2, 1400, 1), big.data(), 1400));
+    feed(a, datagram(header(1, 2000, 2, 1400, 1), big.data(), 599));
+    feed(a, datagram(header(1, 2000, 2, 1400, 0), big.data(), 1500));
+    CHECK(a.stats().malformed == 3);
+    CHECK(sink.count == 0);
+}
+
+// A valid frame after the rejected ones, and one rebuilt from parity
+static void test_valid_frames() {
+    keep_sink sink;
+    frame_assembler a(key, iv, sink, 64 * 1024, 4);
+    std::vector<uint8_t> frame(3000);
+    for(size_t i = 0; i < frame.size(); i++) {
+        frame[i] = i * 7;
+    }
+
+    feed(a, datagram(header(1, 100, 5, 1400, 3), frame.data(), 1400));
+    for(uint16_t i = 0; i < 3; i++) {
+        size_t len = i < 2 ? 1400 : 200;
+        stream_header h = header(2, 3000, 3, 1400, i);
+        if(i == 2) {
+            h.flags = STREAM_FLAG_LAST;
+        }
+        feed(a, datagram(h, &frame[i * 1400], len));
+    }
+    CHECK(a.stats().malformed == 1);
+    CHECK(sink.count == 1);
+    CHECK(sink.last_id == 2);
+    CHECK(sink.last == frame);
+
+    // Group of all 3 fragments, the short last one lost
+    std::vector<uint8_t> parity(1400, 0);
+    for(size_t i = 0; i < frame.size(); i++) {
+        parity[i % 1400] ^= frame[i];
+    }
+    for(uint16_t i = 0; i < 2; i++) {
+        stream_header h = header(3, 3000, 3, 1400, i);
+        h.fec_group = 3;
+        feed(a, datagram(h, &frame[i * 1400], 1400));
+    }
+    stream_header p = header(3, 3000, 3, 1400, 0);
+    p.flags = STREAM_FLAG_PARITY;
+    p.fec_group = 3;
+    feed(a, datagram(p, parity.data(), parity.size()));
+    CHECK(a.stats().recovered == 1);
+    CHECK(sink.count == 2);
+    CHECK(sink.last_id == 3);
+    CHECK(sink.last == frame);
+}
+
+int main() {
+    test_fragment_count();
+    test_payload_length();
+    test_valid_frames();
+    if(failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("frame_assembler_test passed\n");
+    return 0;
+}
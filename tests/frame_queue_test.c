@@ -0,0 +1,205 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include "frame_queue.h"
+
+/**
+ * The frame ring between two real threads, like core 1 (producer) and core 0 (consumer).
+ * Every frame carries its sequence number and a pattern derived from it, so the consumer
+ * sees frames lost, duplicated, out of order or overwritten while it still had them.
+ * CMake builds it with ThreadSanitizer, which also fails the test on a data race.
+ */
+
+#define FRAMES 20000
+#define SLOT_SIZE 64
+// Frames the keep test holds on to, FRAME_QUEUE_SLOTS has to be at least this + 2
+#define KEPT 2
+
+#if FRAME_QUEUE_SLOTS < KEPT + 2
+#error "frame_queue_test needs FRAME_QUEUE_SLOTS of at least KEPT + 2"
+#endif
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if(!(cond)) { \
+        printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while(0)
+
+static struct frame_queue q;
+static uint8_t storage[FRAME_QUEUE_SLOTS * SLOT_SIZE];
+// Producer publishes frames in chunks with frame_queue_set_ready(), as with cut-through
+static int partial;
+
+static uint32_t frame_len(uint32_t seq) {
+    return 8 + seq % (SLOT_SIZE - 8);
+}
+
+static void fill(uint8_t *buf, uint32_t seq) {
+    memcpy(buf, &seq, 4);
+    for(uint32_t i = 4; i < frame_len(seq); i++) {
+        buf[i] = seq + i;
+    }
+}
+
+static uint32_t frame_seq(const uint8_t *buf) {
+    uint32_t seq;
+    memcpy(&seq, buf, 4);
+    return seq;
+}
+
+static int intact(const uint8_t *buf, uint32_t seq, uint32_t len) {
+    if(len != frame_len(seq) || frame_seq(buf) != seq) {
+        return 0;
+    }
+    for(uint32_t i = 4; i < len; i++) {
+        if(buf[i] != (uint8_t)(seq + i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void *producer(void *arg) {
+    (void)arg;
+    for(uint32_t seq = 0; seq < FRAMES; seq++) {
+        struct frame_slot *slot;
+        while(!(slot = frame_queue_write_slot(&q))) {
+            sched_yield();
+        }
+        if(partial) {
+            // Length first, then the data in two parts
+            uint32_t len = frame_len(seq);
+            frame_queue_publish_partial(&q, len);
+            fill(slot->buf, seq);
+            frame_queue_set_ready(&q, len / 2);
+            frame_queue_set_ready(&q, len);
+        } else {
+            fill(slot->buf, seq);
+            frame_queue_publish(&q, frame_len(seq));
+        }
+    }
+    return NULL;
+}
+
+static struct frame_slot *wait_frame() {
+    struct frame_slot *slot;
+    while(!(slot = frame_queue_read_slot(&q))) {
+        sched_yield();
+    }
+    if(partial) {
+        while(frame_slot_ready(slot) < slot->len) {
+            sched_yield();
+        }
+    }
+    return slot;
+}
+
+static void run(enum frame_queue_policy policy, void *(*consumer)(void *)) {
+    frame_queue_init(&q, storage, SLOT_SIZE, policy);
+    pthread_t p, c;
+    pthread_create(&c, NULL, consumer, NULL);
+    pthread_create(&p, NULL, producer, NULL);
+    pthread_join(p, NULL);
+    pthread_join(c, NULL);
+}
+
+// Every frame exactly once and in order
+static uint32_t full_seen;
+
+static void *consume_all(void *arg) {
+    (void)arg;
+    full_seen = 0;
+    for(uint32_t expected = 0; expected < FRAMES; expected++) {
+        struct frame_slot *slot = wait_frame();
+        CHECK(intact(slot->buf, expected, slot->len));
+        // The producer's counters, read while it runs like the send loop does
+        if(__atomic_load_n(&q.producer_waiting, __ATOMIC_RELAXED)) {
+            full_seen = __atomic_load_n(&q.full, __ATOMIC_RELAXED);
+        }
+        frame_queue_release(&q);
+    }
+    return NULL;
+}
+
+// Newest frame only: increasing, and every frame either read or counted as stale
+static uint32_t drop_read;
+
+static void *consume_newest(void *arg) {
+    (void)arg;
+    uint32_t last = 0;
+    drop_read = 0;
+    for(int first = 1; ; first = 0) {
+        if(drop_read % 16 == 0) {
+            // Lets the producer get ahead so there is something to drop
+            uint32_t head;
+            while((head = __atomic_load_n(&q.head, __ATOMIC_ACQUIRE)) - q.read < 2 && head != FRAMES) {
+                sched_yield();
+            }
+        }
+        struct frame_slot *slot = wait_frame();
+        uint32_t seq = frame_seq(slot->buf);
+        CHECK(intact(slot->buf, seq, slot->len));
+        CHECK(first || seq > last);
+        last = seq;
+        drop_read++;
+        frame_queue_release(&q);
+        if(seq == FRAMES - 1) {
+            return NULL;
+        }
+    }
+}
+
+// Holds the last KEPT frames, they must not change until they are given back
+static void *consume_kept(void *arg) {
+    (void)arg;
+    uint32_t oldest_kept = 0;
+    for(uint32_t expected = 0; expected < FRAMES; expected++) {
+        struct frame_slot *slot = wait_frame();
+        CHECK(intact(slot->buf, expected, slot->len));
+        if(expected % 5 == 4) {
+            // Some frames are not kept, they go back once the kept ones before them do
+            frame_queue_release(&q);
+        } else {
+            frame_queue_keep(&q);
+        }
+        while(q.read - q.tail > KEPT) {
+            struct frame_slot *old = &q.slots[q.tail % FRAME_QUEUE_SLOTS];
+            if(old->kept) {
+                while(oldest_kept % 5 == 4) {
+                    oldest_kept++;
+                }
+                CHECK(intact(old->buf, oldest_kept, old->len));
+                oldest_kept++;
+            }
+            frame_queue_release_kept(&q);
+        }
+    }
+    while(q.tail != q.read) {
+        frame_queue_release_kept(&q);
+    }
+    return NULL;
+}
+
+int main() {
+    for(partial = 0; partial < 2; partial++) {
+        run(FRAME_QUEUE_BLOCK, consume_all);
+        CHECK(full_seen <= q.full);
+
+        run(FRAME_QUEUE_DROP_OLDEST, consume_newest);
+        CHECK(drop_read + q.dropped_stale == FRAMES);
+        CHECK(q.dropped_stale > 0);
+
+        run(FRAME_QUEUE_BLOCK, consume_kept);
+        CHECK(q.head == FRAMES && q.tail == FRAMES);
+    }
+    if(failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("frame_queue_test passed\n");
+    return 0;
+}
@@ -0,0 +1,178 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "hal.h"
+#include "aes.h"
+#include "arducam.h"
+#include "streamer.h"
+#include "stream_header.h"
+#include "chacha20poly1305.h"
+#include "trace.h"
+#include "sim_camera.h"
+
+/**
+ * The sim streamer with ENCRYPT_AEAD, NACKed by a receiver for the first and the last fragment
+ * of each frame. With cut-through the first one goes out before core 1 has read the whole frame
+ * and worked out its CRC, the last one with it. A resent fragment has to be the exact datagram
+ * it was the first time but for STREAM_FLAG_RETRANSMIT: a tag over a different header under the
+ * same nonce would give away the Poly1305 key.
+ */
+
+#define PORT 20121
+// Frames to NACK, with at least one whose first fragment went out without the CRC
+#define FRAMES 6
+#define TIMEOUT_S 10
+#define MAX_DATAGRAM 2048
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if(!(cond)) { \
+        printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while(0)
+
+static const uint32_t sizes[] = { 21876, 22410, 21530, 23982 };
+static uint8_t key[STREAM_KEY_LEN] = "YOUR_KEY";
+static uint8_t iv[AES_BLOCKLEN] = "YOUR_IV";
+
+// First send of a NACKed fragment
+struct original {
+    uint8_t data[MAX_DATAGRAM];
+    ssize_t len;
+    bool resent;
+};
+
+// The first and the last fragment of the frame being NACKed
+static uint32_t frame_id;
+static uint16_t fragment_count;
+static struct original first;
+static struct original last;
+
+static void *send_thread(void *arg) {
+    (void)arg;
+    streamer_send_loop();
+    return NULL;
+}
+
+static bool verify(const uint8_t *d, ssize_t len, const struct stream_header *h) {
+    uint8_t nonce[CHACHA20_NONCELEN];
+    uint8_t aad[STREAM_HEADER_SIZE];
+    stream_auth_nonce(nonce, stream_get32(&d[STREAM_HEADER_SIZE]), h);
+    stream_auth_aad(aad, d);
+    return chacha20poly1305_verify(key, nonce, aad, sizeof(aad), &d[STREAM_HEADER_SIZE + STREAM_AUTH_SIZE],
+        len - STREAM_HEADER_SIZE - STREAM_AUTH_SIZE, &d[STREAM_HEADER_SIZE + 4]);
+}
+
+// Same datagram as the first time, STREAM_FLAG_RETRANSMIT aside
+static void check_resend(struct original *o, uint8_t *d, ssize_t len, const struct stream_header *h) {
+    CHECK(!o->resent);
+    o->resent = true;
+    CHECK(verify(d, len, h));
+    d[1] &= ~STREAM_FLAG_RETRANSMIT;
+    CHECK(len == o->len && memcmp(d, o->data, len) == 0);
+}
+
+int main() {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr))) {
+        perror("retransmit_test");
+        return 1;
+    }
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct timeval timeout = { 1, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    hal_init(8 * 1000 * 1000);
+    sim_camera_init_synthetic(sizes, sizeof(sizes) / sizeof(sizes[0]), 20000);
+    camera_start();
+    if(!hal_udp_connect("127.0.0.1", PORT)) {
+        return 1;
+    }
+    streamer_init(key, iv);
+    streamer_set_retransmit(RETRANSMIT_FRAMES, RETRANSMIT_DEADLINE_US);
+    trace_init("127.0.0.1");
+    hal_launch_core1(camera_poll);
+    pthread_t core0;
+    pthread_create(&core0, NULL, send_thread, NULL);
+
+    int nacked = 0;
+    int resent = 0;
+    // Frames whose first fragment went out without the CRC and their last one with it
+    int crc_later = 0;
+    bool waiting = false;
+    uint64_t end_us = hal_time_us() + TIMEOUT_S * 1000000ull;
+    while(resent < FRAMES && hal_time_us() < end_us) {
+        uint8_t d[MAX_DATAGRAM];
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t n = recvfrom(sock, d, sizeof(d), 0, (struct sockaddr*)&from, &from_len);
+        struct stream_header h;
+        if(n <= 0 || !stream_header_read(d, n, &h) || (h.flags & STREAM_FLAG_PARITY)) {
+            continue;
+        }
+        CHECK(h.flags & STREAM_FLAG_AEAD);
+        if(h.flags & STREAM_FLAG_RETRANSMIT) {
+            CHECK(waiting && h.frame_id == frame_id);
+            if(h.fragment == 0) {
+                check_resend(&first, d, n, &h);
+            } else {
+                CHECK(h.fragment == fragment_count - 1);
+                check_resend(&last, d, n, &h);
+            }
+            if(first.resent && last.resent) {
+                waiting = false;
+                resent++;
+            }
+            continue;
+        }
+        if(waiting) {
+            continue;
+        }
+        if(h.fragment == 0) {
+            memcpy(first.data, d, n);
+            first.len = n;
+            frame_id = h.frame_id;
+            fragment_count = h.fragment_count;
+        } else if((h.flags & STREAM_FLAG_LAST) && h.frame_id == frame_id && first.len) {
+            memcpy(last.data, d, n);
+            last.len = n;
+            CHECK(h.flags & STREAM_FLAG_CRC);
+            if(!(first.data[1] & STREAM_FLAG_CRC)) {
+                crc_later++;
+            }
+            struct stream_nack nack;
+            memset(&nack, 0, sizeof(nack));
+            nack.stream_id = h.stream_id;
+            nack.frame_id = h.frame_id;
+            nack.bitmap_len = (h.fragment_count + 7) / 8;
+            nack.bitmap[0] = 1;
+            nack.bitmap[h.fragment / 8] |= 1 << (h.fragment % 8);
+            uint8_t out[STREAM_NACK_HEADER_SIZE + STREAM_NACK_BITMAP];
+            sendto(sock, out, stream_nack_write(out, &nack), 0, (struct sockaddr*)&from, from_len);
+            first.resent = false;
+            last.resent = false;
+            waiting = true;
+            nacked++;
+        }
+    }
+    CHECK(resent == FRAMES);
+    CHECK(crc_later > 0);
+    if(failures) {
+        printf("%d checks failed, %d of %d NACKed frames resent\n", failures, resent, nacked);
+        return 1;
+    }
+    printf("retransmit_test passed, %d of %d frames had their first fragment sent before the CRC\n",
+        crc_later, resent);
+    return 0;
+}
@@ -0,0 +1,192 @@
+/**
+ * Host side benchmark of the stream's encryption modes in cycles per byte.
+ * Checks src/chacha20poly1305.c against the RFC 8439 test vectors, then encrypts a frame
+ * sized buffer the way src/streamer.c does in each mode:
+ *   CBC   AES_CBC_encrypt_buffer over the whole frame
+ *   CTR   AES-CTR per FRAME_SIZE fragment with its own counter block
+ *   AEAD  ChaCha20-Poly1305 per fragment with the stream header as additional data
+ * Cycles are read from the TSC on x86, elsewhere the clock is converted at -g GHz.
+ *
+ *   cc -O2 -Iinclude tools/aead_bench.c src/aes.c src/chacha20poly1305.c -o aead_bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "aes.h"
+#include "chacha20poly1305.h"
+#include "stream_header.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define FRAME_BYTES 30000
+#define FRAGMENT_BYTES 1400
+#define BENCH_ROUNDS 200
+
+// RFC 8439 2.5.2
+static const uint8_t poly_key[32] = {
+  0x85, 0xd6, 0xbe, 0x78, 0x57, 0x55, 0x6d, 0x33, 0x7f, 0x44, 0x52, 0xfe, 0x42, 0xd5, 0x06, 0xa8,
+  0x01, 0x03, 0x80, 0x8a, 0xfb, 0x0d, 0xb2, 0xfd, 0x4a, 0xbf, 0xf6, 0xaf, 0x41, 0x49, 0xf5, 0x1b };
+static const char poly_msg[] = "Cryptographic Forum Research Group";
+static const uint8_t poly_tag[16] = {
+  0xa8, 0x06, 0x1d, 0xc1, 0x30, 0x51, 0x36, 0xc6, 0xc2, 0x2b, 0x8b, 0xaf, 0x0c, 0x01, 0x27, 0xa9 };
+
+// RFC 8439 2.8.2
+static const char aead_plain[] =
+  "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+static const uint8_t aead_aad[12] = {
+  0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7 };
+static const uint8_t aead_nonce[12] = {
+  0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47 };
+static const uint8_t aead_cipher[114] = {
+  0xd3, 0x1a, 0x8d, 0x34, 0x64, 0x8e, 0x60, 0xdb, 0x7b, 0x86, 0xaf, 0xbc, 0x53, 0xef, 0x7e, 0xc2,
+  0xa4, 0xad, 0xed, 0x51, 0x29, 0x6e, 0x08, 0xfe, 0xa9, 0xe2, 0xb5, 0xa7, 0x36, 0xee, 0x62, 0xd6,
+  0x3d, 0xbe, 0xa4, 0x5e, 0x8c, 0xa9, 0x67, 0x12, 0x82, 0xfa, 0xfb, 0x69, 0xda, 0x92, 0x72, 0x8b,
+  0x1a, 0x71, 0xde, 0x0a, 0x9e, 0x06, 0x0b, 0x29, 0x05, 0xd6, 0xa5, 0xb6, 0x7e, 0xcd, 0x3b, 0x36,
+  0x92, 0xdd, 0xbd, 0x7f, 0x2d, 0x77, 0x8b, 0x8c, 0x98, 0x03, 0xae, 0xe3, 0x28, 0x09, 0x1b, 0x58,
+  0xfa, 0xb3, 0x24, 0xe4, 0xfa, 0xd6, 0x75, 0x94, 0x55, 0x85, 0x80, 0x8b, 0x48, 0x31, 0xd7, 0xbc,
+  0x3f, 0xf4, 0xde, 0xf0, 0x8e, 0x4b, 0x7a, 0x9d, 0xe5, 0x76, 0xd2, 0x65, 0x86, 0xce, 0xc6, 0x4b,
+  0x61, 0x16 };
+static const uint8_t aead_tag[16] = {
+  0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09, 0xe2, 0x6a, 0x7e, 0x90, 0x2e, 0xcb, 0xd0, 0x60, 0x06, 0x91 };
+
+static double ghz = 1.0;
+
+static uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)((ts.tv_sec * 1e9 + ts.tv_nsec) * ghz);
+#endif
+}
+
+static double now_s() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int check(const char *name, const uint8_t *got, const uint8_t *expected, size_t len) {
+  if(memcmp(got, expected, len) != 0) {
+    printf("%-18s test vector FAILED\n", name);
+    return 1;
+  }
+  printf("%-18s test vector ok\n", name);
+  return 0;
+}
+
+static int self_test() {
+  int failed = 0;
+  uint8_t tag[16];
+  struct poly1305_ctx poly;
+  poly1305_init(&poly, poly_key);
+  poly1305_update(&poly, (const uint8_t*)poly_msg, strlen(poly_msg));
+  poly1305_finish(&poly, tag);
+  failed |= check("Poly1305", tag, poly_tag, 16);
+
+  uint8_t key[32];
+  for(int i = 0; i < 32; i++) {
+    key[i] = 0x80 + i;
+  }
+  uint8_t buf[114];
+  memcpy(buf, aead_plain, sizeof(buf));
+  chacha20poly1305_encrypt(key, aead_nonce, aead_aad, sizeof(aead_aad), buf, sizeof(buf), tag);
+  failed |= check("AEAD ciphertext", buf, aead_cipher, sizeof(buf));
+  failed |= check("AEAD tag", tag, aead_tag, 16);
+
+  bool ok = chacha20poly1305_decrypt(key, aead_nonce, aead_aad, sizeof(aead_aad), buf, sizeof(buf), tag);
+  failed |= check("AEAD decrypt", buf, (const uint8_t*)aead_plain, sizeof(buf)) | !ok;
+  buf[7] ^= 1;
+  if(chacha20poly1305_decrypt(key, aead_nonce, aead_aad, sizeof(aead_aad), buf, sizeof(buf), tag)) {
+    printf("AEAD accepted a changed message\n");
+    failed = 1;
+  }
+  return failed;
+}
+
+struct result {
+  double cycles_per_byte;
+  double mb_per_s;
+};
+
+static void report(const char *name, struct result r) {
+  printf("%-6s %8.2f cycles/byte %9.2f MB/s\n", name, r.cycles_per_byte, r.mb_per_s);
+}
+
+int main(int argc, char **argv) {
+  if(argc == 3 && strcmp(argv[1], "-g") == 0) {
+    ghz = atof(argv[2]);
+  }
+  if(self_test()) {
+    return 1;
+  }
+
+  uint8_t aes_key[AES_KEYLEN] = "YOUR_KEY";
+  uint8_t iv[AES_BLOCKLEN] = "YOUR_IV";
+  uint8_t key[CHACHA20_KEYLEN] = "YOUR_KEY";
+  uint8_t *frame = malloc(FRAME_BYTES);
+  for(uint32_t i = 0; i < FRAME_BYTES; i++) {
+    frame[i] = (uint8_t)(i * 31 + (i >> 8));
+  }
+  uint32_t cbc_len = FRAME_BYTES - FRAME_BYTES % AES_BLOCKLEN;
+  uint32_t frags = (FRAME_BYTES + FRAGMENT_BYTES - 1) / FRAGMENT_BYTES;
+  uint64_t bytes = (uint64_t)FRAME_BYTES * BENCH_ROUNDS;
+  struct AES_ctx ctx;
+  struct result r;
+
+  AES_init_ctx_iv(&ctx, aes_key, iv);
+  double start = now_s();
+  uint64_t c = cycles();
+  for(int round = 0; round < BENCH_ROUNDS; round++) {
+    AES_CBC_encrypt_buffer(&ctx, frame, cbc_len);
+  }
+  r.cycles_per_byte = (double)(cycles() - c) / ((uint64_t)cbc_len * BENCH_ROUNDS);
+  r.mb_per_s = (double)cbc_len * BENCH_ROUNDS / (now_s() - start) / 1e6;
+  report("CBC", r);
+
+  start = now_s();
+  c = cycles();
+  for(int round = 0; round < BENCH_ROUNDS; round++) {
+    for(uint32_t i = 0; i < frags; i++) {
+      uint32_t offset = i * FRAGMENT_BYTES;
+      uint32_t len = FRAME_BYTES - offset < FRAGMENT_BYTES ? FRAME_BYTES - offset : FRAGMENT_BYTES;
+      uint8_t counter[AES_BLOCKLEN] = { 0 };
+      memcpy(counter, iv, 8);
+      stream_put32(&counter[8], round);
+      stream_put16(&counter[12], i);
+      AES_ctx_set_iv(&ctx, counter);
+      AES_CTR_xcrypt_buffer(&ctx, &frame[offset], len);
+    }
+  }
+  r.cycles_per_byte = (double)(cycles() - c) / bytes;
+  r.mb_per_s = bytes / (now_s() - start) / 1e6;
+  report("CTR", r);
+
+  struct stream_header h = { .fragment_count = frags, .frame_len = FRAME_BYTES, .fragment_size = FRAGMENT_BYTES };
+  uint8_t aad[STREAM_HEADER_SIZE];
+  uint8_t nonce[CHACHA20_NONCELEN];
+  uint8_t tag[POLY1305_TAGLEN];
+  start = now_s();
+  c = cycles();
+  for(int round = 0; round < BENCH_ROUNDS; round++) {
+    h.frame_id = round;
+    for(uint32_t i = 0; i < frags; i++) {
+      uint32_t offset = i * FRAGMENT_BYTES;
+      uint32_t len = FRAME_BYTES - offset < FRAGMENT_BYTES ? FRAME_BYTES - offset : FRAGMENT_BYTES;
+      h.fragment = i;
+      stream_header_write(aad, &h);
+      stream_auth_nonce(nonce, 0x12345678, &h);
+      chacha20poly1305_encrypt(key, nonce, aad, sizeof(aad), &frame[offset], len, tag);
+    }
+  }
+  r.cycles_per_byte = (double)(cycles() - c) / bytes;
+  r.mb_per_s = bytes / (now_s() - start) / 1e6;
+  report("AEAD", r);
+
+  free(frame);
+  return 0;
+}
@@ -0,0 +1,128 @@
+import argparse
+import subprocess
+import sys
+
+# Shows which RP2040 memory the buffers, tables and stacks of a firmware image ended up in,
+# how full every bank is and which of the hot objects share a bank (see include/sram_layout.h)
+#   python sram_layout.py --nm arm-none-eabi-nm build/Arducam_Streamer.elf
+# The cmake target <image>_layout runs it on a built image.
+
+# name, start, end
+REGIONS = [
+    ("flash", 0x10000000, 0x11000000),
+    ("SRAM0-3 striped", 0x20000000, 0x20040000),
+    ("SRAM4", 0x20040000, 0x20041000),
+    ("SRAM5", 0x20041000, 0x20042000),
+    ("SRAM0", 0x21000000, 0x21010000),
+    ("SRAM1", 0x21010000, 0x21020000),
+    ("SRAM2", 0x21020000, 0x21030000),
+    ("SRAM3", 0x21030000, 0x21040000),
+]
+
+# What the placement options move, and what else is hit on every frame
+HOT = [
+    ("frame_buffers", "frame ring (DMA writes, core 0 encrypts)"),
+    ("Te0", "AES T-table"),
+    ("sbox", "AES S-box"),
+    ("ctx", "AES round keys"),
+    ("aead_key", "ChaCha20 key"),
+    ("fec_parity", "FEC parity"),
+    ("header_blocks", "header pbuf pool"),
+    ("datagram_blocks", "datagram pbuf pool"),
+    ("udp_refs", "zero copy refs"),
+    ("Cipher", "AES Cipher() code"),
+    ("AES_CTR_xcrypt_buffer", "AES CTR loop code"),
+    ("chacha20_block", "ChaCha20 block code"),
+    ("poly1305_blocks", "Poly1305 code"),
+    ("send_frame", "send_frame() code"),
+    ("hal_udp_send", "hal_udp_send() code"),
+]
+
+# Bottom and top symbols the SDK's linker script sets for each core's stack
+STACKS = [
+    ("core 0 stack", "__StackBottom", "__StackTop"),
+    ("core 1 stack", "__StackOneBottom", "__StackOneTop"),
+]
+
+
+def region_of(addr):
+    for name, start, end in REGIONS:
+        if start <= addr < end:
+            return name
+    return None
+
+
+def read_symbols(nm, elf):
+    out = subprocess.run([nm, "-S", "--defined-only", elf], check=True, capture_output=True, text=True).stdout
+    symbols = {}
+    sized = []
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) == 4:
+            addr, size, kind, name = int(parts[0], 16), int(parts[1], 16), parts[2], parts[3]
+            sized.append((name, addr, size, kind))
+        elif len(parts) == 3:
+            addr, kind, name = int(parts[0], 16), parts[1], parts[2]
+        else:
+            continue
+        symbols[name] = addr
+    return symbols, sized
+
+
+def main():
+    parser = argparse.ArgumentParser(description="RP2040 SRAM bank layout of a firmware image")
+    parser.add_argument("elf")
+    parser.add_argument("--nm", default="arm-none-eabi-nm")
+    parser.add_argument("--top", type=int, default=5, help="largest symbols listed per region")
+    args = parser.parse_args()
+
+    symbols, sized = read_symbols(args.nm, args.elf)
+
+    used = {}
+    largest = {}
+    for name, addr, size, kind in sized:
+        region = region_of(addr)
+        # Code stays in flash, only data in RAM is of interest there
+        if region is None or (region == "flash" and kind.lower() == "t"):
+            continue
+        used[region] = used.get(region, 0) + size
+        largest.setdefault(region, []).append((size, name))
+
+    print("%-16s %10s %10s %6s" % ("region", "used B", "size B", "full"))
+    for name, start, end in REGIONS:
+        if name not in used or name == "flash":
+            continue
+        print("%-16s %10d %10d %5d%%" % (name, used[name], end - start, used[name] * 100 // (end - start)))
+        for size, sym in sorted(largest[name], reverse=True)[:args.top]:
+            print("    %-28s %8d" % (sym, size))
+
+    print()
+    placed = []
+    for sym, what in HOT:
+        entry = next((e for e in sized if e[0] == sym), None)
+        if entry is None:
+            continue
+        region = region_of(entry[1])
+        placed.append((what, region))
+        print("%-40s %-16s 0x%08x %7d B" % (what, region or "?", entry[1], entry[2]))
+    for what, bottom, top in STACKS:
+        if bottom in symbols and top in symbols:
+            region = region_of(symbols[bottom])
+            placed.append((what, region))
+            print("%-40s %-16s 0x%08x %7d B" % (what, region or "?", symbols[bottom], symbols[top] - symbols[bottom]))
+    if "core1_stack" in symbols:
+        region = region_of(symbols["core1_stack"])
+        placed.append(("core 1 stack", region))
+        print("%-40s %-16s 0x%08x" % ("core 1 stack (CORE1_STACK_SRAM)", region or "?", symbols["core1_stack"]))
+
+    # The frame ring is what the DMA writes while core 0 encrypts, anything sharing its bank can stall
+    frames = next((region for what, region in placed if what.startswith("frame ring")), None)
+    if frames and frames != "flash":
+        shared = [what for what, region in placed if region == frames and not what.startswith("frame ring")]
+        if shared:
+            print("\nSharing %s with the frame ring: %s" % (frames, ", ".join(shared)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
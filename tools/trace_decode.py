@@ -0,0 +1,131 @@
+import argparse
+import json
+import socket
+import struct
+import sys
+import time
+
+# Turns the trace batches written by src/trace.c into Chrome trace JSON
+# (open it in chrome://tracing or https://ui.perfetto.dev)
+#
+# From a USB serial log (or the simulator's stdout), the "T:<hex>" lines are picked out:
+#   python trace_decode.py serial.log -o trace.json
+# From the UDP side channel (TRACE_SINK_UDP):
+#   python trace_decode.py --udp 20002 --seconds 10 -o trace.json
+
+TRACE_VERSION = 1
+HEADER = struct.Struct("<2sBBHH")
+EVENT = struct.Struct("<IHH")
+
+# Same ids as enum trace_id in include/trace.h
+EVENTS = {
+    1: ("capture", "B"),
+    2: ("capture", "E"),
+    3: ("readout", "B"),
+    4: ("readout", "E"),
+    5: ("wait for slot", "B"),
+    6: ("wait for slot", "E"),
+    7: ("wait for frame", "B"),
+    8: ("wait for frame", "E"),
+    9: ("send frame", "B"),
+    10: ("send frame", "E"),
+    11: ("send error", "i"),
+    12: ("camera reset", "i"),
+    13: ("retransmit", "i"),
+    14: ("rate change", "i"),
+    15: ("corrupt frame", "i"),
+}
+
+
+class Decoder:
+    def __init__(self):
+        self.events = []
+        # Per core: last raw 32 bit timestamp and how many times it wrapped
+        self.last_time = {}
+        self.wraps = {}
+
+    def timestamp(self, core, raw):
+        # The device only sends the low 32 bits of its microsecond clock
+        last = self.last_time.get(core)
+        if last is not None and raw < last and last - raw > 0x80000000:
+            self.wraps[core] = self.wraps.get(core, 0) + 1
+        self.last_time[core] = raw
+        return self.wraps.get(core, 0) * 0x100000000 + raw
+
+    def batch(self, data):
+        if len(data) < HEADER.size:
+            return
+        magic, version, core, lost, count = HEADER.unpack_from(data)
+        if magic != b"TR" or version != TRACE_VERSION:
+            print("Skipping unknown batch", file=sys.stderr)
+            return
+        if lost:
+            ts = self.events[-1]["ts"] if self.events else 0
+            self.events.append({"name": "lost %d events" % lost, "ph": "i", "s": "t",
+                                "ts": ts, "pid": 0, "tid": core})
+        for i in range(count):
+            offset = HEADER.size + i * EVENT.size
+            if offset + EVENT.size > len(data):
+                break
+            raw, event_id, arg = EVENT.unpack_from(data, offset)
+            name, phase = EVENTS.get(event_id, ("event %d" % event_id, "i"))
+            event = {"name": name, "ph": phase, "ts": self.timestamp(core, raw),
+                     "pid": 0, "tid": core, "args": {"arg": arg}}
+            if phase == "i":
+                event["s"] = "t"
+            self.events.append(event)
+
+    def json(self):
+        names = [{"name": "thread_name", "ph": "M", "pid": 0, "tid": core,
+                  "args": {"name": "core %d" % core}} for core in (0, 1)]
+        return {"traceEvents": names + self.events, "displayTimeUnit": "ms"}
+
+
+def read_log(path, decoder):
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.strip()
+            if line.startswith("T:"):
+                try:
+                    decoder.batch(bytes.fromhex(line[2:]))
+                except ValueError:
+                    # Line cut off in the log
+                    pass
+
+
+def read_udp(port, seconds, decoder):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("0.0.0.0", port))
+    sock.settimeout(0.5)
+    end = time.time() + seconds
+    while time.time() < end:
+        try:
+            data, _ = sock.recvfrom(4096)
+        except socket.timeout:
+            continue
+        decoder.batch(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode pipeline traces into Chrome trace JSON")
+    parser.add_argument("log", nargs="?", help="serial log or simulator output with T: lines")
+    parser.add_argument("--udp", type=int, help="receive batches on this UDP port instead")
+    parser.add_argument("--seconds", type=float, default=10, help="how long to receive for")
+    parser.add_argument("-o", "--output", default="trace.json")
+    args = parser.parse_args()
+
+    decoder = Decoder()
+    if args.udp:
+        read_udp(args.udp, args.seconds, decoder)
+    elif args.log:
+        read_log(args.log, decoder)
+    else:
+        parser.error("give a log file or --udp")
+
+    with open(args.output, "w") as f:
+        json.dump(decoder.json(), f)
+    print("Wrote %d events to %s" % (len(decoder.events), args.output))
+
+
+if __name__ == "__main__":
+    main()
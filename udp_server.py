@@ -2,8 +2,10 @@ import socket
 import cv2
 import numpy as np
 from Crypto.Cipher import AES 
+from Crypto.Cipher import ChaCha20_Poly1305
 from Crypto.Util.Padding import unpad 
 import binascii
+import zlib
 
 # Simple demo server implementation which can be used for testing
 
@@ -28,35 +30,198 @@ print("UDP server up and listening")
 
 key = 'YOUR_KEY'.encode('ascii')
 iv = 'YOUR_IV'.encode('ascii')
-cipher = AES.new(key, AES.MODE_CBC, iv) 
+# ENCRYPT_AEAD uses the whole 32 byte key, zero padded like the firmware's
+aead_key = key.ljust(32, b'\0')
 
-# Listen for incoming datagrams
-buffer = np.array([],dtype=np.uint8)
+# CBC chains across frames, the firmware keeps encrypting with the last frame's final block as IV
+cipher = AES.new(key, AES.MODE_CBC, iv)
+
+# Stream header in front of every fragment, see include/stream_header.h
+HEADER_VERSION = 4
+HEADER_SIZE = 28
+FLAG_LAST = 0x01
+FLAG_CBC = 0x02
+FLAG_PARITY = 0x04
+FLAG_RETRANSMIT = 0x08
+FLAG_PLAIN = 0x10
+FLAG_AEAD = 0x20
+# frame_crc holds the CRC-32 of the frame as read from the camera
+FLAG_CRC = 0x40
+# Session and Poly1305 tag between the header and the payload with FLAG_AEAD
+AUTH_SIZE = 20
+# Counter fragment value the firmware encrypts parity fragments with, see include/fec.h
+PARITY_COUNTER = 0x8000
+# Frames older than the newest one by more than this are given up on
+MAX_PENDING = 4
+# A frame id this far behind the last one shown means the camera restarted its count,
+# the same gap as RESTART_GAP in receiver/frame_assembler.cpp
+RESTART_GAP = 1000
+
+# Counter block: IV[0..7] | frame id (32 bit BE) | fragment index (16 bit BE) | block counter (16 bit BE)
+def decrypt_fragment(data, frame_id, frag):
+    nonce = iv[:8] + frame_id.to_bytes(4, 'big') + frag.to_bytes(2, 'big')
+    return AES.new(key, AES.MODE_CTR, nonce=nonce, initial_value=0).decrypt(data)
+
+def xor_into(dst, src):
+    for i in range(len(src)):
+        dst[i] ^= src[i]
+
+class Frame:
+    def __init__(self, length, count, frag_size, flags, fec_group):
+        # Allocated from whichever fragment arrives first, every fragment carries the frame length
+        self.data = bytearray(length)
+        self.received = [False] * count
+        self.remaining = count
+        self.frag_size = frag_size
+        self.flags = flags
+        # Parity fragments by group, as sent (CBC) or decrypted (CTR)
+        self.fec_group = fec_group
+        self.parity = {}
+        # With cut-through only the fragments sent after the camera readout carry it
+        self.crc = None
+
+    def missing(self):
+        return [i for i, got in enumerate(self.received) if not got]
+
+    def fragment(self, index):
+        offset = index * self.frag_size
+        return self.data[offset:min(offset + self.frag_size, len(self.data))]
+
+    def recover(self, group):
+        # XOR of the parity and every other fragment of the group is the one that is missing
+        if not self.fec_group or group not in self.parity:
+            return
+        first = group * self.fec_group
+        indices = range(first, min(first + self.fec_group, len(self.received)))
+        missing = [i for i in indices if not self.received[i]]
+        if len(missing) != 1:
+            return
+        rebuilt = bytearray(self.parity[group])
+        for i in indices:
+            if i != missing[0]:
+                xor_into(rebuilt, self.fragment(i))
+        offset = missing[0] * self.frag_size
+        length = len(self.fragment(missing[0]))
+        self.data[offset:offset + length] = rebuilt[:length]
+        self.received[missing[0]] = True
+        self.remaining -= 1
+        print("Frame recovered fragment %d from parity" % missing[0])
+
+# Frames still being put together, by frame id
+pending = {}
+last_shown = -1
 while True:
     # Receive data from the client
     data, addr = UDPServerSocket.recvfrom(bufferSize)
+    if len(data) < HEADER_SIZE or data[0] != HEADER_VERSION:
+        print("Unknown packet")
+        continue
+
+    flags = data[1]
+    frag = int.from_bytes(data[2:4], 'big')
+    frame_id = int.from_bytes(data[4:8], 'big')
+    frame_len = int.from_bytes(data[8:12], 'big')
+    count = int.from_bytes(data[12:14], 'big')
+    frag_size = int.from_bytes(data[14:16], 'big')
+    timestamp = int.from_bytes(data[16:20], 'big')
+    fec_group = int.from_bytes(data[22:24], 'big')
+    frame_crc = int.from_bytes(data[24:28], 'big')
+    payload = data[HEADER_SIZE:]
+    if flags & FLAG_AEAD:
+        # Nonce: session | frame id | fragment | stream id, the tag covers the header without the retransmit flag
+        session = data[HEADER_SIZE:HEADER_SIZE + 4]
+        tag = data[HEADER_SIZE + 4:HEADER_SIZE + AUTH_SIZE]
+        nonce_frag = frag | PARITY_COUNTER if flags & FLAG_PARITY else frag
+        nonce = session + data[4:8] + nonce_frag.to_bytes(2, 'big') + data[20:22]
+        aad = bytearray(data[:HEADER_SIZE])
+        aad[1] &= ~FLAG_RETRANSMIT
+        aead = ChaCha20_Poly1305.new(key=aead_key, nonce=nonce)
+        aead.update(bytes(aad))
+        try:
+            payload = aead.decrypt_and_verify(data[HEADER_SIZE + AUTH_SIZE:], tag)
+        except ValueError:
+            print("Fragment failed authentication")
+            continue
+        # Decrypted already, from here on it is handled like a plain fragment
+        flags |= FLAG_PLAIN
+    # The header is not encrypted
+    print("ID: %d FRAGMENT: %d/%d LAST: %d TIME: %d" % (frame_id, frag, count, flags & FLAG_LAST, timestamp))
 
-    np_data = np.frombuffer(data, dtype=np.uint8)
-    # Gets rid of metadata
-    buffer = np.append(buffer, np_data[:-3])
-    # Each fragmented image frame has some metadata ID, ORDER and COMPLETE which is not encrypted
-    print("ID: %x ORDER: %x COMPLETE: %x" % (np_data[-3], np_data[-2], np_data[-1]))
-    if(np_data[-1] == 0):
+    if frame_id <= last_shown:
+        if last_shown - frame_id < RESTART_GAP:
+            # Late fragment of a frame that was already shown or given up on
+            continue
+        # Camera rebooted and counts from 0 again, nothing from before is coming anymore
+        print("Frame ids restarted at %d" % frame_id)
+        last_shown = -1
+        pending.clear()
+        # CBC chains from the IV again, like the firmware's fresh context
+        cipher = AES.new(key, AES.MODE_CBC, iv)
+    if flags & FLAG_PARITY:
+        if not fec_group or frag * fec_group >= count:
+            continue
+    elif frag >= count:
+        continue
+    frame = pending.get(frame_id)
+    if frame is None:
+        frame = pending[frame_id] = Frame(frame_len, count, frag_size, flags & ~FLAG_PARITY, fec_group)
+        # Drops frames that fell too far behind, their missing fragments won't come anymore
+        for old in [i for i in pending if i < frame_id - MAX_PENDING]:
+            print("Frame %d dropped, missing fragments %s" % (old, pending[old].missing()))
+            del pending[old]
+    if flags & FLAG_CRC:
+        frame.crc = frame_crc
+    if flags & FLAG_PARITY:
+        # CTR parity is over the plaintext, CBC parity over the ciphertext as sent
+        if frag not in frame.parity:
+            frame.parity[frag] = payload if frame.flags & (FLAG_CBC | FLAG_PLAIN) else decrypt_fragment(payload, frame_id, PARITY_COUNTER | frag)
+            frame.recover(frag)
+    elif frame.received[frag]:
+        continue
+    else:
+        # Every fragment goes straight to its place in the frame
+        offset = frag * frame.frag_size
+        if flags & (FLAG_CBC | FLAG_PLAIN):
+            frame.data[offset:offset + len(payload)] = payload
+        else:
+            # Every fragment decrypts on its own, lost fragments only leave a hole in the image
+            frame.data[offset:offset + len(payload)] = decrypt_fragment(payload, frame_id, frag)
+        frame.received[frag] = True
+        frame.remaining -= 1
+        if fec_group:
+            frame.recover(frag // fec_group)
+    if flags & FLAG_LAST and frame.remaining:
+        print("Frame %d missing fragments %s" % (frame_id, frame.missing()))
+    if frame.remaining:
         continue
-    
-    try: 
-        buffer = np.frombuffer(unpad(cipher.decrypt(bytearray(buffer.tobytes())), 16), dtype=np.uint8)
-        frame = cv2.imdecode(buffer, cv2.IMREAD_COLOR)
-    except:
-        print("Failed to decrypt\n")
-    
-    if frame is not None:
+
+    del pending[frame_id]
+    last_shown = frame_id
+    # Anything older can't be shown anymore
+    for old in [i for i in pending if i < frame_id]:
+        del pending[old]
+
+    image = None
+    jpeg = None
+    if frame.flags & FLAG_CBC:
+        try:
+            jpeg = unpad(cipher.decrypt(bytes(frame.data)), 16)
+        except:
+            print("Failed to decrypt\n")
+    else:
+        jpeg = bytes(frame.data)
+    if jpeg is not None and frame.crc is not None and zlib.crc32(jpeg) != frame.crc:
+        print("Frame %d failed its CRC" % frame_id)
+        jpeg = None
+    if jpeg is not None:
+        image = cv2.imdecode(np.frombuffer(jpeg, dtype=np.uint8), cv2.IMREAD_COLOR)
+
+    if image is not None:
         #print("Showing")
-        cv2.imshow('MJPEG Stream', frame)
-    
+        cv2.imshow('MJPEG Stream', image)
+
     if cv2.waitKey(1) & 0xFF == ord('q'):
         break
-    buffer = np.array([], dtype=np.uint8)
 
 UDPServerSocket.close()
-cv2.destroyAllWindows()
\ No newline at end of file
+cv2.destroyAllWindows()